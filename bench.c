@@ -0,0 +1,390 @@
+#define FIT_IMPLEMENTATION
+#include "fit.h"
+
+// Times the common commands on synthetic trees and writes the results as JSON, so runs can be
+// compared between machines and releases. Build it like main.c and run
+//
+//   bench <scratch dir> [--workload name] [--runs n] [--scale f] [--seed n] [--out results.json]
+//
+// Each workload gets its own directory below <scratch dir>. The trees are generated from the seed,
+// so the same arguments always produce the same files. Files are read back from the page cache,
+// so these are warm numbers.
+
+typedef struct FIT_BenchWorkload {
+	const char *name;
+	uint32_t fileCount;
+	uint64_t minSize;
+	uint64_t maxSize;
+	double changeRate;
+} FIT_BenchWorkload;
+
+// Sizes are spread evenly over the powers of two between the min and max, so each workload has lots of
+// small files and a few big ones.
+static const FIT_BenchWorkload FIT_BENCH_WORKLOADS[] = {
+	{ "small-files", 20000, 256, 16 * 1024, 0.01 },
+	{ "mixed", 2000, 64, 1024 * 1024, 0.01 },
+	{ "large-files", 32, 1024 * 1024, 16 * 1024 * 1024, 0.01 },
+	{ "high-churn", 2000, 64, 256 * 1024, 0.25 },
+};
+#define FIT_BENCH_WORKLOAD_COUNT (sizeof(FIT_BENCH_WORKLOADS) / sizeof(FIT_BENCH_WORKLOADS[0]))
+
+#define FIT_BENCH_FILES_PER_DIRECTORY 64
+#define FIT_BENCH_MAX_RUNS 64
+
+typedef enum FIT_BenchStep {
+	FIT_BENCH_CREATE_TRACK_ALL_SAVE,
+	FIT_BENCH_SAVE_UNCHANGED,
+	FIT_BENCH_SAVE_CHANGED,
+	FIT_BENCH_OPEN,
+	FIT_BENCH_LOAD_OLDEST,
+	FIT_BENCH_DELETE_OLDEST,
+
+	FIT_BENCH_STEP_COUNT
+} FIT_BenchStep;
+
+static const char *FIT_BENCH_STEP_NAMES[FIT_BENCH_STEP_COUNT] = {
+	"create_track_all_save",
+	"save_unchanged",
+	"save_changed",
+	"open",
+	"load_oldest",
+	"delete_oldest",
+};
+
+typedef struct FIT_BenchResult {
+	uint64_t nanoseconds[FIT_BENCH_STEP_COUNT][FIT_BENCH_MAX_RUNS];
+	// how many bytes each step had to read or write, for the throughput
+	uint64_t stepBytes[FIT_BENCH_STEP_COUNT];
+	uint64_t totalBytes;
+	uint64_t storeBytes;
+	uint32_t changedCount;
+} FIT_BenchResult;
+
+static uint64_t FIT_BenchNext(uint64_t *state) {
+	// xorshift64*
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1Dull;
+}
+
+static uint64_t FIT_BenchFileSize(const FIT_BenchWorkload *workload, uint32_t index, uint64_t seed) {
+	uint64_t state = (seed ^ ((uint64_t)index * 0x9E3779B97F4A7C15ull)) | 1;
+	uint32_t minShift = 0;
+	uint32_t maxShift = 0;
+	while ((2ull << minShift) <= workload->minSize) minShift++;
+	while ((2ull << maxShift) <= workload->maxSize) maxShift++;
+
+	uint32_t shift = minShift + (uint32_t)(FIT_BenchNext(&state) % (maxShift - minShift + 1));
+	uint64_t size = (1ull << shift) + FIT_BenchNext(&state) % (1ull << shift);
+	return size < workload->minSize ? workload->minSize : size > workload->maxSize ? workload->maxSize : size;
+}
+
+// The commands log every file, which would swamp the results and time the terminal. Only the
+// last message is kept, to say why a step failed.
+static char FIT_benchLastMessage[FIT_MAX_ENTRY_PATH + 1024];
+
+static void FIT_BenchKeepLastLog(const char *message, void *user) {
+	(void)user;
+	strncpy(FIT_benchLastMessage, message, sizeof(FIT_benchLastMessage) - 1);
+}
+
+static int FIT_BenchMakeDirectory(const char *path) {
+#ifdef _WIN32
+	return CreateDirectoryA(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+	return mkdir(path, 0777) == 0 || errno == EEXIST;
+#endif
+}
+
+// Writes file [index] of the tree, [version] 0 is the original contents and anything else a change.
+static int FIT_BenchWriteFile(const char *root, const FIT_BenchWorkload *workload, uint32_t index, uint32_t version, uint64_t seed, char *scratch, uint64_t *size) {
+	char path[FIT_MAX_PATH];
+	snprintf(path, sizeof(path), "%s/d%04u", root, index / FIT_BENCH_FILES_PER_DIRECTORY);
+	FIT_ASSERT_LOG_RETURN(FIT_BenchMakeDirectory(path), "Unable to make directory [%s].", path);
+	snprintf(path, sizeof(path), "%s/d%04u/f%06u.bin", root, index / FIT_BENCH_FILES_PER_DIRECTORY, index);
+
+	*size = FIT_BenchFileSize(workload, index, seed);
+	uint64_t state = (seed + index * 0xD1B54A32D192ED03ull + version * 0x8CB92BA72F3D8DD7ull) | 1;
+
+	FILE *file = fopen(path, "wb");
+	FIT_ASSERT_LOG_RETURN(file, "Unable to open [%s] to write.", path);
+
+	uint64_t remaining = *size;
+	int result = 1;
+	while (remaining && result) {
+		uint64_t len = remaining < (1 << 20) ? remaining : (1 << 20);
+		for (uint64_t i = 0; i < len; i += 8) {
+			uint64_t value = FIT_BenchNext(&state);
+			memcpy(&scratch[i], &value, 8);
+		}
+		result = fwrite(scratch, (size_t)len, 1, file) == 1;
+		remaining -= len;
+	}
+	result = (fclose(file) == 0) && result;
+	FIT_ASSERT_LOG_RETURN(result, "Unable to write [%s].", path);
+	return 1;
+}
+
+static int FIT_BenchRunCommand(int argc, char *argv[]) {
+	FIT_Context ctx;
+	FIT_ContextInit(&ctx);
+	ctx.nonInteractive = 1;
+	int result = FIT_Run(&ctx, argc, argv);
+	FIT_ContextDeinit(&ctx);
+	return result;
+}
+
+static int FIT_BenchRunWorkload(const char *scratchDir, const FIT_BenchWorkload *workload, uint32_t runCount, uint64_t seed, FIT_BenchResult *result) {
+	memset(result, 0, sizeof(FIT_BenchResult));
+
+	char root[FIT_MAX_PATH];
+	char storePath[FIT_MAX_PATH];
+	int len = snprintf(root, sizeof(root), "%s/%s", scratchDir, workload->name);
+	FIT_ASSERT_LOG_RETURN(len > 0 && len + 32 < FIT_MAX_PATH, "The scratch directory [%s] is too long.", scratchDir);
+	snprintf(storePath, sizeof(storePath), "%.*s/bench.fit", len, root);
+	FIT_ASSERT_LOG_RETURN(FIT_BenchMakeDirectory(root), "Unable to make directory [%s].", root);
+
+	char *scratch = (char *)malloc(1 << 20);
+	FIT_ASSERT_LOG_RETURN(scratch, "Out of memory. Unable to allocate the scratch buffer.");
+
+	// Spread the changes over the whole tree rather than the first few directories.
+	result->changedCount = (uint32_t)(workload->fileCount * workload->changeRate + 0.5);
+	if (result->changedCount == 0 && workload->changeRate > 0) {
+		result->changedCount = 1;
+	}
+	uint32_t changeStride = result->changedCount ? workload->fileCount / result->changedCount : 0;
+
+	int ok = 1;
+	for (uint32_t run = 0; run < runCount && ok; run++) {
+		// Every run starts from the same tree and an empty store.
+		result->totalBytes = 0;
+		for (uint32_t i = 0; i < workload->fileCount && ok; i++) {
+			uint64_t size = 0;
+			ok = FIT_BenchWriteFile(root, workload, i, 0, seed, scratch, &size);
+			result->totalBytes += size;
+		}
+		remove(storePath);
+		if (!ok) {
+			break;
+		}
+
+		char *createArgs[] = { "fit", "create_track_all_save", storePath };
+		char *saveArgs[] = { "fit", "save", storePath };
+		char *loadArgs[] = { "fit", "load", storePath, "0" };
+		char *deleteArgs[] = { "fit", "delete", storePath, "0" };
+
+		uint64_t start = FIT_GetTimeNanoseconds();
+		ok = FIT_BenchRunCommand(3, createArgs);
+		result->nanoseconds[FIT_BENCH_CREATE_TRACK_ALL_SAVE][run] = FIT_GetTimeNanoseconds() - start;
+		result->stepBytes[FIT_BENCH_CREATE_TRACK_ALL_SAVE] = result->totalBytes;
+		if (!ok) {
+			break;
+		}
+
+		start = FIT_GetTimeNanoseconds();
+		ok = FIT_BenchRunCommand(3, saveArgs);
+		result->nanoseconds[FIT_BENCH_SAVE_UNCHANGED][run] = FIT_GetTimeNanoseconds() - start;
+		result->stepBytes[FIT_BENCH_SAVE_UNCHANGED] = result->totalBytes;
+		if (!ok) {
+			break;
+		}
+
+		uint64_t changedBytes = 0;
+		for (uint32_t i = 0; i < result->changedCount && ok; i++) {
+			uint64_t size = 0;
+			ok = FIT_BenchWriteFile(root, workload, i * changeStride, run + 1, seed, scratch, &size);
+			changedBytes += size;
+		}
+		if (!ok) {
+			break;
+		}
+
+		start = FIT_GetTimeNanoseconds();
+		ok = FIT_BenchRunCommand(3, saveArgs);
+		result->nanoseconds[FIT_BENCH_SAVE_CHANGED][run] = FIT_GetTimeNanoseconds() - start;
+		result->stepBytes[FIT_BENCH_SAVE_CHANGED] = result->totalBytes;
+		if (!ok) {
+			break;
+		}
+
+		FIT_Context ctx;
+		FIT_ContextInit(&ctx);
+		start = FIT_GetTimeNanoseconds();
+		ok = FIT_LoadFileStoreAndSetWorkingDirectory(&ctx, storePath);
+		result->nanoseconds[FIT_BENCH_OPEN][run] = FIT_GetTimeNanoseconds() - start;
+		result->storeBytes = ctx.fsData.bufferCount;
+		result->stepBytes[FIT_BENCH_OPEN] = ctx.fsData.bufferCount;
+		FIT_ContextDeinit(&ctx);
+		if (!ok) {
+			break;
+		}
+
+		// Only the changed files differ from the oldest snapshot.
+		start = FIT_GetTimeNanoseconds();
+		ok = FIT_BenchRunCommand(4, loadArgs);
+		result->nanoseconds[FIT_BENCH_LOAD_OLDEST][run] = FIT_GetTimeNanoseconds() - start;
+		result->stepBytes[FIT_BENCH_LOAD_OLDEST] = changedBytes;
+		if (!ok) {
+			break;
+		}
+
+		start = FIT_GetTimeNanoseconds();
+		ok = FIT_BenchRunCommand(4, deleteArgs);
+		result->nanoseconds[FIT_BENCH_DELETE_OLDEST][run] = FIT_GetTimeNanoseconds() - start;
+		result->stepBytes[FIT_BENCH_DELETE_OLDEST] = result->storeBytes;
+	}
+
+	free(scratch);
+	return ok;
+}
+
+static int FIT_BenchCompare(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+// The separator goes before each record rather than after it, so a workload that fails
+// part way through never leaves a trailing comma.
+static void FIT_BenchWriteJson(FILE *out, const FIT_BenchWorkload *workload, const FIT_BenchResult *result, uint32_t runCount, int first) {
+	fprintf(out, "%s\t\t{\n", first ? "" : ",\n");
+	fprintf(out, "\t\t\t\"name\": \"%s\",\n", workload->name);
+	fprintf(out, "\t\t\t\"files\": %u,\n", workload->fileCount);
+	fprintf(out, "\t\t\t\"bytes\": %llu,\n", (unsigned long long)result->totalBytes);
+	fprintf(out, "\t\t\t\"minFileSize\": %llu,\n", (unsigned long long)workload->minSize);
+	fprintf(out, "\t\t\t\"maxFileSize\": %llu,\n", (unsigned long long)workload->maxSize);
+	fprintf(out, "\t\t\t\"changeRate\": %g,\n", workload->changeRate);
+	fprintf(out, "\t\t\t\"changedFiles\": %u,\n", result->changedCount);
+	fprintf(out, "\t\t\t\"storeBytes\": %llu,\n", (unsigned long long)result->storeBytes);
+	fprintf(out, "\t\t\t\"steps\": {\n");
+
+	for (uint32_t step = 0; step < FIT_BENCH_STEP_COUNT; step++) {
+		uint64_t sorted[FIT_BENCH_MAX_RUNS];
+		memcpy(sorted, result->nanoseconds[step], runCount * sizeof(uint64_t));
+		qsort(sorted, runCount, sizeof(uint64_t), FIT_BenchCompare);
+
+		double median = (double)(sorted[(runCount - 1) / 2] + sorted[runCount / 2]) / 2e6;
+		double bytesPerSecond = median > 0.0 ? (double)result->stepBytes[step] * 1e3 / median : 0.0;
+
+		fprintf(out, "\t\t\t\t\"%s\": { \"minMs\": %.3f, \"medianMs\": %.3f, \"maxMs\": %.3f, \"bytes\": %llu, \"megabytesPerSecond\": %.1f, \"runsMs\": [",
+			FIT_BENCH_STEP_NAMES[step], (double)sorted[0] / 1e6, median, (double)sorted[runCount - 1] / 1e6,
+			(unsigned long long)result->stepBytes[step], bytesPerSecond / 1e6);
+		for (uint32_t run = 0; run < runCount; run++) {
+			fprintf(out, "%s%.3f", run ? ", " : "", (double)result->nanoseconds[step][run] / 1e6);
+		}
+		fprintf(out, "] }%s\n", step + 1 < FIT_BENCH_STEP_COUNT ? "," : "");
+	}
+
+	fprintf(out, "\t\t\t}\n");
+	fprintf(out, "\t\t}");
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2 || argv[1][0] == '-') {
+		printf("bench <scratch dir> [--workload name] [--runs n] [--scale f] [--seed n] [--out results.json]\n");
+		printf("workloads:");
+		for (uint32_t i = 0; i < FIT_BENCH_WORKLOAD_COUNT; i++) {
+			printf(" %s", FIT_BENCH_WORKLOADS[i].name);
+		}
+		printf("\n");
+		return 0;
+	}
+
+	const char *scratchDir = argv[1];
+	const char *workloadName = NULL;
+	const char *outPath = NULL;
+	uint32_t runCount = 3;
+	double scale = 1.0;
+	uint64_t seed = 1;
+
+	for (int i = 2; i + 1 < argc; i += 2) {
+		if (strcmp(argv[i], "--workload") == 0) {
+			workloadName = argv[i + 1];
+		}
+		else if (strcmp(argv[i], "--runs") == 0) {
+			runCount = (uint32_t)strtoul(argv[i + 1], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--scale") == 0) {
+			scale = strtod(argv[i + 1], NULL);
+		}
+		else if (strcmp(argv[i], "--seed") == 0) {
+			seed = strtoull(argv[i + 1], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--out") == 0) {
+			outPath = argv[i + 1];
+		}
+		else {
+			fprintf(stderr, "Unknown option [%s].\n", argv[i]);
+			return 1;
+		}
+	}
+	if (runCount < 1 || runCount > FIT_BENCH_MAX_RUNS || scale <= 0.0) {
+		fprintf(stderr, "--runs has to be between 1 and %d, and --scale above 0.\n", FIT_BENCH_MAX_RUNS);
+		return 1;
+	}
+
+	if (!FIT_BenchMakeDirectory(scratchDir)) {
+		fprintf(stderr, "Unable to make directory [%s].\n", scratchDir);
+		return 1;
+	}
+
+	FILE *out = outPath ? fopen(outPath, "w") : stdout;
+	if (!out) {
+		fprintf(stderr, "Unable to open [%s] to write the results.\n", outPath);
+		return 1;
+	}
+
+	FIT_SetLogProc(FIT_BenchKeepLastLog, NULL);
+
+	fprintf(out, "{\n");
+	fprintf(out, "\t\"seed\": %llu,\n", (unsigned long long)seed);
+	fprintf(out, "\t\"runs\": %u,\n", runCount);
+	fprintf(out, "\t\"scale\": %g,\n", scale);
+	fprintf(out, "\t\"workloads\": [\n");
+
+	FIT_BenchResult *result = (FIT_BenchResult *)malloc(sizeof(FIT_BenchResult));
+	int ok = result != NULL;
+
+	uint32_t ranCount = 0;
+	for (uint32_t i = 0; i < FIT_BENCH_WORKLOAD_COUNT && ok; i++) {
+		if (workloadName && strcmp(workloadName, FIT_BENCH_WORKLOADS[i].name) != 0) {
+			continue;
+		}
+
+		FIT_BenchWorkload workload = FIT_BENCH_WORKLOADS[i];
+		workload.fileCount = (uint32_t)(workload.fileCount * scale);
+		if (workload.fileCount == 0) {
+			workload.fileCount = 1;
+		}
+
+		fprintf(stderr, "%s: %u files, %u runs\n", workload.name, workload.fileCount, runCount);
+		ok = FIT_BenchRunWorkload(scratchDir, &workload, runCount, seed, result);
+		if (!ok) {
+			fprintf(stderr, "The [%s] workload failed. %s\n", workload.name, FIT_benchLastMessage);
+		}
+		else {
+			FIT_BenchWriteJson(out, &workload, result, runCount, ranCount == 0);
+			ranCount++;
+		}
+	}
+
+	fprintf(out, "%s\t]\n", ranCount ? "\n" : "");
+	fprintf(out, "}\n");
+	if (out != stdout) {
+		fclose(out);
+	}
+	free(result);
+
+	FIT_SetLogProc(NULL, NULL);
+	if (!ok) {
+		return 1;
+	}
+	if (ranCount == 0) {
+		fprintf(stderr, "There is no workload called [%s].\n", workloadName);
+		return 1;
+	}
+	return 0;
+}
@@ -5,9 +5,35 @@
 #ifndef FIT_H
 #define FIT_H
 
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/sendfile.h>
+#endif
 #endif
 
 #include <stdlib.h>
@@ -16,11 +42,66 @@
 #include <stdarg.h>
 #include <assert.h>
 #include <stdint.h>
+#include <time.h>
+
+// SSE2 is always there on x64, the line diff uses it to find line ends.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FIT_SSE2 1
+#include <emmintrin.h>
+#else
+#define FIT_SSE2 0
+#endif
+
+// Define FIT_USE_IO_URING before including this file to read tracked files in batches
+// through io_uring on Linux. Without it, or when the kernel refuses, stdio is used.
+#if defined(FIT_USE_IO_URING) && defined(__linux__)
+#define FIT_IO_URING 1
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#else
+#define FIT_IO_URING 0
+#endif
+
+// How many files are opened, sized and read together by the batched backend.
+#define FIT_PREFETCH_BATCH_SIZE 64
+
+#define FIT_MAX_RESTORE_THREADS 32
+
+// Edit distance after which the line diff stops looking for the smallest diff.
+#define FIT_LINE_DIFF_MAX_COST 1024
 
 typedef void fit_can_abort;
 
 #define FIT_MAX_PATH 256
 
+// Version 1 added the modified time of each file entry.
+// Version 2 added the time each snapshot was saved.
+#define FIT_FILE_STORE_VERSION 2
+
+// Stores are written to this file next to them and then renamed over them.
+#define FIT_STORE_TEMP_SUFFIX ".tmp"
+// Writers lock this file next to the store, see FIT_LockFileStore.
+#define FIT_STORE_LOCK_SUFFIX ".lock"
+
+// Stores can be bigger than a long can address on Windows.
+#ifdef _WIN32
+#define FIT_FSEEK _fseeki64
+#define FIT_FTELL _ftelli64
+#else
+#define FIT_FSEEK fseeko
+#define FIT_FTELL ftello
+#endif
+
+// Paths of tracked files are relative to the store and are not held in a FIT_Path,
+// so they can be much longer than the store path itself.
+#ifdef _WIN32
+#define FIT_MAX_ENTRY_PATH 32767
+#else
+#define FIT_MAX_ENTRY_PATH 4096
+#endif
+
 typedef enum FIT_Difficulty {
 	FIT_DIFFICULTY_EASY = 0,
 	FIT_DIFFICULTY_NORMAL,
@@ -30,6 +111,11 @@ typedef enum FIT_Difficulty {
 void FIT_Log(const char *format, ...);
 void FIT_AbortWithMessage(const char *format, ...);
 
+// Sends every message to [proc] instead of stdout, NULL goes back to stdout. [proc] can be called
+// from any thread that is doing work, including several at once.
+typedef void (*FIT_LogProc)(const char *message, void *user);
+void FIT_SetLogProc(FIT_LogProc proc, void *user);
+
 #define FIT_RELEASE_ASSERT(condition, format, ...) if (!(condition)) FIT_AbortWithMessage(format, __VA_ARGS__)
 #define FIT_DEBUG_ASSERT(condition, format, ...) assert(condition)
 #define FIT_SHOULD_NOT_BE_NULL(condition) FIT_DEBUG_ASSERT(condition, "")
@@ -45,6 +131,30 @@ void FIT_AbortWithMessage(const char *format, ...);
 #define FIT_BASE64_DIGEST_SIZE 64
 #define FIT_BASE64_OUTPUT_STR_SIZE (4 * ((FIT_SHA1_DIGEST_SIZE + 2) / 3)) 
 
+#ifdef _WIN32
+typedef HANDLE FIT_Thread;
+#else
+typedef pthread_t FIT_Thread;
+#endif
+
+typedef void (*FIT_ThreadProc)(void *arg);
+
+int FIT_ThreadCreate(FIT_Thread *thread, FIT_ThreadProc proc, void *arg);
+void FIT_ThreadJoin(FIT_Thread thread);
+uint32_t FIT_GetCpuCount(void);
+// Monotonic, only the difference between two calls means anything.
+uint64_t FIT_GetTimeNanoseconds(void);
+// Returns the value before the add.
+uint64_t FIT_AtomicAdd(volatile uint64_t *value, uint64_t add);
+
+#ifdef _MSC_VER
+#define FIT_THREAD_LOCAL __declspec(thread)
+#else
+#define FIT_THREAD_LOCAL __thread
+#endif
+// Runs [proc] on [threadCount] threads (the caller is one of them) and waits for all of them.
+int FIT_RunOnThreads(uint32_t threadCount, FIT_ThreadProc proc, void *arg);
+
 typedef struct FIT_Sha1Digest {
 	uint8_t bytes[FIT_SHA1_DIGEST_SIZE];
 } FIT_Sha1Digest;
@@ -57,6 +167,15 @@ void FIT_DigestToBase64(FIT_Sha1Digest *input, FIT_Base64Digest *output);
 void FIT_DoSha1(const char *message, size_t messageLen, FIT_Sha1Digest *digest);
 fit_can_abort FIT_Sha1Test();
 
+// Known messages and their digests in base64, FIT_Sha1Test checks FIT_DoSha1 against these.
+typedef struct FIT_Sha1TestVector {
+	const char *message;
+	const char *base64Digest;
+} FIT_Sha1TestVector;
+
+#define FIT_SHA1_TEST_VECTOR_COUNT 6
+extern const FIT_Sha1TestVector FIT_SHA1_TEST_VECTORS[FIT_SHA1_TEST_VECTOR_COUNT];
+
 typedef struct FIT_Path {
 	char buffer[FIT_MAX_PATH];
 } FIT_Path;
@@ -65,15 +184,55 @@ int FIT_GetAbsolutePath(FIT_Path *path, const char *relativePath);
 int FIT_GoUpDirectory(FIT_Path *path, FIT_Path *newPath);
 int FIT_AppendPath(const FIT_Path *srce, const char *str, FIT_Path *outPath);
 
+// Patterns in this file (one per line, gitignore-like) are never tracked by track_all.
+#define FIT_IGNORE_FILE_NAME ".fitignore"
+
+typedef enum FIT_IgnoreRuleFlags {
+	FIT_IGNORE_RULE_NEGATE = 1 << 0,		// "!pattern" re-includes a path
+	FIT_IGNORE_RULE_DIRECTORY_ONLY = 1 << 1, // "pattern/" only matches directories
+	FIT_IGNORE_RULE_ANCHORED = 1 << 2,		// contains a '/' so matches the whole relative path, otherwise the basename
+	FIT_IGNORE_RULE_LITERAL = 1 << 3,		// no glob characters, matched through the hash table
+} FIT_IgnoreRuleFlags;
+
+typedef struct FIT_IgnoreRule {
+	char *pattern;
+	uint32_t patternLen;
+	uint32_t literalPrefixLen; // chars before the first glob character, used to reject quickly
+	uint32_t flags;
+	int32_t literalNext; // next (lower priority) literal rule with the same text, or -1
+} FIT_IgnoreRule;
+
+// An ignore file compiled once before traversal. Literal rules are looked up 
+// through an open addressed hash table, glob rules are only tried when they can 
+// still beat the best literal match (the last matching rule wins, as in git).
+typedef struct FIT_IgnoreMatcher {
+	FIT_IgnoreRule *rules;
+	uint32_t ruleCount;
+	int32_t *literalSlots;
+	uint32_t literalSlotCount;
+	int32_t *globRules;
+	uint32_t globRuleCount;
+	uint8_t loaded;
+} FIT_IgnoreMatcher;
+
+uint32_t FIT_HashString(const char *str, size_t len);
+int FIT_CompileIgnorePatterns(FIT_IgnoreMatcher *matcher, const char *text, size_t textLen);
+int FIT_LoadIgnoreFile(FIT_IgnoreMatcher *matcher, FILE *file); // a NULL file means there is no ignore file
+int FIT_IsPathIgnored(const FIT_IgnoreMatcher *matcher, const char *relPath, size_t relPathLen, int isDirectory);
+void FIT_IgnoreMatcherDeinit(FIT_IgnoreMatcher *matcher);
+
 typedef struct FIT_FileEntry {
 	char *path;
 	uint32_t pathLen;
 	FIT_Base64Digest hash;
 	uint64_t offset;
 	uint64_t offsetLen;
+	uint64_t modifiedTime; // of the file when it was saved, 0 when unknown
 	char *buffer;
 	uint64_t bufferLen;
 	uint8_t inSnapshot;
+	uint8_t restoreAction;
+	uint8_t dirty; // a tracked file that changed since the last snapshot, see trustCleanEntries
 
 	struct FIT_FileEntry *poolNext;
 	struct FIT_FileEntry *snapNext;
@@ -82,15 +241,136 @@ typedef struct FIT_FileEntry {
 	struct FIT_FileEntry *trackPrev;
 } FIT_FileEntry;
 
+typedef enum FIT_RestoreAction {
+	FIT_RESTORE_UNCHANGED = 0,	// the working copy already matches
+	FIT_RESTORE_CREATE,			// missing from the working directory
+	FIT_RESTORE_OVERWRITE,		// the working copy differs
+	FIT_RESTORE_NOT_IN_SNAPSHOT, // a tracked file the snapshot does not have, it is left alone
+} FIT_RestoreAction;
+
+typedef struct FIT_RestorePlan {
+	uint32_t createCount;
+	uint32_t overwriteCount;
+	uint32_t unchangedCount;
+	uint32_t notInSnapshotCount;
+} FIT_RestorePlan;
+
+// Open addressing table from an entry's path to the entry, so matching paths
+// between lists does not need a nested scan.
+typedef struct FIT_PathTable {
+	FIT_FileEntry **slots;
+	uint32_t slotCount;
+	uint32_t count;
+} FIT_PathTable;
+
+int FIT_PathTableInit(FIT_PathTable *table, uint32_t expectedCount);
+int FIT_PathTableInsert(FIT_PathTable *table, FIT_FileEntry *entry);
+FIT_FileEntry *FIT_PathTableFind(const FIT_PathTable *table, const char *path, size_t pathLen);
+void FIT_PathTableDeinit(FIT_PathTable *table);
+
 typedef struct FIT_Snapshot {
 	FIT_FileEntry *entryHead;
 	FIT_FileEntry *entryTail;
 	uint32_t entryCount;
+	uint32_t index;			// position in the snapshot list
+	uint64_t savedTime;		// seconds since 1970 UTC, 0 when the store is older than version 2
 	struct FIT_Snapshot *next;
 	struct FIT_Snapshot *prev;
 	struct FIT_Snapshot *poolNext;
 } FIT_Snapshot;
 
+typedef struct FIT_FileVersion {
+	FIT_Snapshot *snapshot;
+	FIT_FileEntry *entry;	// the digest, offset and size of this version
+} FIT_FileVersion;
+
+typedef struct FIT_FileHistory {
+	char *path;
+	uint32_t pathLen;
+	FIT_FileVersion *versions;	// oldest snapshot first
+	uint32_t versionCount;
+	uint32_t versionCapacity;
+} FIT_FileHistory;
+
+// Every snapshot each path is in, kept up to date as snapshots are loaded, saved and deleted.
+typedef struct FIT_HistoryIndex {
+	FIT_FileHistory *histories;
+	uint32_t historyCount;
+	uint32_t historyCapacity;
+	uint32_t *slots;		// index into histories + 1, 0 is empty
+	uint32_t slotCount;
+} FIT_HistoryIndex;
+
+typedef enum FIT_DiffKind {
+	FIT_DIFF_ADDED,
+	FIT_DIFF_REMOVED,
+	FIT_DIFF_MODIFIED,
+	FIT_DIFF_RENAMED,	// [from] and [to] have different paths but the same contents
+	FIT_DIFF_UNCHANGED,
+} FIT_DiffKind;
+
+typedef struct FIT_DiffItem {
+	FIT_DiffKind kind;
+	FIT_FileEntry *from;	// NULL when added
+	FIT_FileEntry *to;		// NULL when removed
+} FIT_DiffItem;
+
+// Only the changes are kept as items, unchanged files are just counted.
+typedef struct FIT_Diff {
+	FIT_DiffItem *items;
+	uint32_t itemCount;
+	uint32_t itemCapacity;
+	uint32_t addedCount;
+	uint32_t removedCount;
+	uint32_t modifiedCount;
+	uint32_t renamedCount;
+	uint32_t unchangedCount;
+} FIT_Diff;
+
+typedef struct FIT_TextLines {
+	const char *text;
+	uint64_t textLen;
+	uint64_t *lineStarts;	// lineCount + 1 of them, the last one is textLen
+	uint32_t lineCount;
+	uint32_t lineCapacity;
+	uint32_t *ids;			// lines with the same contents have the same id
+} FIT_TextLines;
+
+// The lines of each side that are not part of the longest common subsequence. The texts
+// are not copied, so they have to outlive the diff.
+typedef struct FIT_LineDiff {
+	FIT_TextLines from;
+	FIT_TextLines to;
+	uint8_t *fromChanged;	// 1 for each line of [from] that was deleted
+	uint8_t *toChanged;		// 1 for each line of [to] that was inserted
+	uint32_t deletedCount;
+	uint32_t insertedCount;
+} FIT_LineDiff;
+
+typedef enum FIT_StatusKind {
+	FIT_STATUS_NEW,			// tracked but not in the latest snapshot yet
+	FIT_STATUS_MODIFIED,
+	FIT_STATUS_DELETED,		// in the latest snapshot but missing or no longer tracked
+	FIT_STATUS_UNTRACKED,	// in the working directory but neither tracked nor ignored
+} FIT_StatusKind;
+
+typedef struct FIT_StatusItem {
+	FIT_StatusKind kind;
+	char *path;
+} FIT_StatusItem;
+
+typedef struct FIT_Status {
+	FIT_StatusItem *items;
+	uint32_t itemCount;
+	uint32_t itemCapacity;
+	uint32_t newCount;
+	uint32_t modifiedCount;
+	uint32_t deletedCount;
+	uint32_t untrackedCount;
+	uint32_t cleanCount;
+	uint32_t hashedCount;	// files the size and modified time could not settle
+} FIT_Status;
+
 typedef struct FIT_FileStoreData {
 	FIT_Snapshot *snapshotHead;
 	FIT_Snapshot *snapshotTail;
@@ -102,21 +382,103 @@ typedef struct FIT_FileStoreData {
 	uint32_t trackingCount;
 } FIT_FileStoreData;
 
+typedef struct FIT_IoRing FIT_IoRing;
+
+typedef enum FIT_OperationState {
+	FIT_OPERATION_RUNNING = 0,
+	FIT_OPERATION_SUCCEEDED,
+	FIT_OPERATION_FAILED,
+	FIT_OPERATION_CANCELLED,
+} FIT_OperationState;
+
+typedef struct FIT_Progress {
+	FIT_OperationState state;
+	uint64_t filesDone;
+	uint64_t filesTotal;
+	uint64_t bytesDone;
+	uint64_t bytesTotal;
+	const char *currentPath; // the last file started, owned by the context, NULL before the first
+	uint64_t elapsedNanoseconds;
+	double bytesPerSecond;
+} FIT_Progress;
+
+typedef void (*FIT_ProgressProc)(const FIT_Progress *progress, void *user);
+
+// A save or load running on its own thread, see FIT_StartSave.
+typedef struct FIT_Operation FIT_Operation;
+
+// Which version of a store file was loaded. A save renames a new file over the store, so any
+// save since then changes it.
+typedef struct FIT_StoreIdentity {
+	uint64_t fileId;
+	uint64_t size;
+	uint64_t modifiedTime;
+	uint8_t valid;
+} FIT_StoreIdentity;
+
 typedef struct FIT_Context {
 	FIT_FileStoreData fsData;
 
 	FIT_Path workingDirectory;
 	FIT_Path fileStoreAbsolutePath;
-	FIT_Path trackedFileAbsolutePath;
 	FIT_Path filenamePath;
 
+	// Tracked files are opened relative to this handle of the working directory (POSIX only).
+	int workingDirectoryFd;
+
 	FIT_FileEntry *entryHead;
 	FIT_FileEntry *entryTail;
 	FIT_Snapshot *snapHead;
 	FIT_Snapshot *snapTail;
+	uint32_t entryPoolCount;
 
 	FILE *fileStore;
 
+	// A context holds one store, loading it again does nothing so a long lived context
+	// can run any number of commands against it.
+	uint8_t storeLoaded;
+
+	// Set when commands come from a client or a script rather than a terminal. Questions are
+	// answered yes instead of read from stdin, and serve and client are refused.
+	uint8_t nonInteractive;
+
+	// Set when something is watching the tracked files. A save then keeps what the last
+	// snapshot has for tracked entries that are not dirty, without looking at their files.
+	uint8_t trustCleanEntries;
+
+	// Set while running a batch, saving the loaded store only sets savePending and the batch
+	// writes it once at the end.
+	uint8_t deferSave;
+	uint8_t savePending;
+
+	// Open store whose blobs start at blobStoreOffset, when only the metadata was loaded.
+	FILE *blobStore;
+	uint64_t blobStoreOffset;
+
+	// The store file the context was loaded from, a save refuses to replace a different one.
+	FIT_StoreIdentity loadedStore;
+
+	// Held while this context is changing the store, see FIT_LockFileStore.
+#ifdef _WIN32
+	HANDLE storeLock;
+#else
+	int storeLock;
+#endif
+	uint8_t storeLocked;
+
+	FIT_IgnoreMatcher ignore;
+
+	FIT_HistoryIndex history;
+
+	FIT_IoRing *ioRing;
+	uint8_t ioRingUnavailable;
+
+	// The operation running on this context, it is told about each file and can cancel.
+	FIT_Operation *operation;
+
+	// Threads used for parallel work, 0 picks a default from the number of cores.
+	uint32_t threadCount;
+
 	FIT_Difficulty difficulty;
 } FIT_Context;
 
@@ -138,31 +500,695 @@ int FIT_CopyFileEntry(FIT_FileEntry *dest, FIT_FileEntry *srce);
 int FIT_AllocateFileContents(FILE *file, char **buffer, uint64_t *bufferLength);
 int FIT_HashBuffer(FIT_Base64Digest *base64Digest, char *buffer, uint64_t bufferLen);
 int FIT_SaveFileEntry(FILE *file, FIT_FileEntry *entry);
-int FIT_LoadFileEntry(FILE *file, FIT_FileEntry *entry);
+int FIT_LoadFileEntry(FILE *file, FIT_FileEntry *entry, uint32_t version);
+// Writes everything up to and including the buffer count, so the blobs can be written after it.
+int FIT_SaveFileStoreMetadataFromBuffer(FIT_Context *ctx, FILE *file);
 int FIT_SaveFileStoreFromBuffer(FIT_Context *ctx, FILE *file);
 int FIT_SaveFileStoreFromFile(FIT_Context *ctx, const char *path);
+// Flushes [file] and waits for the disk to have it.
+int FIT_SyncFile(FILE *file);
+// Renames [from] over [to] in one step, [to] is either the old file or the new one after a crash.
+int FIT_ReplaceFile(const char *from, const char *to);
+// One process changes a store at a time. A writer holds the lock on <store>.lock from loading the
+// store to saving it, and waits for it when another writer has it. Readers never take it: a save
+// writes a new file and renames it over the store, so a reader keeps reading the version it
+// opened. Saving takes the lock by itself when the context does not hold it, and fails when the
+// store was saved by someone else since the context loaded it. Locking again does nothing.
+int FIT_LockFileStore(FIT_Context *ctx, const char *fileStoreStr);
+void FIT_UnlockFileStore(FIT_Context *ctx);
+int FIT_LoadFileStoreMetadataFromBuffer(FIT_Context *ctx, FILE *file);
 int FIT_LoadFileStoreFromBuffer(FIT_Context *ctx, FILE *file);
 int FIT_LoadFileStoreFromFile(FIT_Context *ctx, const char *filename);
+// Loads everything but the blob buffer and keeps the store open in ctx->blobStore.
+int FIT_LoadFileStoreMetadataFromFile(FIT_Context *ctx, const char *filename);
+// Writes the contents of [entry] to [file], from the loaded buffer or straight out of the open store.
+int FIT_CopyBlobToFile(FIT_Context *ctx, FIT_FileEntry *entry, FILE *file);
+// Reads [len] bytes at [offset] of the open store. Safe to call from several threads.
+int FIT_ReadStoreRange(FIT_Context *ctx, uint64_t offset, char *buffer, uint64_t len);
+int FIT_SetWorkingDirectoryFromFileStore(FIT_Context *ctx, const char *fileStoreStr);
+int FIT_LoadFileStoreAndSetWorkingDirectory(FIT_Context *ctx, const char *fileStoreStr);
+int FIT_CheckFileStoreExists(FIT_Context *ctx, const char *fileName);
+char *FIT_AllocateWorkingPath(FIT_Context *ctx, const char *relPath);
+FILE *FIT_OpenWorkingFile(FIT_Context *ctx, const char *relPath, const char *mode);
+// The part of [path] after the last slash.
+const char *FIT_GetFileName(const char *path, size_t pathLen);
+// Called for every file the walk finds, return 0 to stop it.
+typedef int (*FIT_WorkingFileProc)(FIT_Context *ctx, const char *relPath, size_t relPathLen, void *user);
+// Visits every file below the working directory that is not ignored, skipping the store itself.
+int FIT_WalkWorkingDirectory(FIT_Context *ctx, const char *fileStoreStr, size_t fileStoreStrLen, FIT_WorkingFileProc proc, void *user);
+int FIT_TrackAll(FIT_Context *ctx, const char *fileStoreStr, size_t fileStoreStrLen);
+// Reads up to [maxCount] entries of a snapshot list into their buffers in one go and
+// returns the entry after them. Entries it could not read are left for stdio.
+FIT_FileEntry *FIT_PrefetchFileContents(FIT_Context *ctx, FIT_FileEntry *head, uint32_t maxCount);
+void FIT_IoRingDestroy(FIT_IoRing *ring);
+// [modifiedTime] can be NULL. Its units depend on the platform, so only compare it with other
+// times from this function.
+int FIT_GetWorkingFileStat(FIT_Context *ctx, const char *relPath, uint64_t *size, uint64_t *modifiedTime);
+int FIT_MakeParentDirectories(FIT_Context *ctx, const char *relPath);
+FIT_RestoreAction FIT_CompareWorkingFile(FIT_Context *ctx, FIT_FileEntry *entry);
+// Works out what loading [snapshot] would do without touching anything. Sets restoreAction
+// on the snapshot's entries and on tracked files that are not in it.
+int FIT_PlanRestore(FIT_Context *ctx, FIT_Snapshot *snapshot, FIT_RestorePlan *plan);
+// Writes the entries FIT_PlanRestore marked as needing to be created or overwritten, on
+// several threads. A file that fails is logged and keeps its restoreAction, the rest still
+// get written, and 0 is returned at the end.
+int FIT_RestoreSnapshot(FIT_Context *ctx, FIT_Snapshot *snapshot);
+FIT_Snapshot *FIT_GetSnapshotByIndex(FIT_Context *ctx, long int index);
+// True when [path] is [pathOrPrefix] itself or a file inside the directory it names.
+int FIT_PathMatchesPrefix(const char *path, size_t pathLen, const char *pathOrPrefix, size_t prefixLen);
+// Writes the files of [snapshot] matching [pathOrPrefix] into [destDir], keeping their relative
+// paths, or into the working directory when [destDir] is NULL. Only their blobs are read from the store.
+int FIT_ExtractFromSnapshot(FIT_Context *ctx, FIT_Snapshot *snapshot, const char *pathOrPrefix, const char *destDir, uint32_t *extractedCount);
+int FIT_HistoryIndexAddSnapshot(FIT_HistoryIndex *index, FIT_Snapshot *snapshot);
+void FIT_HistoryIndexRemoveSnapshot(FIT_HistoryIndex *index, FIT_Snapshot *snapshot);
+void FIT_HistoryIndexDeinit(FIT_HistoryIndex *index);
+// Every version of [path] in the loaded snapshots, oldest first, or NULL when none have it.
+const FIT_FileHistory *FIT_GetFileHistory(FIT_Context *ctx, const char *path, size_t pathLen);
+int FIT_HashWorkingFile(FIT_Context *ctx, const char *relPath, FIT_Base64Digest *digest, uint64_t *size);
+// Hashes the tracked files into a snapshot that is not added to the store, so the
+// working directory can be compared like any other snapshot.
+FIT_Snapshot *FIT_SnapshotWorkingDirectory(FIT_Context *ctx);
+// Compares two snapshots by path and digest, only the metadata is needed. An added and a
+// removed file with the same digest are reported as one rename.
+int FIT_DiffSnapshots(FIT_Snapshot *from, FIT_Snapshot *to, FIT_Diff *diff);
+void FIT_DiffDeinit(FIT_Diff *diff);
+// Compares the working directory with the latest snapshot without reading any blobs or
+// writing anything. Files are only hashed when their size and modified time are not enough.
+int FIT_GetStatus(FIT_Context *ctx, int includeUntracked, FIT_Status *status);
+void FIT_StatusDeinit(FIT_Status *status);
+// Reads the contents of [entry] into a new buffer, from the loaded buffer or the open store.
+int FIT_ReadBlob(FIT_Context *ctx, FIT_FileEntry *entry, char **buffer, uint64_t *bufferLen);
+// Myers diff over the lines of two texts, lines are compared as interned ids.
+int FIT_DiffLines(const char *from, uint64_t fromLen, const char *to, uint64_t toLen, FIT_LineDiff *diff);
+int FIT_WriteUnifiedDiff(const FIT_LineDiff *diff, const char *fromLabel, const char *toLabel, uint32_t contextLines, FILE *out);
+void FIT_LineDiffDeinit(FIT_LineDiff *diff);
+// Writes the unified diff of one file. [from] or [to] is NULL for a file that was added or removed.
+// [to] is read from the working directory when [toWorkingDirectory] is set, otherwise from the store.
+int FIT_WriteFileContentDiff(FIT_Context *ctx, FIT_FileEntry *from, FIT_FileEntry *to, int toWorkingDirectory, FILE *out);
 int FIT_Run(FIT_Context *ctx, int argc, char *argv[]);
 
+typedef struct FIT_SnapshotStoreStats {
+	uint32_t entryCount;
+	uint64_t logicalBytes;	// the size of every file in the snapshot
+	uint64_t addedBytes;	// contents no earlier snapshot has, what saving it grew the store by
+} FIT_SnapshotStoreStats;
+
+typedef struct FIT_PathStoreStats {
+	const char *path;		// owned by the context
+	uint32_t versionCount;	// snapshots the path is in
+	uint32_t blobCount;		// different contents it has had
+	uint64_t storedBytes;	// store space its contents take
+} FIT_PathStoreStats;
+
+// What a store holds, worked out from the metadata alone.
+typedef struct FIT_StoreStats {
+	uint64_t bufferBytes;
+	uint64_t logicalBytes;		// every file of every snapshot, what it would take without sharing
+	uint64_t referencedBytes;	// buffer bytes at least one snapshot uses
+	uint64_t unreachableBytes;	// buffer bytes no snapshot uses, repack gets them back
+	uint64_t blobCount;
+	uint64_t duplicateBlobCount; // blobs with the same contents as an earlier blob
+	uint64_t duplicateBytes;
+	uint32_t holeCount;			// unreachable runs in the buffer
+	uint64_t largestHoleBytes;
+
+	FIT_SnapshotStoreStats *snapshots; // one per snapshot, oldest first
+	uint32_t snapshotCount;
+
+	FIT_PathStoreStats *topPaths; // the paths taking the most space, biggest first
+	uint32_t topPathCount;
+	uint32_t pathCount;
+} FIT_StoreStats;
+
+#define FIT_STORE_STATS_DEFAULT_TOP_PATHS 10
+
+// Needs the metadata of a store loaded, the blobs are never read.
+int FIT_ComputeStoreStats(FIT_Context *ctx, uint32_t topPathCount, FIT_StoreStats *stats);
+int FIT_WriteStoreStatsJson(const FIT_StoreStats *stats, FILE *out);
+void FIT_StoreStatsDeinit(FIT_StoreStats *stats);
+
+// What a repack did.
+typedef struct FIT_RepackResult {
+	uint64_t oldSize;		// of the whole store file
+	uint64_t newSize;
+	uint64_t oldBufferBytes;
+	uint64_t newBufferBytes;
+	uint64_t blobCount;		// blobs in the new store, one per distinct contents
+	uint64_t entryCount;	// file entries of every snapshot that point at them
+} FIT_RepackResult;
+
+// Rewrites [fileStoreStr] into a new file and renames it over the old one. Each distinct
+// contents is kept once, and the blobs are laid out by path and then snapshot so a restore
+// reads the store front to back. Blobs are streamed across, only the metadata is held in
+// memory. A store that is not loaded yet is left loaded as metadata from the new file. One
+// already loaded, as fit serve does, has to be the one on disk and stays loaded the same way.
+int FIT_RepackFileStore(FIT_Context *ctx, const char *fileStoreStr, FIT_RepackResult *repack);
+
+// Which snapshots a prune keeps. A snapshot any rule keeps is kept.
+typedef struct FIT_RetentionPolicy {
+	uint32_t keepLast;		// the newest snapshots
+	uint32_t keepDaily;		// the newest snapshot of each of the last days that have one
+	uint32_t keepWeekly;	// the same for weeks, which start on Monday
+} FIT_RetentionPolicy;
+
+// Deletes every snapshot [policy] does not keep in one go. The blobs still in use are found in
+// one pass and the buffer is compacted once, so it needs the whole store loaded. The store is not
+// saved. Days and weeks are in UTC.
+int FIT_PruneSnapshots(FIT_Context *ctx, const FIT_RetentionPolicy *policy, uint32_t *prunedCount);
+// Removes [snapshot] and the blobs no other snapshot uses, from the whole store loaded. The store
+// is not saved.
+int FIT_DeleteSnapshot(FIT_Context *ctx, FIT_Snapshot *snapshot);
+
+typedef struct FIT_VerifyResult {
+	uint64_t blobCount;			// distinct blobs checked
+	uint64_t bytesChecked;
+	uint64_t corruptBlobCount;
+	uint64_t corruptEntryCount;	// file entries of every snapshot that use a corrupt blob
+	uint32_t corruptSnapshotCount;
+} FIT_VerifyResult;
+
+// Rehashes every blob the snapshots use, or only the ones [snapshot] uses when it is not NULL,
+// and logs each file whose contents no longer match their digest along with the snapshots it is
+// corrupt in. Each blob is read and hashed once, in store order on several threads. Needs the
+// store loaded, as metadata or whole. Returns 1 when the check ran, corrupt blobs or not.
+int FIT_VerifyFileStore(FIT_Context *ctx, FIT_Snapshot *snapshot, FIT_VerifyResult *verify);
+
+// A served store is reached through a Unix socket next to it, named <fileStore>.sock.
+#define FIT_SERVE_SOCKET_SUFFIX ".sock"
+#define FIT_SERVE_MAX_REQUEST_SIZE (1 << 20)
+// Requests are served one at a time, so a client that stops sending or reading half way
+// through a frame is dropped after this long rather than holding up everyone else.
+#define FIT_SERVE_FRAME_TIMEOUT_SECONDS 5
+// Commands like diff allocate entries that are only freed with the context, so a served
+// context is reloaded once this many have piled up.
+#define FIT_SERVE_MAX_SCRATCH_ENTRIES (1 << 16)
+
+// Keeps [fileStoreStr] loaded and runs the commands clients send until it is stopped. Each
+// request is a frame of NUL separated strings, the client's directory and then its arguments,
+// and is answered with a frame of the output and a frame of the result. A frame is a uint32_t
+// length and then that many bytes. The store is reloaded when something else changes it.
+int FIT_Serve(FIT_Context *ctx, const char *fileStoreStr);
+// Runs the command in [argv] on the server of the store in argv[1] and writes its output to
+// stdout. Returns the result of the command, or 0 when the server could not be reached.
+int FIT_RunClient(int argc, char *argv[]);
+
+#define FIT_WATCH_DEFAULT_QUIET_MILLISECONDS 2000
+
+// Watches the directories of the tracked files and saves a snapshot once they have been left
+// alone for [quietMilliseconds]. Only the files that changed are read. Runs until interrupted.
+int FIT_Watch(FIT_Context *ctx, const char *fileStoreStr, uint32_t quietMilliseconds);
+
+#define FIT_BATCH_MAX_ARGS 64
+
+// Progress callbacks are made at most this often, and once more when the operation ends.
+#define FIT_PROGRESS_INTERVAL_NANOSECONDS 50000000ull
+
+// Loads [fileStoreStr] into [ctx] and saves a snapshot of the tracked files, on a new thread so
+// the caller can keep going. [ctx] belongs to the operation until FIT_FinishOperation. [proc]
+// can be NULL, otherwise it is called with the progress from the threads doing the work. After
+// a save fails or is cancelled the store on disk is as it was, but [ctx] has to be deinitialised.
+FIT_Operation *FIT_StartSave(FIT_Context *ctx, const char *fileStoreStr, FIT_ProgressProc proc, void *user);
+// Like FIT_StartSave, but loads snapshot [snapshotIndex] into the working directory, or the latest
+// when it is negative. Files are overwritten without asking. A cancelled load leaves the files it
+// already wrote, each one complete.
+FIT_Operation *FIT_StartLoad(FIT_Context *ctx, const char *fileStoreStr, long int snapshotIndex, FIT_ProgressProc proc, void *user);
+void FIT_GetOperationProgress(FIT_Operation *operation, FIT_Progress *progress);
+// Asks the operation to stop after the files it is working on, it does not wait.
+void FIT_CancelOperation(FIT_Operation *operation);
+// Waits for the operation to end, frees it and returns how it ended.
+FIT_OperationState FIT_FinishOperation(FIT_Operation *operation);
+
+// The parts of a command the stats time separately.
+typedef enum FIT_StatsPhase {
+	FIT_PHASE_LOAD_STORE,
+	FIT_PHASE_TRACK_ALL,
+	FIT_PHASE_READ_FILES,
+	FIT_PHASE_HASH,
+	FIT_PHASE_GROW_BUFFER,
+	FIT_PHASE_SAVE_STORE,
+
+	FIT_PHASE_COUNT
+} FIT_StatsPhase;
+
+typedef struct FIT_Stats {
+	uint64_t phaseNanoseconds[FIT_PHASE_COUNT];
+	uint64_t phaseCalls[FIT_PHASE_COUNT];
+	uint64_t bytesRead;    // working files and the store
+	uint64_t bytesWritten; // the store and restored files
+	uint64_t filesHashed;
+	uint64_t filesSkipped; // trusted without reading them, by their time or by a watcher
+	uint64_t peakMemoryBytes;
+} FIT_Stats;
+
+// Stats are kept for the whole process, from every thread, while they are enabled. They are off
+// until this is called, and "--stats" anywhere on the command line turns them on for that command.
+void FIT_EnableStats(int enable);
+void FIT_ResetStats(void);
+// Fills in the peak memory of the process as well.
+void FIT_GetStats(FIT_Stats *stats);
+void FIT_LogStats(const FIT_Stats *stats);
+
+#define FIT_TRACE_DEFAULT_EVENT_COUNT (1 << 16)
+
+// Records the stats phases and a span per file, from every thread, as Chrome trace events that
+// Perfetto or chrome://tracing can open. Events go into a ring of [eventCount], so a long run
+// keeps the latest ones. "--trace out.json" on a command line traces just that command.
+int FIT_StartTrace(uint32_t eventCount);
+// Writes what was recorded to [path] and stops tracing.
+int FIT_FinishTrace(const char *path);
+
+// Runs one command per line of [script] on [fileStoreStr], which is loaded once and only
+// saved at the end when every command worked. A line is a command without the store, like
+// "track Content/a.png", and blank lines and lines starting with # are skipped.
+int FIT_RunBatch(FIT_Context *ctx, const char *fileStoreStr, FILE *script);
+
 #if defined(FIT_IMPLEMENTATION)
 
+static FIT_LogProc FIT_logProc = NULL;
+static void *FIT_logUser = NULL;
+
+void FIT_SetLogProc(FIT_LogProc proc, void *user) {
+	FIT_logProc = proc;
+	FIT_logUser = user;
+}
+
 void FIT_Log(const char *format, ...) {
 	va_list args = {0};
 	va_start(args, format);
-	vfprintf(stdout, format, args);
+	if (FIT_logProc) {
+		char message[FIT_MAX_ENTRY_PATH + 1024];
+		vsnprintf(message, sizeof(message), format, args);
+		FIT_logProc(message, FIT_logUser);
+	}
+	else {
+		vfprintf(stdout, format, args);
+		fprintf(stdout, "\n");
+	}
 	va_end(args);
-	fprintf(stdout, "\n");
 }
 
 void FIT_AbortWithMessage(const char *format, ...) {
 	va_list args = {0};
 	va_start(args, format);
-	vfprintf(stdout, format, args);
+	if (FIT_logProc) {
+		char message[FIT_MAX_ENTRY_PATH + 1024];
+		vsnprintf(message, sizeof(message), format, args);
+		FIT_logProc(message, FIT_logUser);
+	}
+	else {
+		vfprintf(stdout, format, args);
+	}
 	va_end(args);
 	exit(0);
 }
 
+#ifdef _WIN32
+typedef struct FIT_ThreadStartInfo {
+	FIT_ThreadProc proc;
+	void *arg;
+} FIT_ThreadStartInfo;
+
+static DWORD WINAPI FIT_ThreadTrampoline(LPVOID param) {
+	FIT_ThreadStartInfo info = *(FIT_ThreadStartInfo *)param;
+	free(param);
+	info.proc(info.arg);
+	return 0;
+}
+#else
+typedef struct FIT_ThreadStartInfo {
+	FIT_ThreadProc proc;
+	void *arg;
+} FIT_ThreadStartInfo;
+
+static void *FIT_ThreadTrampoline(void *param) {
+	FIT_ThreadStartInfo info = *(FIT_ThreadStartInfo *)param;
+	free(param);
+	info.proc(info.arg);
+	return NULL;
+}
+#endif
+
+int FIT_ThreadCreate(FIT_Thread *thread, FIT_ThreadProc proc, void *arg) {
+	FIT_SHOULD_NOT_BE_NULL(thread);
+	FIT_SHOULD_NOT_BE_NULL(proc);
+
+	FIT_ThreadStartInfo *info = (FIT_ThreadStartInfo *)malloc(sizeof(FIT_ThreadStartInfo));
+	FIT_ASSERT_LOG_RETURN(info, "Out of memory. Unable to start thread.");
+	info->proc = proc;
+	info->arg = arg;
+
+#ifdef _WIN32
+	*thread = CreateThread(NULL, 0, FIT_ThreadTrampoline, info, 0, NULL);
+	if (*thread == NULL) {
+		free(info);
+		FIT_ASSERT_LOG_RETURN(0, "Unable to start thread [%lu].", GetLastError());
+	}
+#else
+	int result = pthread_create(thread, NULL, FIT_ThreadTrampoline, info);
+	if (result != 0) {
+		free(info);
+		FIT_ASSERT_LOG_RETURN(0, "Unable to start thread [%d].", result);
+	}
+#endif
+	return 1;
+}
+
+void FIT_ThreadJoin(FIT_Thread thread) {
+#ifdef _WIN32
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+#else
+	pthread_join(thread, NULL);
+#endif
+}
+
+uint32_t FIT_GetCpuCount(void) {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (uint32_t)count : 1;
+#endif
+}
+
+uint64_t FIT_GetTimeNanoseconds(void) {
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	if (!frequency.QuadPart) {
+		QueryPerformanceFrequency(&frequency);
+	}
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)((counter.QuadPart / frequency.QuadPart) * 1000000000ull +
+		(counter.QuadPart % frequency.QuadPart) * 1000000000ull / frequency.QuadPart);
+#else
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t)time.tv_sec * 1000000000ull + (uint64_t)time.tv_nsec;
+#endif
+}
+
+uint64_t FIT_AtomicAdd(volatile uint64_t *value, uint64_t add) {
+#ifdef _WIN32
+	return (uint64_t)InterlockedExchangeAdd64((volatile LONG64 *)value, (LONG64)add);
+#else
+	return __atomic_fetch_add(value, add, __ATOMIC_ACQ_REL);
+#endif
+}
+
+int FIT_RunOnThreads(uint32_t threadCount, FIT_ThreadProc proc, void *arg) {
+	FIT_SHOULD_NOT_BE_NULL(proc);
+
+	if (threadCount == 0) {
+		threadCount = 1;
+	}
+
+	FIT_Thread *threads = (FIT_Thread *)calloc(threadCount, sizeof(FIT_Thread));
+	FIT_ASSERT_LOG_RETURN(threads, "Out of memory. Unable to allocate threads.");
+
+	// If some threads fail to start, the ones that did (and this one) still do all the work.
+	uint32_t started = 0;
+	for (uint32_t i = 1; i < threadCount; i++) {
+		if (!FIT_ThreadCreate(&threads[started], proc, arg)) {
+			break;
+		}
+		started++;
+	}
+
+	proc(arg);
+
+	for (uint32_t i = 0; i < started; i++) {
+		FIT_ThreadJoin(threads[i]);
+	}
+	free(threads);
+
+	return 1;
+}
+
+static volatile uint64_t FIT_statsEnabled = 0;
+static FIT_Stats FIT_stats;
+
+static const char *FIT_STATS_PHASE_NAMES[FIT_PHASE_COUNT] = {
+	"load store",
+	"track all",
+	"read files",
+	"hash",
+	"grow buffer",
+	"save store",
+};
+
+void FIT_EnableStats(int enable) {
+	FIT_statsEnabled = enable ? 1 : 0;
+}
+
+void FIT_ResetStats(void) {
+	memset(&FIT_stats, 0, sizeof(FIT_Stats));
+}
+
+void FIT_GetStats(FIT_Stats *stats) {
+	FIT_SHOULD_NOT_BE_NULL(stats);
+
+	*stats = FIT_stats;
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		stats->peakMemoryBytes = counters.PeakWorkingSetSize;
+	}
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+		stats->peakMemoryBytes = (uint64_t)usage.ru_maxrss;
+#else
+		stats->peakMemoryBytes = (uint64_t)usage.ru_maxrss * 1024;
+#endif
+	}
+#endif
+}
+
+void FIT_LogStats(const FIT_Stats *stats) {
+	FIT_SHOULD_NOT_BE_NULL(stats);
+
+	FIT_LOG(" ");
+	FIT_LOG("%-12s %12s %8s", "phase", "ms", "calls");
+	for (int i = 0; i < FIT_PHASE_COUNT; i++) {
+		FIT_LOG("%-12s %12.3f %8llu", FIT_STATS_PHASE_NAMES[i], (double)stats->phaseNanoseconds[i] / 1e6, (unsigned long long)stats->phaseCalls[i]);
+	}
+	FIT_LOG(" ");
+	FIT_LOG("bytes read:    %llu", (unsigned long long)stats->bytesRead);
+	FIT_LOG("bytes written: %llu", (unsigned long long)stats->bytesWritten);
+	FIT_LOG("files hashed:  %llu", (unsigned long long)stats->filesHashed);
+	FIT_LOG("files skipped: %llu", (unsigned long long)stats->filesSkipped);
+	FIT_LOG("peak memory:   %.1f MB", (double)stats->peakMemoryBytes / (1024.0 * 1024.0));
+}
+
+typedef struct FIT_TraceEvent {
+	const char *name;
+	uint64_t start;
+	uint64_t duration;
+	uint32_t threadId;
+	// The end of the path, that is the part that tells files apart.
+	char path[84];
+} FIT_TraceEvent;
+
+static FIT_TraceEvent *volatile FIT_traceEvents = NULL;
+static uint64_t FIT_traceEventMask;
+static uint64_t FIT_traceStartTime;
+static volatile uint64_t FIT_traceNext;
+static volatile uint64_t FIT_traceThreadCount;
+static FIT_THREAD_LOCAL uint32_t FIT_traceThreadId;
+
+int FIT_StartTrace(uint32_t eventCount) {
+	FIT_ASSERT_LOG_RETURN(!FIT_traceEvents, "A trace is already being recorded.");
+
+	uint64_t capacity = 1;
+	while (capacity < eventCount) {
+		capacity *= 2;
+	}
+	FIT_TraceEvent *events = (FIT_TraceEvent *)calloc(capacity, sizeof(FIT_TraceEvent));
+	FIT_ASSERT_LOG_RETURN(events, "Out of memory. Unable to allocate %llu trace events.", (unsigned long long)capacity);
+
+	FIT_traceEventMask = capacity - 1;
+	FIT_traceNext = 0;
+	FIT_traceStartTime = FIT_GetTimeNanoseconds();
+	FIT_traceEvents = events;
+	return 1;
+}
+
+static uint64_t FIT_TraceBegin(void) {
+	return FIT_traceEvents ? FIT_GetTimeNanoseconds() : 0;
+}
+
+static void FIT_TraceEnd(const char *name, uint64_t start, const char *path) {
+	FIT_TraceEvent *events = FIT_traceEvents;
+	if (!events) {
+		return;
+	}
+	if (!FIT_traceThreadId) {
+		FIT_traceThreadId = (uint32_t)FIT_AtomicAdd(&FIT_traceThreadCount, 1) + 1;
+	}
+
+	FIT_TraceEvent *event = &events[FIT_AtomicAdd(&FIT_traceNext, 1) & FIT_traceEventMask];
+	event->name = name;
+	event->start = start;
+	event->duration = FIT_GetTimeNanoseconds() - start;
+	event->threadId = FIT_traceThreadId;
+	event->path[0] = '\0';
+	if (path) {
+		size_t len = strlen(path);
+		size_t skip = len < sizeof(event->path) ? 0 : len - (sizeof(event->path) - 1);
+		memcpy(event->path, &path[skip], len - skip + 1);
+	}
+}
+
+static void FIT_WriteJsonString(FILE *file, const char *str) {
+	for (; *str; str++) {
+		unsigned char c = (unsigned char)*str;
+		if (c == '"' || c == '\\') {
+			fprintf(file, "\\%c", c);
+		}
+		else if (c < 0x20) {
+			fprintf(file, "\\u%04x", c);
+		}
+		else {
+			fputc(c, file);
+		}
+	}
+}
+
+int FIT_FinishTrace(const char *path) {
+	FIT_SHOULD_NOT_BE_NULL(path);
+
+	FIT_TraceEvent *events = FIT_traceEvents;
+	FIT_ASSERT_LOG_RETURN(events, "There is no trace being recorded.");
+	FIT_traceEvents = NULL;
+
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		free(events);
+		FIT_ASSERT_LOG_RETURN(0, "Unable to open [%s] to write the trace.", path);
+	}
+
+	// Once the ring has wrapped the oldest event is the next one to be overwritten.
+	uint64_t capacity = FIT_traceEventMask + 1;
+	uint64_t end = FIT_traceNext;
+	uint64_t begin = end > capacity ? end - capacity : 0;
+
+	fprintf(file, "{\"traceEvents\":[\n");
+	for (uint64_t i = begin; i < end; i++) {
+		const FIT_TraceEvent *event = &events[i & FIT_traceEventMask];
+		fprintf(file, "{\"name\":\"%s\",\"cat\":\"fit\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+			event->name, event->threadId,
+			(double)(event->start - FIT_traceStartTime) / 1000.0, (double)event->duration / 1000.0);
+		if (event->path[0]) {
+			fprintf(file, ",\"args\":{\"path\":\"");
+			FIT_WriteJsonString(file, event->path);
+			fprintf(file, "\"}");
+		}
+		fprintf(file, "}%s\n", i + 1 < end ? "," : "");
+	}
+	fprintf(file, "],\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":%llu}}\n", (unsigned long long)begin);
+
+	int result = fclose(file) == 0;
+	free(events);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to write the trace to [%s].", path);
+	return 1;
+}
+
+// Timers are a pair of calls around the work, they cost nothing but a branch when stats and the
+// trace are off.
+static uint64_t FIT_StatsBegin(void) {
+	return (FIT_statsEnabled || FIT_traceEvents) ? FIT_GetTimeNanoseconds() : 0;
+}
+
+static void FIT_StatsEnd(FIT_StatsPhase phase, uint64_t start) {
+	if (FIT_statsEnabled) {
+		FIT_AtomicAdd(&FIT_stats.phaseNanoseconds[phase], FIT_GetTimeNanoseconds() - start);
+		FIT_AtomicAdd(&FIT_stats.phaseCalls[phase], 1);
+	}
+	FIT_TraceEnd(FIT_STATS_PHASE_NAMES[phase], start, NULL);
+}
+
+static void FIT_StatsCount(uint64_t *counter, uint64_t add) {
+	if (FIT_statsEnabled) {
+		FIT_AtomicAdd(counter, add);
+	}
+}
+
+struct FIT_Operation {
+	FIT_Context *ctx;
+	FIT_Thread thread;
+	FIT_Path fileStorePath;
+	long int snapshotIndex;
+	FIT_ProgressProc proc;
+	void *user;
+	uint64_t startTime;
+
+	volatile uint64_t filesDone;
+	volatile uint64_t filesTotal;
+	volatile uint64_t bytesDone;
+	volatile uint64_t bytesTotal;
+	const char *volatile currentPath;
+	volatile uint64_t state;
+	volatile uint64_t cancelRequested;
+
+	// Only the thread that takes [callbackBusy] from 0 makes the callback, so they never overlap.
+	volatile uint64_t callbackBusy;
+	volatile uint64_t nextCallbackTime;
+};
+
+void FIT_GetOperationProgress(FIT_Operation *operation, FIT_Progress *progress) {
+	FIT_SHOULD_NOT_BE_NULL(operation);
+	FIT_SHOULD_NOT_BE_NULL(progress);
+
+	progress->state = (FIT_OperationState)operation->state;
+	progress->filesDone = operation->filesDone;
+	progress->filesTotal = operation->filesTotal;
+	progress->bytesDone = operation->bytesDone;
+	progress->bytesTotal = operation->bytesTotal;
+	progress->currentPath = operation->currentPath;
+	progress->elapsedNanoseconds = FIT_GetTimeNanoseconds() - operation->startTime;
+	progress->bytesPerSecond = progress->elapsedNanoseconds ? (double)progress->bytesDone * 1e9 / (double)progress->elapsedNanoseconds : 0.0;
+}
+
+static void FIT_ReportOperationProgress(FIT_Operation *operation, int force) {
+	if (!operation->proc) {
+		return;
+	}
+	uint64_t now = FIT_GetTimeNanoseconds();
+	if (!force && now < operation->nextCallbackTime) {
+		return;
+	}
+	if (FIT_AtomicAdd(&operation->callbackBusy, 1) == 0) {
+		operation->nextCallbackTime = now + FIT_PROGRESS_INTERVAL_NANOSECONDS;
+		FIT_Progress progress;
+		FIT_GetOperationProgress(operation, &progress);
+		operation->proc(&progress, operation->user);
+	}
+	FIT_AtomicAdd(&operation->callbackBusy, (uint64_t)-1);
+}
+
+// The work of an operation calls these, they do nothing when the context has no operation.
+static void FIT_OperationFileStarted(FIT_Context *ctx, const char *path) {
+	if (ctx->operation) {
+		ctx->operation->currentPath = path;
+	}
+}
+
+static void FIT_OperationFileDone(FIT_Context *ctx, uint64_t bytes) {
+	if (ctx->operation) {
+		FIT_AtomicAdd(&ctx->operation->filesDone, 1);
+		FIT_AtomicAdd(&ctx->operation->bytesDone, bytes);
+		FIT_ReportOperationProgress(ctx->operation, 0);
+	}
+}
+
+static int FIT_IsOperationCancelled(FIT_Context *ctx) {
+	return ctx->operation && ctx->operation->cancelRequested;
+}
+
 // Base64 encoding lookup table
 static const char FIT_BASE64_TABLE[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
@@ -200,6 +1226,65 @@ void FIT_DigestToBase64(FIT_Sha1Digest *input, FIT_Base64Digest *output) {
 	output->buffer[output_len] = '\0'; // Null-terminate the output string
 }
 
+#define FIT_SHA1_ROTL32(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+static void FIT_Sha1Block(uint32_t h[5], const uint8_t *block) {
+	uint32_t w[80];
+
+	// Copy the first sixteen 32 bit words of the block
+	for (int i = 0; i < 16; ++i) {
+		int j = i * 4;
+		w[i] = ((uint32_t)block[j] << 24) | ((uint32_t)block[j + 1] << 16) | ((uint32_t)block[j + 2] << 8) | ((uint32_t)block[j + 3]);
+	}
+
+	// then extend this to 80 32 bit words
+	for (int i = 16; i < 80; ++i) {
+		w[i] = FIT_SHA1_ROTL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+	}
+
+	//Initialize hash value for this chunk:
+	uint32_t a = h[0];
+	uint32_t b = h[1];
+	uint32_t c = h[2];
+	uint32_t d = h[3];
+	uint32_t e = h[4];
+
+	for (int i = 0; i < 80; ++i) {
+		uint32_t f, k;
+		if (i <= 19) {
+			f = (b & c) | ((~b) & d);
+			k = 0x5A827999;
+		}
+		else if (i <= 39) {
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		}
+		else if (i <= 59) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		}
+		else {
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		}
+
+		uint32_t temp = FIT_SHA1_ROTL32(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = FIT_SHA1_ROTL32(b, 30);
+		b = a;
+		a = temp;
+	}
+
+	h[0] += a;
+	h[1] += b;
+	h[2] += c;
+	h[3] += d;
+	h[4] += e;
+}
+
+#undef FIT_SHA1_ROTL32
+
 void FIT_DoSha1(const char *message, size_t messageLen, FIT_Sha1Digest *digest) {
 	FIT_SHOULD_NOT_BE_NULL(message);
 	FIT_SHOULD_NOT_BE_NULL(digest);
@@ -213,97 +1298,30 @@ void FIT_DoSha1(const char *message, size_t messageLen, FIT_Sha1Digest *digest)
 		0x10325476,
 		0xC3D2E1F0,
 	};
-	// Break up message into 512 bit blocks (64 bytes the SHA1_BLOCK_SIZE)
-
-	size_t blockCount = ((messageLen + 8) / 64) + 1;
-	uint8_t *messageBlocks = (uint8_t *)calloc(blockCount, FIT_SHA1_BLOCK_SIZE);
-	FIT_RELEASE_ASSERT(messageBlocks, "Out of memory when allocating SHA1 block.");
-
-	memcpy(messageBlocks, message, messageLen);
-
-	// Append bit "1" to message (add 0x80)
-	messageBlocks[messageLen] = 0x80;
-
-	// implictly appended all the zeros up to the nearest 512 bit block...
-
-	// Append the message length on to teh eng
-	uint64_t bitLength = messageLen * 8;
-
-	// convert from little to big endian
-	uint64_t bitLengthBigEndian = ((bitLength >> 56) & 0xFF) |
-		((bitLength >> 40) & 0xFF00) |
-		((bitLength >> 24) & 0xFF0000) |
-		((bitLength >> 8) & 0xFF000000) |
-
-		((bitLength << 8) & 0xFF00000000) |
-		((bitLength << 24) & 0xFF0000000000) |
-		((bitLength << 40) & 0xFF000000000000) |
-		((bitLength << 56) & 0xFF00000000000000);
 
-	memcpy(&messageBlocks[(blockCount * FIT_SHA1_BLOCK_SIZE) - sizeof(bitLengthBigEndian)], &bitLengthBigEndian, sizeof(bitLengthBigEndian));
-
-#define FIT_SHA1_ROTL32(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
-
-	uint32_t w[80] = {0};
-
-	for (size_t blockIndex = 0; blockIndex < blockCount; blockIndex++) {
-
-		memset(w, 0, sizeof(w));
-
-		// Message schedule : extend the sixteen 32 - bit words into eighty 32 - bit words :
-		size_t blockIndexBytes = 64 * blockIndex;
-		uint8_t *block = &messageBlocks[blockIndexBytes];
-
-		// Copy the first sixteen 32 bit words of the block
-		for (int i = 0; i < 16; ++i) {
-			int j = i * 4;
-			w[i] = ((uint32_t)block[j] << 24) | ((uint32_t)block[j + 1] << 16) | ((uint32_t)block[j + 2] << 8) | ((uint32_t)block[j + 3]);
-		}
-
-		// then extend this to 80 32 bit words
-		for (int i = 16; i < 80; ++i) {
-			w[i] = FIT_SHA1_ROTL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
-		}
-
-		//Initialize hash value for this chunk:
-		uint32_t a = h[0];
-		uint32_t b = h[1];
-		uint32_t c = h[2];
-		uint32_t d = h[3];
-		uint32_t e = h[4];
-
-		for (int i = 0; i < 80; ++i) {
-			uint32_t f, k;
-			if (i <= 19) {
-				f = (b & c) | ((~b) & d);
-				k = 0x5A827999;
-			}
-			else if (i >= 20 && i <= 39) {
-				f = b ^ c ^ d;
-				k = 0x6ED9EBA1;
-			}
-			else if (i >= 40 && i <= 59) {
-				f = (b & c) | (b & d) | (c & d);
-				k = 0x8F1BBCDC;
-			}
-			else if (i >= 60 && i <= 79) {
-				f = b ^ c ^ d;
-				k = 0xCA62C1D6;
-			}
+	// Whole 512 bit blocks (64 bytes the SHA1_BLOCK_SIZE) are hashed where they are, nothing is
+	// allocated, so hashing a file can not run out of memory part way through a save.
+	size_t fullBlockCount = messageLen / FIT_SHA1_BLOCK_SIZE;
+	for (size_t blockIndex = 0; blockIndex < fullBlockCount; blockIndex++) {
+		FIT_Sha1Block(h, (const uint8_t *)&message[blockIndex * FIT_SHA1_BLOCK_SIZE]);
+	}
 
-			uint32_t temp = FIT_SHA1_ROTL32(a, 5) + f + e + k + w[i];
-			e = d;
-			d = c;
-			c = FIT_SHA1_ROTL32(b, 30);
-			b = a;
-			a = temp;
-		}
+	// The rest of the message, the bit "1" (0x80), the zeros and the length fill one or two more blocks.
+	uint8_t tail[FIT_SHA1_BLOCK_SIZE * 2] = {0};
+	size_t tailLen = messageLen - fullBlockCount * FIT_SHA1_BLOCK_SIZE;
+	size_t tailBlockCount = tailLen + 1 + 8 > FIT_SHA1_BLOCK_SIZE ? 2 : 1;
+	memcpy(tail, &message[fullBlockCount * FIT_SHA1_BLOCK_SIZE], tailLen);
+	tail[tailLen] = 0x80;
+
+	// Append the message length in bits, big endian
+	uint64_t bitLength = (uint64_t)messageLen * 8;
+	uint8_t *lengthBytes = &tail[tailBlockCount * FIT_SHA1_BLOCK_SIZE - 8];
+	for (int i = 0; i < 8; ++i) {
+		lengthBytes[i] = (uint8_t)(bitLength >> (56 - i * 8));
+	}
 
-		h[0] += a;
-		h[1] += b;
-		h[2] += c;
-		h[3] += d;
-		h[4] += e;
+	for (size_t blockIndex = 0; blockIndex < tailBlockCount; blockIndex++) {
+		FIT_Sha1Block(h, &tail[blockIndex * FIT_SHA1_BLOCK_SIZE]);
 	}
 
 	for (int i = 0; i < 5; ++i) {
@@ -313,60 +1331,25 @@ void FIT_DoSha1(const char *message, size_t messageLen, FIT_Sha1Digest *digest)
 		digest->bytes[j + 2] = (h[i] >> 8) & 0xFF;
 		digest->bytes[j + 3] = h[i] & 0xFF;
 	}
-
-	free(messageBlocks);
-
-#undef FIT_SHA1_ROTL32
 }
 
+const FIT_Sha1TestVector FIT_SHA1_TEST_VECTORS[FIT_SHA1_TEST_VECTOR_COUNT] = {
+	{ "", "2jmj7l5rSw0yVb/vlWAYkK/YBwk=" },
+	{ "The quick brown fox jumps over the lazy dog", "L9ThxnotKPzthJ7hu3bnORuT6xI=" },
+	{ "The quick brown fox jumps over the lazy cog", "3p8sf9JeGzr60+haC9F9mxANtLM=" },
+	{ "dGhlIHNhbXBsZSBub25jZQ==", "hHLtf2V1k8aDQZfNjw3Ia1hCwt0=" },
+	{ "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", "Kfh9QIsMVZcl6xEPYxPHzW8SZ8w=" },
+	{ "dGhlIHNhbXBsZSBub25jZQ==258EAFA5-E914-47DA-95CA-C5AB0DC85B11", "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=" },
+};
+
 fit_can_abort FIT_Sha1Test() {
-	const size_t FIT_MAX_MESSAGE_LENGTH = 1024;
-	{
+	for (int i = 0; i < FIT_SHA1_TEST_VECTOR_COUNT; i++) {
+		const FIT_Sha1TestVector *vector = &FIT_SHA1_TEST_VECTORS[i];
 		FIT_Sha1Digest digest = {0};
-		FIT_DoSha1("", 0, &digest);
+		FIT_DoSha1(vector->message, strlen(vector->message), &digest);
 		FIT_Base64Digest base64Digest = {0};
 		FIT_DigestToBase64(&digest, &base64Digest);
-		FIT_RELEASE_ASSERT(strcmp(base64Digest.buffer, "2jmj7l5rSw0yVb/vlWAYkK/YBwk=") == 0, " Sha1 test failed");
-	}
-	{
-		const char message[] = "The quick brown fox jumps over the lazy dog";
-		FIT_Sha1Digest digest = {0};
-		FIT_DoSha1(message, strlen(message), &digest);
-		FIT_Base64Digest base64Digest;
-		FIT_DigestToBase64(&digest, &base64Digest);
-		FIT_RELEASE_ASSERT(strcmp(base64Digest.buffer, "L9ThxnotKPzthJ7hu3bnORuT6xI=") == 0, " Sha1 test failed");
-	}
-	{
-		const char message[] = "The quick brown fox jumps over the lazy cog";
-		FIT_Sha1Digest digest = {0};
-		FIT_DoSha1(message, strlen(message), &digest);
-		FIT_Base64Digest base64Digest;
-		FIT_DigestToBase64(&digest, &base64Digest);
-		FIT_RELEASE_ASSERT(strcmp(base64Digest.buffer, "3p8sf9JeGzr60+haC9F9mxANtLM=") == 0, " Sha1 test failed");
-	}
-	{
-		const char message[] = "dGhlIHNhbXBsZSBub25jZQ==";
-		FIT_Sha1Digest digest = {0};
-		FIT_DoSha1(message, strlen(message), &digest);
-		FIT_Base64Digest base64Digest;
-		FIT_DigestToBase64(&digest, &base64Digest);
-		FIT_RELEASE_ASSERT(strcmp(base64Digest.buffer, "hHLtf2V1k8aDQZfNjw3Ia1hCwt0=") == 0, " Sha1 test failed");
-	}
-	{
-		const char message[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
-		FIT_Sha1Digest digest = {0};
-		FIT_DoSha1(message, strlen(message), &digest);
-		FIT_Base64Digest base64Digest;
-		FIT_DigestToBase64(&digest, &base64Digest);
-		FIT_RELEASE_ASSERT(strcmp(base64Digest.buffer, "Kfh9QIsMVZcl6xEPYxPHzW8SZ8w=") == 0, " Sha1 test failed");
-	}
-	{
-		const char message[] = "dGhlIHNhbXBsZSBub25jZQ==258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
-		FIT_Sha1Digest digest = {0};
-		FIT_DoSha1(message, strlen(message), &digest);
-		FIT_Base64Digest base64Digest;
-		FIT_DigestToBase64(&digest, &base64Digest);
-		FIT_RELEASE_ASSERT(strcmp(base64Digest.buffer, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") == 0, " Sha1 test failed");
+		FIT_RELEASE_ASSERT(strcmp(base64Digest.buffer, vector->base64Digest) == 0, " Sha1 test failed");
 	}
 }
 
@@ -374,8 +1357,20 @@ int FIT_GetAbsolutePath(FIT_Path *path, const char *relativePath) {
 	FIT_SHOULD_NOT_BE_NULL(path);
 	FIT_SHOULD_NOT_BE_NULL(relativePath);
 
+#ifdef _WIN32
 	char *newPath = _fullpath(path->buffer, relativePath, FIT_MAX_PATH);
 	FIT_ASSERT_LOG_RETURN(newPath, "Unable to get an absolute path for relative path [%s]", relativePath);
+#else
+	char *newPath = realpath(relativePath, NULL);
+	FIT_ASSERT_LOG_RETURN(newPath, "Unable to get an absolute path for relative path [%s]", relativePath);
+	size_t newPathLen = strlen(newPath);
+	if (newPathLen >= FIT_MAX_PATH) {
+		free(newPath);
+		FIT_ASSERT_LOG_RETURN(0, "The absolute path for [%s] is too long.", relativePath);
+	}
+	memcpy(path->buffer, newPath, newPathLen + 1);
+	free(newPath);
+#endif
 	path->buffer[FIT_MAX_PATH - 1] = '\0';
 	return 1;
 }
@@ -434,6 +1429,7 @@ int FIT_AppendPath(const FIT_Path *srce, const char *str, FIT_Path *outPath) {
 
 void FIT_ContextInit(FIT_Context *ctx) {
 	memset(ctx, 0, sizeof(FIT_Context));
+	ctx->workingDirectoryFd = -1;
 }
 
 fit_can_abort FIT_ContextDeinit(FIT_Context *ctx) {
@@ -442,9 +1438,25 @@ fit_can_abort FIT_ContextDeinit(FIT_Context *ctx) {
 		result = fclose(ctx->fileStore);
 		FIT_RELEASE_ASSERT(result == 0, "Unable to close file");
 	}
+	if (ctx->blobStore) {
+		fclose(ctx->blobStore);
+		ctx->blobStore = NULL;
+	}
+	FIT_UnlockFileStore(ctx);
+
+#ifndef _WIN32
+	if (ctx->workingDirectoryFd != -1) {
+		close(ctx->workingDirectoryFd);
+		ctx->workingDirectoryFd = -1;
+	}
+#endif
+
+	FIT_IoRingDestroy(ctx->ioRing);
+	ctx->ioRing = NULL;
 
 	for (FIT_FileEntry *entry = ctx->entryHead; entry != NULL;) {
 		FIT_FileEntry *next = entry->poolNext;
+		free(entry->path);
 		free(entry->buffer);
 		free(entry);
 		entry = next;
@@ -454,6 +1466,12 @@ fit_can_abort FIT_ContextDeinit(FIT_Context *ctx) {
 		free(snap);
 		snap = next;
 	}
+
+	free(ctx->fsData.buffer);
+	memset(&ctx->fsData, 0, sizeof(FIT_FileStoreData));
+
+	FIT_IgnoreMatcherDeinit(&ctx->ignore);
+	FIT_HistoryIndexDeinit(&ctx->history);
 }
 
 int FIT_CreateStore(FIT_Context *ctx, const char *path) {
@@ -563,7 +1581,7 @@ void *FIT_AddToSnapshotList(FIT_Context *ctx, FIT_Snapshot *snapshot) {
 		snapshot->prev = ctx->fsData.snapshotTail;
 		ctx->fsData.snapshotTail = snapshot;
 	}
-	ctx->fsData.snapshotCount++;
+	snapshot->index = ctx->fsData.snapshotCount++;
 }
 
 
@@ -588,6 +1606,10 @@ void *FIT_RemoveFromSnapshotList(FIT_Context *ctx, FIT_Snapshot *snap) {
 		snap->next->prev = snap->prev;
 	}
 
+	for (FIT_Snapshot *after = snap->next; after != NULL; after = after->next) {
+		after->index--;
+	}
+
 	snap->next = NULL;
 	snap->prev = NULL;
 	ctx->fsData.snapshotCount--;
@@ -614,6 +1636,7 @@ FIT_FileEntry *FIT_AllocateFileEntry(FIT_Context *ctx) {
 
 	FIT_FileEntry *entry = (FIT_FileEntry *)calloc(1, sizeof(FIT_FileEntry));
 	FIT_ASSERT_LOG_RETURN(entry, "Out of memory, unable to allocate file entry");
+	ctx->entryPoolCount++;
 	if (ctx->entryHead == NULL) {
 		ctx->entryHead = entry;
 		ctx->entryTail = entry;
@@ -631,7 +1654,7 @@ int FIT_IsPathInTrackingList(FIT_Context *ctx, const char *path) {
 	for (FIT_FileEntry *entry = ctx->fsData.entryTrackingHead;
 		 entry != NULL;
 		 entry = entry->trackNext) {
-		if (strncmp(entry->path, path, FIT_MAX_PATH) == 0) {
+		if (strcmp(entry->path, path) == 0) {
 			return 1;
 		}
 	}
@@ -651,6 +1674,8 @@ int FIT_CopyFileEntry(FIT_FileEntry *dest, FIT_FileEntry *srce) {
 	dest->pathLen = srce->pathLen;
 	dest->offset = srce->offset;
 	dest->offsetLen = srce->offsetLen;
+	dest->modifiedTime = srce->modifiedTime;
+	return 1;
 }
 
 int FIT_AllocateFileContents(FILE *file, char **buffer, uint64_t *bufferLength) {
@@ -659,6 +1684,7 @@ int FIT_AllocateFileContents(FILE *file, char **buffer, uint64_t *bufferLength)
 	FIT_SHOULD_NOT_BE_NULL(buffer);
 
 	int result = 0;
+	uint64_t statsStart = FIT_StatsBegin();
 
 	result = fseek(file, 0L, SEEK_END);
 	FIT_ASSERT_LOG_RETURN(result == 0, "fseek to end of file failed.");
@@ -683,6 +1709,9 @@ int FIT_AllocateFileContents(FILE *file, char **buffer, uint64_t *bufferLength)
 		FIT_ASSERT_LOG_RETURN(result == 1, "TODO");
 		*bufferLength = fileSize;
 	}
+
+	FIT_StatsEnd(FIT_PHASE_READ_FILES, statsStart);
+	FIT_StatsCount(&FIT_stats.bytesRead, (uint64_t)fileSize);
 	return 1;
 }
 
@@ -690,11 +1719,14 @@ int FIT_HashBuffer(FIT_Base64Digest *base64Digest, char *buffer, uint64_t buffer
 	FIT_SHOULD_NOT_BE_NULL(base64Digest);
 
 	size_t messageLen = bufferLen;
+	uint64_t statsStart = FIT_StatsBegin();
 
 	FIT_Sha1Digest digest = {0};
 	FIT_DoSha1(buffer, messageLen, &digest);
 	FIT_DigestToBase64(&digest, base64Digest);
 
+	FIT_StatsEnd(FIT_PHASE_HASH, statsStart);
+	FIT_StatsCount(&FIT_stats.filesHashed, 1);
 	return 1;
 }
 
@@ -719,10 +1751,13 @@ int FIT_SaveFileEntry(FILE *file, FIT_FileEntry *entry) {
 	result = fwrite(&entry->offsetLen, sizeof(uint64_t), 1, file);
 	FIT_ASSERT_LOG_RETURN(result == 1, "TODO");
 
+	result = fwrite(&entry->modifiedTime, sizeof(uint64_t), 1, file);
+	FIT_ASSERT_LOG_RETURN(result == 1, "TODO");
+
 	return 1;
 }
 
-int FIT_LoadFileEntry(FILE *file, FIT_FileEntry *entry) {
+int FIT_LoadFileEntry(FILE *file, FIT_FileEntry *entry, uint32_t version) {
 	FIT_SHOULD_NOT_BE_NULL(file);
 	FIT_SHOULD_NOT_BE_NULL(entry);
 
@@ -730,7 +1765,7 @@ int FIT_LoadFileEntry(FILE *file, FIT_FileEntry *entry) {
 
 	result = fread(&entry->pathLen, sizeof(uint32_t), 1, file);
 	FIT_ASSERT_LOG_RETURN(result == 1, "Could not load the path length of a file entry.");
-	FIT_ASSERT_LOG_RETURN(entry->pathLen && entry->pathLen < FIT_MAX_PATH, "The path length of a file entry is invalid [%u].", entry->pathLen);
+	FIT_ASSERT_LOG_RETURN(entry->pathLen && entry->pathLen < FIT_MAX_ENTRY_PATH, "The path length of a file entry is invalid [%u].", entry->pathLen);
 
 	entry->path = (char *)calloc(entry->pathLen + 1, sizeof(char));
 	FIT_ASSERT_LOG_RETURN(entry->path, "Out of memory. Could not allocate string for path of file entry.");
@@ -749,14 +1784,19 @@ int FIT_LoadFileEntry(FILE *file, FIT_FileEntry *entry) {
 	result = fread(&entry->offsetLen, sizeof(uint64_t), 1, file);
 	FIT_ASSERT_LOG_RETURN(result == 1, "Unable to read offset length of file entry.");
 
+	if (version >= 1) {
+		result = fread(&entry->modifiedTime, sizeof(uint64_t), 1, file);
+		FIT_ASSERT_LOG_RETURN(result == 1, "Unable to read modified time of file entry.");
+	}
+
 	return 1;
 }
 
-int FIT_SaveFileStoreFromBuffer(FIT_Context *ctx, FILE *file) {
+int FIT_SaveFileStoreMetadataFromBuffer(FIT_Context *ctx, FILE *file) {
 	FIT_SHOULD_NOT_BE_NULL(ctx);
 	FIT_SHOULD_NOT_BE_NULL(file);
 
-	static uint32_t version = 0;
+	static uint32_t version = FIT_FILE_STORE_VERSION;
 	int result = 0;
 
 	result = fwrite(&version, sizeof(uint32_t), 1, file);
@@ -769,6 +1809,9 @@ int FIT_SaveFileStoreFromBuffer(FIT_Context *ctx, FILE *file) {
 		 snapshot != NULL;
 		 snapshot = snapshot->next) {
 
+		result = fwrite(&snapshot->savedTime, sizeof(uint64_t), 1, file);
+		FIT_ASSERT_LOG_RETURN(result == 1, "TODO");
+
 		uint32_t entryListCount = snapshot->entryCount;
 		result = fwrite(&entryListCount, sizeof(uint32_t), 1, file);
 		FIT_ASSERT_LOG_RETURN(result == 1, "TODO");
@@ -794,6 +1837,16 @@ int FIT_SaveFileStoreFromBuffer(FIT_Context *ctx, FILE *file) {
 	result = fwrite(&ctx->fsData.bufferCount, sizeof(uint64_t), 1, file);
 	FIT_ASSERT_LOG_RETURN(result == 1, "TODO");
 
+	return 1;
+}
+
+int FIT_SaveFileStoreFromBuffer(FIT_Context *ctx, FILE *file) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(file);
+
+	int result = FIT_SaveFileStoreMetadataFromBuffer(ctx, file);
+	FIT_ASSERT_LOG_RETURN(result, "TODO");
+
 	if (ctx->fsData.bufferCount) {
 		result = fwrite(ctx->fsData.buffer, ctx->fsData.bufferCount, 1, file);
 		FIT_ASSERT_LOG_RETURN(result == 1, "TODO");
@@ -802,29 +1855,270 @@ int FIT_SaveFileStoreFromBuffer(FIT_Context *ctx, FILE *file) {
 	return 1;
 }
 
+static char *FIT_AllocateStorePath(const char *path, const char *suffix) {
+	size_t pathLen = strlen(path);
+	size_t suffixLen = strlen(suffix);
+	char *storePath = (char *)malloc(pathLen + suffixLen + 1);
+	FIT_ASSERT_LOG_RETURN(storePath, "Out of memory. Unable to allocate path.");
+	memcpy(storePath, path, pathLen);
+	memcpy(&storePath[pathLen], suffix, suffixLen + 1);
+	return storePath;
+}
+
+static FILE *FIT_OpenStoreForReading(const char *path) {
+#ifdef _WIN32
+	// Shared for delete too, so a writer can rename a new store over the one being read.
+	HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE) {
+		return NULL;
+	}
+	int fd = _open_osfhandle((intptr_t)handle, _O_RDONLY | _O_BINARY);
+	if (fd == -1) {
+		CloseHandle(handle);
+		return NULL;
+	}
+	FILE *file = _fdopen(fd, "rb");
+	if (!file) {
+		_close(fd);
+	}
+	return file;
+#else
+	return fopen(path, "rb");
+#endif
+}
+
+static int FIT_GetStoreIdentity(FILE *file, FIT_StoreIdentity *identity) {
+	memset(identity, 0, sizeof(FIT_StoreIdentity));
+#ifdef _WIN32
+	BY_HANDLE_FILE_INFORMATION info;
+	if (!GetFileInformationByHandle((HANDLE)_get_osfhandle(_fileno(file)), &info)) {
+		return 0;
+	}
+	identity->fileId = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+	identity->size = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	identity->modifiedTime = ((uint64_t)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+#else
+	struct stat st;
+	if (fstat(fileno(file), &st) != 0) {
+		return 0;
+	}
+	identity->fileId = (uint64_t)st.st_ino;
+	identity->size = (uint64_t)st.st_size;
+#ifdef __APPLE__
+	identity->modifiedTime = (uint64_t)st.st_mtimespec.tv_sec * 1000000000ull + (uint64_t)st.st_mtimespec.tv_nsec;
+#else
+	identity->modifiedTime = (uint64_t)st.st_mtim.tv_sec * 1000000000ull + (uint64_t)st.st_mtim.tv_nsec;
+#endif
+#endif
+	identity->valid = 1;
+	return 1;
+}
+
+// What is at [path] now, invalid when there is nothing.
+static void FIT_GetStoreIdentityFromPath(const char *path, FIT_StoreIdentity *identity) {
+	memset(identity, 0, sizeof(FIT_StoreIdentity));
+	FILE *file = FIT_OpenStoreForReading(path);
+	if (file) {
+		FIT_GetStoreIdentity(file, identity);
+		fclose(file);
+	}
+}
+
+// Whether the store at [path] is still the one this context loaded, or nothing was loaded.
+static int FIT_LoadedStoreIsCurrent(FIT_Context *ctx, const char *path) {
+	if (!ctx->loadedStore.valid) {
+		return 1;
+	}
+	FIT_StoreIdentity current;
+	FIT_GetStoreIdentityFromPath(path, &current);
+	return current.fileId == ctx->loadedStore.fileId && current.size == ctx->loadedStore.size &&
+		current.modifiedTime == ctx->loadedStore.modifiedTime;
+}
+
 int FIT_SaveFileStoreFromFile(FIT_Context *ctx, const char *path) {
 	FIT_SHOULD_NOT_BE_NULL(ctx);
 	FIT_SHOULD_NOT_BE_NULL(path);
 
 	int result = 0;
 
+	if (ctx->deferSave && ctx->storeLoaded) {
+		ctx->savePending = 1;
+		return 1;
+	}
+
 	FIT_RELEASE_ASSERT(ctx->fileStore == NULL, "Trying to save the file store after it's already been opened");
 
-	ctx->fileStore = fopen(path, "wb");
-	FIT_ASSERT_LOG_RETURN(ctx->fileStore, "Unable to open file [%s]", path);
+	uint8_t wasLocked = ctx->storeLocked;
+	result = FIT_LockFileStore(ctx, path);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to lock file store [%s] to save it.", path);
 
-	result = FIT_SaveFileStoreFromBuffer(ctx, ctx->fileStore);
-	FIT_ASSERT_LOG_RETURN(result, "TODO");
+	// Replacing a store someone else saved after this context loaded it would lose their snapshots.
+	if (!FIT_LoadedStoreIsCurrent(ctx, path)) {
+		if (!wasLocked) {
+			FIT_UnlockFileStore(ctx);
+		}
+		FIT_ASSERT_LOG_RETURN(0, "The file store [%s] was changed by something else since it was loaded. Load it again and retry.", path);
+	}
 
-	result = fclose(ctx->fileStore);
-	FIT_ASSERT_LOG_RETURN(result == 0, "TODO");
+	// The old store is left alone until the new one is on disk, so a crash or a full disk
+	// part way through a save loses nothing.
+	char *tempPath = FIT_AllocateStorePath(path, FIT_STORE_TEMP_SUFFIX);
+	ctx->fileStore = tempPath ? fopen(tempPath, "wb") : NULL;
+	if (!ctx->fileStore) {
+		FIT_LOG("Unable to open file [%s]", tempPath ? tempPath : path);
+		free(tempPath);
+		if (!wasLocked) {
+			FIT_UnlockFileStore(ctx);
+		}
+		return 0;
+	}
+	setvbuf(ctx->fileStore, NULL, _IOFBF, 1 << 20);
+
+#ifndef _WIN32
+	// Keep the permissions of the store being replaced.
+	struct stat st;
+	if (stat(path, &st) == 0) {
+		fchmod(fileno(ctx->fileStore), st.st_mode & 07777);
+	}
+#endif
+
+	uint64_t statsStart = FIT_StatsBegin();
+	result = FIT_SaveFileStoreFromBuffer(ctx, ctx->fileStore);
+	int64_t size = FIT_FTELL(ctx->fileStore);
 
+	// One sync for the whole store and one for the rename, however many files the save had.
+	result = result && FIT_SyncFile(ctx->fileStore);
+	result = (fclose(ctx->fileStore) == 0) && result;
 	ctx->fileStore = NULL;
 
+	result = result && FIT_ReplaceFile(tempPath, path);
+	if (!result) {
+		remove(tempPath);
+	}
+	else {
+		FIT_GetStoreIdentityFromPath(path, &ctx->loadedStore);
+	}
+	free(tempPath);
+	if (!wasLocked) {
+		FIT_UnlockFileStore(ctx);
+	}
+	FIT_ASSERT_LOG_RETURN(result, "Unable to save file store [%s], it has been left as it was.", path);
+
+	FIT_StatsCount(&FIT_stats.bytesWritten, (uint64_t)size);
+	FIT_StatsEnd(FIT_PHASE_SAVE_STORE, statsStart);
+
 	return 1;
 }
 
-int FIT_LoadFileStoreFromBuffer(FIT_Context *ctx, FILE *file) {
+int FIT_SyncFile(FILE *file) {
+	FIT_SHOULD_NOT_BE_NULL(file);
+
+	int result = fflush(file);
+	FIT_ASSERT_LOG_RETURN(result == 0, "Unable to flush the file.");
+
+#ifdef _WIN32
+	result = _commit(_fileno(file));
+#else
+	result = fsync(fileno(file));
+#endif
+	FIT_ASSERT_LOG_RETURN(result == 0, "Unable to sync the file to disk.");
+	return 1;
+}
+
+int FIT_ReplaceFile(const char *from, const char *to) {
+	FIT_SHOULD_NOT_BE_NULL(from);
+	FIT_SHOULD_NOT_BE_NULL(to);
+
+#ifdef _WIN32
+	BOOL replaced = MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+	FIT_ASSERT_LOG_RETURN(replaced, "Unable to replace [%s] with [%s].", to, from);
+#else
+	int result = rename(from, to);
+	FIT_ASSERT_LOG_RETURN(result == 0, "Unable to replace [%s] with [%s].", to, from);
+
+	// The rename lives in the directory, so it is only on disk once the directory is.
+	const char *slash = strrchr(to, '/');
+	char *dir = slash ? strndup(to, slash == to ? 1 : (size_t)(slash - to)) : strdup(".");
+	FIT_ASSERT_LOG_RETURN(dir, "Out of memory. Unable to allocate path.");
+	int dirFd = open(dir, O_RDONLY);
+	free(dir);
+	if (dirFd >= 0) {
+		fsync(dirFd);
+		close(dirFd);
+	}
+#endif
+	return 1;
+}
+
+int FIT_LockFileStore(FIT_Context *ctx, const char *fileStoreStr) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(fileStoreStr);
+
+	if (ctx->storeLocked) {
+		return 1;
+	}
+
+	// The lock file is never removed, removing it would let two writers lock different files.
+	char *lockPath = FIT_AllocateStorePath(fileStoreStr, FIT_STORE_LOCK_SUFFIX);
+	FIT_ASSERT_LOG_RETURN(lockPath, "Unable to lock file store [%s].", fileStoreStr);
+
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(lockPath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	free(lockPath);
+	FIT_ASSERT_LOG_RETURN(handle != INVALID_HANDLE_VALUE, "Unable to open the lock file of file store [%s].", fileStoreStr);
+
+	OVERLAPPED overlapped = {0};
+	if (!LockFileEx(handle, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, 1, 0, &overlapped)) {
+		FIT_LOG("Waiting for another process to finish changing file store [%s].", fileStoreStr);
+		if (!LockFileEx(handle, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped)) {
+			CloseHandle(handle);
+			FIT_ASSERT_LOG_RETURN(0, "Unable to lock file store [%s].", fileStoreStr);
+		}
+	}
+	ctx->storeLock = handle;
+#else
+	int fd = open(lockPath, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+	free(lockPath);
+	FIT_ASSERT_LOG_RETURN(fd != -1, "Unable to open the lock file of file store [%s].", fileStoreStr);
+
+	if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+		FIT_LOG("Waiting for another process to finish changing file store [%s].", fileStoreStr);
+		int result = 0;
+		do {
+			result = flock(fd, LOCK_EX);
+		} while (result != 0 && errno == EINTR);
+		if (result != 0) {
+			close(fd);
+			FIT_ASSERT_LOG_RETURN(0, "Unable to lock file store [%s].", fileStoreStr);
+		}
+	}
+	ctx->storeLock = fd;
+#endif
+
+	ctx->storeLocked = 1;
+	return 1;
+}
+
+void FIT_UnlockFileStore(FIT_Context *ctx) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+
+	if (!ctx->storeLocked) {
+		return;
+	}
+#ifdef _WIN32
+	// Closing the handle lets go of the lock.
+	CloseHandle(ctx->storeLock);
+	ctx->storeLock = NULL;
+#else
+	close(ctx->storeLock);
+	ctx->storeLock = -1;
+#endif
+	ctx->storeLocked = 0;
+}
+
+int FIT_LoadFileStoreMetadataFromBuffer(FIT_Context *ctx, FILE *file) {
 	FIT_SHOULD_NOT_BE_NULL(ctx);
 	FIT_SHOULD_NOT_BE_NULL(file);
 
@@ -833,7 +2127,7 @@ int FIT_LoadFileStoreFromBuffer(FIT_Context *ctx, FILE *file) {
 
 	result = fread(&version, sizeof(uint32_t), 1, file);
 	FIT_ASSERT_LOG_RETURN(result == 1, "Unable to load version to file store");
-	FIT_ASSERT_LOG_RETURN(version == 0, "Only version 0 supported.");
+	FIT_ASSERT_LOG_RETURN(version <= FIT_FILE_STORE_VERSION, "The file store is version [%u], only versions up to [%u] are supported.", version, FIT_FILE_STORE_VERSION);
 
 	uint32_t snapshotCount;
 	result = fread(&snapshotCount, sizeof(uint32_t), 1, file);
@@ -846,6 +2140,11 @@ int FIT_LoadFileStoreFromBuffer(FIT_Context *ctx, FILE *file) {
 
 		FIT_AddToSnapshotList(ctx, snapshot);
 
+		if (version >= 2) {
+			result = fread(&snapshot->savedTime, sizeof(uint64_t), 1, file);
+			FIT_ASSERT_LOG_RETURN(result == 1, "Unable to load the saved time of snapshot [%u].", isnap);
+		}
+
 		uint32_t entryListCount = 0;
 		result = fread(&entryListCount, sizeof(uint32_t), 1, file);
 		FIT_ASSERT_LOG_RETURN(result == 1, "Unable to load file entry list count from file store");
@@ -859,9 +2158,12 @@ int FIT_LoadFileStoreFromBuffer(FIT_Context *ctx, FILE *file) {
 
 			FIT_AddToSnapshotFileEntryList(snapshot, entry);
 
-			result = FIT_LoadFileEntry(file, entry);
+			result = FIT_LoadFileEntry(file, entry, version);
 			FIT_ASSERT_LOG_RETURN(result == 1, "Unable to read file entry.");
 		}
+
+		result = FIT_HistoryIndexAddSnapshot(&ctx->history, snapshot);
+		FIT_ASSERT_LOG_RETURN(result, "Unable to index snapshot [%u].", isnap);
 	}
 
 	uint32_t trackingListCount;
@@ -876,14 +2178,30 @@ int FIT_LoadFileStoreFromBuffer(FIT_Context *ctx, FILE *file) {
 
 		FIT_AddToTrackingList(ctx, entry);
 
-		result = FIT_LoadFileEntry(file, entry);
+		result = FIT_LoadFileEntry(file, entry, version);
 		FIT_ASSERT_LOG_RETURN(result == 1, "Unable to read tracking file entry [%d]. It is recommended to clear the tracking list and try again.", index);
 		index++;
 	}
 
 	result = fread(&ctx->fsData.bufferCount, sizeof(uint64_t), 1, file);
 	FIT_ASSERT_LOG_RETURN(result == 1, "Unable to read the buffer count of the file store.");
-	FIT_ASSERT_LOG_RETURN(ctx->fsData.bufferCount < 100000000, "Buffer count of file store is invalid [%u].", ctx->fsData.bufferCount);
+
+	// The buffer is the rest of the file, so it can be no bigger than what is left.
+	int64_t bufferStart = FIT_FTELL(file);
+	FIT_ASSERT_LOG_RETURN(bufferStart >= 0 && FIT_FSEEK(file, 0, SEEK_END) == 0, "Unable to seek in the file store.");
+	int64_t fileSize = FIT_FTELL(file);
+	FIT_ASSERT_LOG_RETURN(FIT_FSEEK(file, bufferStart, SEEK_SET) == 0, "Unable to seek in the file store.");
+	FIT_ASSERT_LOG_RETURN(ctx->fsData.bufferCount <= (uint64_t)(fileSize - bufferStart), "Buffer count of file store is invalid [%llu].", (unsigned long long)ctx->fsData.bufferCount);
+
+	return 1;
+}
+
+int FIT_LoadFileStoreFromBuffer(FIT_Context *ctx, FILE *file) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(file);
+
+	int result = FIT_LoadFileStoreMetadataFromBuffer(ctx, file);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to load the file store metadata.");
 
 	if (ctx->fsData.bufferCount) {
 		ctx->fsData.buffer = (char *)calloc(ctx->fsData.bufferCount, sizeof(char));
@@ -900,887 +2218,5682 @@ int FIT_LoadFileStoreFromFile(FIT_Context *ctx, const char *filename) {
 	FIT_SHOULD_NOT_BE_NULL(ctx);
 	FIT_SHOULD_NOT_BE_NULL(filename);
 
+	if (ctx->storeLoaded) {
+		return 1;
+	}
+
 	FIT_RELEASE_ASSERT(ctx->fileStore == NULL, "Trying to load the file store after it's already been loaded");
 
-	ctx->fileStore = fopen(filename, "rb");
+	ctx->fileStore = FIT_OpenStoreForReading(filename);
 	FIT_ASSERT_LOG_RETURN(ctx->fileStore, "Unable to open file [%s]", filename);
+	FIT_GetStoreIdentity(ctx->fileStore, &ctx->loadedStore);
 
+	uint64_t statsStart = FIT_StatsBegin();
 	int result = FIT_LoadFileStoreFromBuffer(ctx, ctx->fileStore);
 	FIT_ASSERT_LOG_RETURN(result, "Unable to load file store from buffer");
+	FIT_StatsEnd(FIT_PHASE_LOAD_STORE, statsStart);
+	FIT_StatsCount(&FIT_stats.bytesRead, (uint64_t)FIT_FTELL(ctx->fileStore));
 
 	result = fclose(ctx->fileStore);
 	FIT_ASSERT_LOG_RETURN(result == 0, "Unable to close file store [%s]", filename);
 
 	ctx->fileStore = NULL;
+	ctx->storeLoaded = 1;
 
 	return 1;
 }
 
-int FIT_LoadFileStoreAndSetWorkingDirectory(FIT_Context *ctx, const char *fileStoreStr) {
+int FIT_LoadFileStoreMetadataFromFile(FIT_Context *ctx, const char *filename) {
 	FIT_SHOULD_NOT_BE_NULL(ctx);
-	FIT_SHOULD_NOT_BE_NULL(fileStoreStr);
+	FIT_SHOULD_NOT_BE_NULL(filename);
 
-	int result = 0;
+	if (ctx->storeLoaded) {
+		return 1;
+	}
 
-	// Extract the full path of the file store
-	result = FIT_GetAbsolutePath(&ctx->fileStoreAbsolutePath, fileStoreStr);
-	FIT_ASSERT_LOG_RETURN(result, "Unable to get the absolute path for the file store.");
+	FIT_RELEASE_ASSERT(ctx->blobStore == NULL, "Trying to load the file store after it's already been loaded");
 
-	result = FIT_GoUpDirectory(&ctx->fileStoreAbsolutePath, &ctx->workingDirectory);
-	FIT_ASSERT_LOG_RETURN(result, "Unable to get the working directory for the file store.");
+	// Everything is read from this one open file, so a save renaming a new store over it
+	// part way through does not change what is read.
+	FILE *file = FIT_OpenStoreForReading(filename);
+	FIT_ASSERT_LOG_RETURN(file, "Unable to open file [%s]", filename);
+	FIT_GetStoreIdentity(file, &ctx->loadedStore);
 
-	result = FIT_LoadFileStoreFromFile(ctx, fileStoreStr);
-	FIT_ASSERT_LOG_RETURN(result, "Unable to load file store [%s]", fileStoreStr);
+	uint64_t statsStart = FIT_StatsBegin();
+	int result = FIT_LoadFileStoreMetadataFromBuffer(ctx, file);
+	if (!result) {
+		fclose(file);
+		FIT_ASSERT_LOG_RETURN(result, "Unable to load file store metadata from [%s]", filename);
+	}
+	FIT_StatsEnd(FIT_PHASE_LOAD_STORE, statsStart);
+	FIT_StatsCount(&FIT_stats.bytesRead, (uint64_t)FIT_FTELL(file));
 
-	return result;
+	// Keep the store open, blobs are read from it on demand.
+	ctx->blobStore = file;
+	ctx->blobStoreOffset = (uint64_t)FIT_FTELL(file);
+	ctx->storeLoaded = 1;
+
+	return 1;
 }
 
-int FIT_TrackAll(FIT_Context *ctx, const char *fileStoreStr, size_t fileStoreStrLen) {
+int FIT_ReadStoreRange(FIT_Context *ctx, uint64_t offset, char *buffer, uint64_t len) {
 	FIT_SHOULD_NOT_BE_NULL(ctx);
-	FIT_SHOULD_NOT_BE_NULL(fileStoreStr);
-
-	int result = 0;
+	FIT_SHOULD_NOT_BE_NULL(buffer);
+	FIT_ASSERT_LOG_RETURN(ctx->blobStore, "The file store is not open.");
 
-	// Go through the current directory and track all of those files.
+	// Positioned reads, so any number of threads can share the one open store.
+	while (len) {
 #ifdef _WIN32
-	{
-		// TODO: sort out all the relative, current working directory, crap. Since if I change the current directory, this wont work
-		WIN32_FIND_DATAA ffd;
-		HANDLE hFind = INVALID_HANDLE_VALUE;
-
-		// the find first file has to end with a wild card because windows is insane
-		FIT_Path wildcardPath = {0};
-		size_t pathLen = strnlen(ctx->workingDirectory.buffer, FIT_MAX_PATH - 1);
-		FIT_ASSERT_LOG_RETURN(pathLen, "TODO.");
+		HANDLE handle = (HANDLE)_get_osfhandle(_fileno(ctx->blobStore));
+		OVERLAPPED overlapped = {0};
+		overlapped.Offset = (DWORD)offset;
+		overlapped.OffsetHigh = (DWORD)(offset >> 32);
+		DWORD chunk = len > (1u << 30) ? (1u << 30) : (DWORD)len;
+		DWORD read = 0;
+		FIT_ASSERT_LOG_RETURN(ReadFile(handle, buffer, chunk, &read, &overlapped) && read, "Unable to read the file store at [%llu].", (unsigned long long)offset);
+#else
+		size_t chunk = len > (1u << 30) ? (1u << 30) : (size_t)len;
+		ssize_t read = pread(fileno(ctx->blobStore), buffer, chunk, (off_t)offset);
+		FIT_ASSERT_LOG_RETURN(read > 0, "Unable to read the file store at [%llu].", (unsigned long long)offset);
+#endif
+		buffer += read;
+		offset += (uint64_t)read;
+		len -= (uint64_t)read;
+		FIT_StatsCount(&FIT_stats.bytesRead, (uint64_t)read);
+	}
+	return 1;
+}
 
-		strncpy(wildcardPath.buffer, ctx->workingDirectory.buffer, pathLen);
-		wildcardPath.buffer[pathLen] = '\0';
-		strncat(wildcardPath.buffer, "*", FIT_MAX_PATH - 1);
+int FIT_CopyBlobToFile(FIT_Context *ctx, FIT_FileEntry *entry, FILE *file) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(entry);
+	FIT_SHOULD_NOT_BE_NULL(file);
 
-		hFind = FindFirstFileA(wildcardPath.buffer, &ffd);
-		FIT_ASSERT_LOG_RETURN(hFind != INVALID_HANDLE_VALUE, "Unable to find first file in current directory [%d].", GetLastError());
+	int result = 0;
 
-		do
-		{
-			if (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-			{
-				/* skip over directories */
-			}
-			else if (strncmp(ffd.cFileName, fileStoreStr, fileStoreStrLen) == 0) {
-				/* skip over the current file store */
-			}
-			else
-			{
-				result = FIT_AppendPath(&ctx->workingDirectory, ffd.cFileName, &ctx->trackedFileAbsolutePath);
-				if (!result) {
-					FindClose(hFind);
-					FIT_ASSERT_LOG_RETURN(result, "Unable to append track filename to working directory path.");
-				}
+	if (ctx->fsData.buffer) {
+		result = fwrite(&ctx->fsData.buffer[entry->offset], entry->offsetLen, 1, file);
+		FIT_ASSERT_LOG_RETURN(result == 1, "Unable to write the contents of [%s].", entry->path);
+		return 1;
+	}
 
-				FILE *fileToTrack = fopen(ctx->trackedFileAbsolutePath.buffer, "rb");
-				if (!fileToTrack) {
-					FindClose(hFind);
-					FIT_ASSERT_LOG_RETURN(fileToTrack, "Unable to open the [%s] file to track.", ctx->trackedFileAbsolutePath.buffer);
-				}
+	FIT_ASSERT_LOG_RETURN(ctx->blobStore, "The file store is not open to read the contents of [%s].", entry->path);
+	FIT_ASSERT_LOG_RETURN(entry->offset + entry->offsetLen <= ctx->fsData.bufferCount, "The contents of [%s] are outside the file store buffer.", entry->path);
 
-				result = fclose(fileToTrack);
-				if (result != 0) {
-					FindClose(hFind);
-					FIT_ASSERT_LOG_RETURN(result == 0, "Unable to close the [%s] file.", ctx->trackedFileAbsolutePath.buffer);
-				}
+	uint64_t offset = ctx->blobStoreOffset + entry->offset;
+	uint64_t remaining = entry->offsetLen;
 
-				if (!FIT_IsPathInTrackingList(ctx, ffd.cFileName)) {
+#ifndef _WIN32
+	result = fflush(file);
+	FIT_ASSERT_LOG_RETURN(result == 0, "Unable to flush [%s].", entry->path);
 
-					FIT_FileEntry *entry = FIT_AllocateFileEntry(ctx);
-					FIT_ASSERT_LOG_RETURN(entry, "TODO");
+	int srcFd = fileno(ctx->blobStore);
+	int dstFd = fileno(file);
 
-					size_t strLen = strnlen(ffd.cFileName, FIT_MAX_PATH);
-					FIT_ASSERT_LOG_RETURN(strLen, "The path length of the specified tracked file is 0. This is an error.");
+#ifdef __linux__
+	// Let the kernel move the bytes, or share them on filesystems with reflinks.
+	while (remaining) {
+		off_t offIn = (off_t)offset;
+		ssize_t copied = copy_file_range(srcFd, &offIn, dstFd, NULL, remaining, 0);
+		if (copied <= 0) {
+			break;
+		}
+		offset += (uint64_t)copied;
+		remaining -= (uint64_t)copied;
+	}
 
-					char *str = (char *)calloc(strLen + 1, sizeof(char));
-					FIT_ASSERT_LOG_RETURN(str, "Out of memory. Unable to allocate string.");
-					strncpy(str, ffd.cFileName, strLen);
-					str[strLen] = '\0';
+	// copy_file_range can refuse across filesystems on older kernels, sendfile cannot.
+	while (remaining) {
+		off_t offIn = (off_t)offset;
+		ssize_t copied = sendfile(dstFd, srcFd, &offIn, remaining);
+		if (copied <= 0) {
+			break;
+		}
+		offset += (uint64_t)copied;
+		remaining -= (uint64_t)copied;
+	}
+#endif
+#endif
 
-					entry->path = str;
-					entry->pathLen = strLen;
+	if (remaining) {
+		const size_t chunkSize = 1 << 20;
+		char *chunk = (char *)malloc(chunkSize);
+		FIT_ASSERT_LOG_RETURN(chunk, "Out of memory. Unable to allocate copy buffer.");
 
-					FIT_AddToTrackingList(ctx, entry);
-				}
+		while (remaining) {
+			size_t len = remaining < chunkSize ? (size_t)remaining : chunkSize;
+			result = FIT_ReadStoreRange(ctx, offset, chunk, len) && fwrite(chunk, len, 1, file) == 1;
+			if (!result) {
+				break;
 			}
-		} while (FindNextFileA(hFind, &ffd) != 0);
+			offset += len;
+			remaining -= len;
+		}
 
-		FindClose(hFind);
+		free(chunk);
+		FIT_ASSERT_LOG_RETURN(result, "Unable to copy the contents of [%s] from the file store.", entry->path);
 	}
-#elif defined(__LINUX__)
-			// TODO:
-	FIT_ASSERT_LOG_RETURN(false, "Not implemented track all for linux.");
-#endif
 
+	return 1;
 }
 
-int FIT_CheckFileStoreExists(FIT_Context *ctx, const char *fileName) {
+int FIT_SetWorkingDirectoryFromFileStore(FIT_Context *ctx, const char *fileStoreStr) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(fileStoreStr);
 
-	// Check the file exists 
-	FILE *file = fopen(fileName, "rb");
-	if (file) {
-		fclose(file);
-		return 1;
+	int result = 0;
+
+	// Extract the full path of the file store
+	result = FIT_GetAbsolutePath(&ctx->fileStoreAbsolutePath, fileStoreStr);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to get the absolute path for the file store.");
+
+	result = FIT_GoUpDirectory(&ctx->fileStoreAbsolutePath, &ctx->workingDirectory);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to get the working directory for the file store.");
+
+#ifndef _WIN32
+	if (ctx->workingDirectoryFd != -1) {
+		close(ctx->workingDirectoryFd);
 	}
+	ctx->workingDirectoryFd = open(ctx->workingDirectory.buffer, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	FIT_ASSERT_LOG_RETURN(ctx->workingDirectoryFd != -1, "Unable to open the working directory [%s].", ctx->workingDirectory.buffer);
+#endif
 
-	return 0;
+	return 1;
 }
 
-int FIT_PrepareSnapshotForSave(FIT_Context *ctx) {
+int FIT_LoadFileStoreAndSetWorkingDirectory(FIT_Context *ctx, const char *fileStoreStr) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(fileStoreStr);
 
-	int result = 0;
-	int newChanges = 0;
+	int result = FIT_SetWorkingDirectoryFromFileStore(ctx, fileStoreStr);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to set the working directory for file store [%s]", fileStoreStr);
 
-	if (ctx->fsData.trackingCount == 0) {
-		FIT_LOG("There are no tracked files that can be saved.");
-		return 0;
+	result = FIT_LoadFileStoreFromFile(ctx, fileStoreStr);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to load file store [%s]", fileStoreStr);
+
+	return result;
+}
+
+uint32_t FIT_HashString(const char *str, size_t len) {
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (uint8_t)str[i];
+		hash *= 16777619u;
 	}
+	return hash;
+}
 
-	FIT_Snapshot *snapshot = FIT_AllocateSnapshot(ctx);
-	FIT_Snapshot *lastSnapshot = ctx->fsData.snapshotTail;
+// Matches [str] against a glob. '*' and '?' do not cross directories, "**" does.
+static int FIT_GlobMatch(const char *pattern, const char *patternEnd, const char *str, const char *strEnd) {
+	while (pattern < patternEnd) {
+		char c = *pattern;
 
-	// Update the tracking list with the latest info in the snapshot 
-	// list.
+		if (c == '*') {
+			int crossesDirectories = (pattern + 1 < patternEnd && pattern[1] == '*');
+			while (pattern < patternEnd && *pattern == '*') {
+				pattern++;
+			}
 
-	for (FIT_FileEntry *entry = ctx->fsData.entryTrackingHead;
-			entry != NULL;
-			entry = entry->trackNext) {
-
-		if (lastSnapshot) {
-			for (FIT_FileEntry *b = lastSnapshot->entryHead;
-					b != NULL;
-					b = b->snapNext) {
-
-				if (strncmp(entry->path, b->path, entry->pathLen) == 0) {
-					entry->inSnapshot = 1;
-					entry->offset = b->offset;
-					entry->offsetLen = b->offsetLen;
-					memcpy(entry->hash.buffer, b->hash.buffer, FIT_BASE64_DIGEST_SIZE);
-					break;
+			// "**/" can also match zero directories
+			if (crossesDirectories && pattern < patternEnd && *pattern == '/') {
+				if (FIT_GlobMatch(pattern + 1, patternEnd, str, strEnd)) {
+					return 1;
+				}
+			}
+
+			if (pattern == patternEnd) {
+				return crossesDirectories || memchr(str, '/', strEnd - str) == NULL;
+			}
+
+			for (const char *s = str; s <= strEnd; s++) {
+				if (FIT_GlobMatch(pattern, patternEnd, s, strEnd)) {
+					return 1;
+				}
+				if (s < strEnd && *s == '/' && !crossesDirectories) {
+					return 0;
 				}
 			}
+			return 0;
 		}
 
-		if (!entry->inSnapshot) {
-			FIT_LOG(" - A new file [*%s] has been added to the store.", entry->path);
-			newChanges++;
+		if (str == strEnd) {
+			return 0;
 		}
 
-		FIT_AddToSnapshotFileEntryList(snapshot, entry);
-	}
-	
-	
+		if (c == '?') {
+			if (*str == '/') return 0;
+		}
+		else if (c == '[') {
+			const char *p = pattern + 1;
+			int negate = 0;
+			if (p < patternEnd && (*p == '!' || *p == '^')) {
+				negate = 1;
+				p++;
+			}
 
-	for (FIT_FileEntry *entry = snapshot->entryHead; entry != NULL;) {
-		FIT_FileEntry *entryNext = entry->snapNext;
+			int matched = 0;
+			const char *classStart = p;
+			while (p < patternEnd && (*p != ']' || p == classStart)) {
+				char lo = *p;
+				char hi = *p;
+				if (p + 2 < patternEnd && p[1] == '-' && p[2] != ']') {
+					hi = p[2];
+					p += 2;
+				}
+				if (*str >= lo && *str <= hi) {
+					matched = 1;
+				}
+				p++;
+			}
 
-		result = FIT_AppendPath(&ctx->workingDirectory, entry->path, &ctx->trackedFileAbsolutePath);
-		FIT_ASSERT_LOG_RETURN(result, "Unable to append entry relative path to working directory path.");
+			if (p == patternEnd) {
+				// no closing bracket so it is just a character
+				if (*str != '[') return 0;
+			}
+			else {
+				if (matched == negate || *str == '/') return 0;
+				pattern = p;
+			}
+		}
+		else {
+			if (c == '\\' && pattern + 1 < patternEnd) {
+				pattern++;
+				c = *pattern;
+			}
+			if (c != *str) return 0;
+		}
 
-		FILE *file = fopen(ctx->trackedFileAbsolutePath.buffer, "rb");
-		if (!file) { // If we cannot open the file, then we assume the change is that this file has been deleted.
+		pattern++;
+		str++;
+	}
 
-			FIT_LOG(" - It appears that file [%s] has been renamed or deleted since the last snapshot.", entry->path);
-			newChanges++;
-			// remove entry from the current snapshot and track list
-			FIT_RemoveFromSnapshotFileEntryList(snapshot, entry);
-			FIT_RemoveFromTrackList(ctx, entry);
+	return str == strEnd;
+}
+
+static int32_t FIT_FindLiteralIgnoreRule(const FIT_IgnoreMatcher *matcher, const char *str, size_t len, uint32_t anchored) {
+	if (matcher->literalSlotCount == 0) {
+		return -1;
+	}
+
+	uint32_t mask = matcher->literalSlotCount - 1;
+	uint32_t slot = FIT_HashString(str, len) & mask;
+	while (matcher->literalSlots[slot] != -1) {
+		const FIT_IgnoreRule *rule = &matcher->rules[matcher->literalSlots[slot]];
+		if (rule->patternLen == len &&
+			(rule->flags & FIT_IGNORE_RULE_ANCHORED) == anchored &&
+			memcmp(rule->pattern, str, len) == 0) {
+			return matcher->literalSlots[slot];
 		}
-		else {
+		slot = (slot + 1) & mask;
+	}
+	return -1;
+}
 
-			result = FIT_AllocateFileContents(file, &entry->buffer, &entry->bufferLen);
-			FIT_ASSERT_LOG_RETURN(result, "TODO");
+int FIT_CompileIgnorePatterns(FIT_IgnoreMatcher *matcher, const char *text, size_t textLen) {
+	FIT_SHOULD_NOT_BE_NULL(matcher);
+	FIT_SHOULD_NOT_BE_NULL(text);
 
-			if (entry->inSnapshot) {
-				FIT_Base64Digest digest = {0};
-				result = FIT_HashBuffer(&digest, entry->buffer, entry->bufferLen);
-				FIT_ASSERT_LOG_RETURN(result, "TODO");
+	FIT_IgnoreMatcherDeinit(matcher);
 
-				// if the hash changes then we need to save the new buffer
-				if (strncmp(digest.buffer, entry->hash.buffer, FIT_MAX_PATH) != 0) {
+	uint32_t lineCount = 1;
+	for (size_t i = 0; i < textLen; i++) {
+		if (text[i] == '\n') lineCount++;
+	}
 
-					memcpy(entry->hash.buffer, digest.buffer, FIT_BASE64_DIGEST_SIZE);
+	matcher->rules = (FIT_IgnoreRule *)calloc(lineCount, sizeof(FIT_IgnoreRule));
+	FIT_ASSERT_LOG_RETURN(matcher->rules, "Out of memory. Unable to allocate ignore rules.");
 
-					entry->offset = ctx->fsData.bufferCount;
-					ctx->fsData.bufferCount += entry->bufferLen;
-					entry->offsetLen = entry->bufferLen;
+	matcher->globRules = (int32_t *)calloc(lineCount, sizeof(int32_t));
+	FIT_ASSERT_LOG_RETURN(matcher->globRules, "Out of memory. Unable to allocate ignore rules.");
 
-					char *newBuffer = realloc(ctx->fsData.buffer, ctx->fsData.bufferCount);
-					FIT_ASSERT_LOG_RETURN(newBuffer, "TODO");
-					ctx->fsData.buffer = newBuffer;
-					memcpy(&ctx->fsData.buffer[entry->offset], entry->buffer, entry->offsetLen);
+	uint32_t literalCount = 0;
 
-					FIT_LOG(" - A file [*%s] has changed since the last snapshot. It's new contents will be added to the store.", entry->path);
-					newChanges++;
+	for (size_t lineStart = 0; lineStart < textLen;) {
+		size_t lineEnd = lineStart;
+		while (lineEnd < textLen && text[lineEnd] != '\n') {
+			lineEnd++;
+		}
+
+		const char *start = &text[lineStart];
+		const char *end = &text[lineEnd];
+		lineStart = lineEnd + 1;
+
+		while (end > start && (end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\0')) {
+			end--;
+		}
+		if (start == end || *start == '#') {
+			continue;
+		}
+
+		uint32_t flags = 0;
+		if (*start == '!') {
+			flags |= FIT_IGNORE_RULE_NEGATE;
+			start++;
+		}
+		if (end > start && end[-1] == '/') {
+			flags |= FIT_IGNORE_RULE_DIRECTORY_ONLY;
+			end--;
+		}
+		if (end > start && *start == '/') {
+			flags |= FIT_IGNORE_RULE_ANCHORED;
+			start++;
+		}
+		if (start == end) {
+			continue;
+		}
+		if (memchr(start, '/', end - start)) {
+			flags |= FIT_IGNORE_RULE_ANCHORED;
+		}
+
+		uint32_t patternLen = (uint32_t)(end - start);
+		uint32_t literalPrefixLen = 0;
+		while (literalPrefixLen < patternLen && !strchr("*?[\\", start[literalPrefixLen])) {
+			literalPrefixLen++;
+		}
+		if (literalPrefixLen == patternLen) {
+			flags |= FIT_IGNORE_RULE_LITERAL;
+			literalCount++;
+		}
+		else {
+			matcher->globRules[matcher->globRuleCount++] = matcher->ruleCount;
+		}
+
+		FIT_IgnoreRule *rule = &matcher->rules[matcher->ruleCount++];
+		rule->pattern = (char *)calloc(patternLen + 1, sizeof(char));
+		FIT_ASSERT_LOG_RETURN(rule->pattern, "Out of memory. Unable to allocate ignore pattern.");
+		memcpy(rule->pattern, start, patternLen);
+		rule->patternLen = patternLen;
+		rule->literalPrefixLen = literalPrefixLen;
+		rule->flags = flags;
+		rule->literalNext = -1;
+	}
+
+	if (literalCount) {
+		matcher->literalSlotCount = 16;
+		while (matcher->literalSlotCount < literalCount * 2) {
+			matcher->literalSlotCount *= 2;
+		}
+
+		matcher->literalSlots = (int32_t *)malloc(matcher->literalSlotCount * sizeof(int32_t));
+		FIT_ASSERT_LOG_RETURN(matcher->literalSlots, "Out of memory. Unable to allocate ignore table.");
+		memset(matcher->literalSlots, 0xFF, matcher->literalSlotCount * sizeof(int32_t));
+
+		// Later rules take priority, so they replace earlier rules with the same text and chain to them.
+		uint32_t mask = matcher->literalSlotCount - 1;
+		for (uint32_t i = 0; i < matcher->ruleCount; i++) {
+			FIT_IgnoreRule *rule = &matcher->rules[i];
+			if (!(rule->flags & FIT_IGNORE_RULE_LITERAL)) {
+				continue;
+			}
+
+			uint32_t slot = FIT_HashString(rule->pattern, rule->patternLen) & mask;
+			while (matcher->literalSlots[slot] != -1) {
+				const FIT_IgnoreRule *other = &matcher->rules[matcher->literalSlots[slot]];
+				if (other->patternLen == rule->patternLen &&
+					(other->flags & FIT_IGNORE_RULE_ANCHORED) == (rule->flags & FIT_IGNORE_RULE_ANCHORED) &&
+					memcmp(other->pattern, rule->pattern, rule->patternLen) == 0) {
+					rule->literalNext = matcher->literalSlots[slot];
+					break;
 				}
+				slot = (slot + 1) & mask;
 			}
-			else {
-				result = FIT_HashBuffer(&entry->hash, entry->buffer, entry->bufferLen);
-				FIT_ASSERT_LOG_RETURN(result, "TODO");
+			matcher->literalSlots[slot] = (int32_t)i;
+		}
+	}
 
-				entry->offset = ctx->fsData.bufferCount;
-				ctx->fsData.bufferCount += entry->bufferLen;
-				entry->offsetLen = entry->bufferLen;
-				entry->inSnapshot = 1;
+	matcher->loaded = 1;
 
-				char *newBuffer = realloc(ctx->fsData.buffer, ctx->fsData.bufferCount);
-				FIT_ASSERT_LOG_RETURN(newBuffer, "TODO");
-				ctx->fsData.buffer = newBuffer;
-				memcpy(&ctx->fsData.buffer[entry->offset], entry->buffer, entry->offsetLen);
+	return 1;
+}
+
+int FIT_LoadIgnoreFile(FIT_IgnoreMatcher *matcher, FILE *file) {
+	FIT_SHOULD_NOT_BE_NULL(matcher);
+
+	if (!file) {
+		// No ignore file just means nothing is ignored.
+		FIT_IgnoreMatcherDeinit(matcher);
+		matcher->loaded = 1;
+		return 1;
+	}
+
+	char *buffer = NULL;
+	uint64_t bufferLen = 0;
+	int result = FIT_AllocateFileContents(file, &buffer, &bufferLen);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to read the ignore file.");
+
+	result = FIT_CompileIgnorePatterns(matcher, buffer, bufferLen);
+	free(buffer);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to compile the ignore file.");
+
+	return 1;
+}
+
+int FIT_IsPathIgnored(const FIT_IgnoreMatcher *matcher, const char *relPath, size_t relPathLen, int isDirectory) {
+	FIT_SHOULD_NOT_BE_NULL(matcher);
+	FIT_SHOULD_NOT_BE_NULL(relPath);
+
+	if (matcher->ruleCount == 0) {
+		return 0;
+	}
+
+	const char *baseName = relPath + relPathLen;
+	while (baseName > relPath && baseName[-1] != '/') {
+		baseName--;
+	}
+	size_t baseNameLen = (relPath + relPathLen) - baseName;
+
+	int32_t best = -1;
+	for (int anchored = 0; anchored < 2; anchored++) {
+		int32_t index = anchored ?
+			FIT_FindLiteralIgnoreRule(matcher, relPath, relPathLen, FIT_IGNORE_RULE_ANCHORED) :
+			FIT_FindLiteralIgnoreRule(matcher, baseName, baseNameLen, 0);
+
+		while (index != -1 && (matcher->rules[index].flags & FIT_IGNORE_RULE_DIRECTORY_ONLY) && !isDirectory) {
+			index = matcher->rules[index].literalNext;
+		}
+		if (index > best) {
+			best = index;
+		}
+	}
+
+	// Glob rules are in file order, so walk back from the last and stop once the literal match wins.
+	for (int32_t i = (int32_t)matcher->globRuleCount - 1; i >= 0 && matcher->globRules[i] > best; i--) {
+		const FIT_IgnoreRule *rule = &matcher->rules[matcher->globRules[i]];
+		if ((rule->flags & FIT_IGNORE_RULE_DIRECTORY_ONLY) && !isDirectory) {
+			continue;
+		}
+
+		const char *subject = (rule->flags & FIT_IGNORE_RULE_ANCHORED) ? relPath : baseName;
+		size_t subjectLen = (rule->flags & FIT_IGNORE_RULE_ANCHORED) ? relPathLen : baseNameLen;
+
+		if (rule->literalPrefixLen > subjectLen || memcmp(subject, rule->pattern, rule->literalPrefixLen) != 0) {
+			continue;
+		}
+		if (FIT_GlobMatch(rule->pattern, rule->pattern + rule->patternLen, subject, subject + subjectLen)) {
+			best = matcher->globRules[i];
+			break;
+		}
+	}
+
+	return best != -1 && !(matcher->rules[best].flags & FIT_IGNORE_RULE_NEGATE);
+}
+
+void FIT_IgnoreMatcherDeinit(FIT_IgnoreMatcher *matcher) {
+	FIT_SHOULD_NOT_BE_NULL(matcher);
+
+	for (uint32_t i = 0; i < matcher->ruleCount; i++) {
+		free(matcher->rules[i].pattern);
+	}
+	free(matcher->rules);
+	free(matcher->literalSlots);
+	free(matcher->globRules);
+	memset(matcher, 0, sizeof(FIT_IgnoreMatcher));
+}
+
+char *FIT_AllocateWorkingPath(FIT_Context *ctx, const char *relPath) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(relPath);
+
+	size_t dirLen = strnlen(ctx->workingDirectory.buffer, FIT_MAX_PATH);
+	size_t relLen = strnlen(relPath, FIT_MAX_ENTRY_PATH);
+	size_t prefixLen = 0;
+
+#ifdef _WIN32
+	// Paths past MAX_PATH need the \\?\ prefix, which turns off all normalisation.
+	static const char longPathPrefix[] = "\\\\?\\";
+	if (dirLen + relLen >= MAX_PATH) {
+		prefixLen = sizeof(longPathPrefix) - 1;
+	}
+#endif
+
+	char *path = (char *)malloc(prefixLen + dirLen + relLen + 1);
+	FIT_ASSERT_LOG_RETURN(path, "Out of memory. Unable to allocate path for [%s].", relPath);
+
+#ifdef _WIN32
+	memcpy(path, longPathPrefix, prefixLen);
+#endif
+	memcpy(&path[prefixLen], ctx->workingDirectory.buffer, dirLen);
+	memcpy(&path[prefixLen + dirLen], relPath, relLen);
+	path[prefixLen + dirLen + relLen] = '\0';
+
+#ifdef _WIN32
+	for (size_t i = prefixLen; path[i]; i++) {
+		if (path[i] == '/') path[i] = '\\';
+	}
+#endif
+
+	return path;
+}
+
+FILE *FIT_OpenWorkingFile(FIT_Context *ctx, const char *relPath, const char *mode) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(relPath);
+	FIT_SHOULD_NOT_BE_NULL(mode);
+
+#ifdef _WIN32
+	char *path = FIT_AllocateWorkingPath(ctx, relPath);
+	if (!path) {
+		return NULL;
+	}
+	FILE *file = fopen(path, mode);
+	free(path);
+	return file;
+#else
+	// Resolved relative to the working directory handle, so the kernel only walks [relPath].
+	int flags = (mode[0] == 'w') ? (O_WRONLY | O_CREAT | O_TRUNC) : O_RDONLY;
+	int fd = openat(ctx->workingDirectoryFd, relPath, flags | O_CLOEXEC, 0666);
+	if (fd == -1) {
+		return NULL;
+	}
+	FILE *file = fdopen(fd, mode);
+	if (!file) {
+		close(fd);
+	}
+	return file;
+#endif
+}
+
+typedef struct FIT_WorkingDirectoryWalk {
+	const char *fileStoreName;
+	FIT_WorkingFileProc proc;
+	void *user;
+	char *relPath; // FIT_MAX_ENTRY_PATH scratch buffer shared by the whole walk
+} FIT_WorkingDirectoryWalk;
+
+static int FIT_WalkDirectory(FIT_Context *ctx, FIT_WorkingDirectoryWalk *walk, int dirFd, size_t relDirLen);
+
+static int FIT_WalkDirectoryEntry(FIT_Context *ctx, FIT_WorkingDirectoryWalk *walk, int dirFd, size_t relDirLen, const char *name, int isDirectory) {
+	char *relPath = walk->relPath;
+
+	if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+		return 1;
+	}
+
+	size_t storeNameLen = strlen(walk->fileStoreName);
+	if (!isDirectory && relDirLen == 0 && strncmp(name, walk->fileStoreName, storeNameLen) == 0 &&
+		(name[storeNameLen] == '\0' || strcmp(&name[storeNameLen], FIT_STORE_TEMP_SUFFIX) == 0 ||
+		 strcmp(&name[storeNameLen], FIT_STORE_LOCK_SUFFIX) == 0)) {
+		/* skip over the current file store, its lock and a save of it that did not finish */
+		return 1;
+	}
+
+	size_t nameLen = strlen(name);
+	FIT_ASSERT_LOG_RETURN(relDirLen + nameLen + 2 < FIT_MAX_ENTRY_PATH, "Path size exceeded when attempting to track [%s] in [%.*s]", name, (int)relDirLen, relPath);
+
+	memcpy(&relPath[relDirLen], name, nameLen);
+	size_t relPathLen = relDirLen + nameLen;
+	relPath[relPathLen] = '\0';
+
+	if (FIT_IsPathIgnored(&ctx->ignore, relPath, relPathLen, isDirectory)) {
+		return 1;
+	}
+
+	if (isDirectory) {
+		// ignored directories never get here so their contents are never visited
+		relPath[relPathLen++] = '/';
+		relPath[relPathLen] = '\0';
+#ifdef _WIN32
+		return FIT_WalkDirectory(ctx, walk, -1, relPathLen);
+#else
+		int subDirFd = openat(dirFd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		FIT_ASSERT_LOG_RETURN(subDirFd != -1, "Unable to open directory [%s].", relPath);
+		return FIT_WalkDirectory(ctx, walk, subDirFd, relPathLen);
+#endif
+	}
+
+	return walk->proc(ctx, relPath, relPathLen, walk->user);
+}
+
+// Visits every file in the directory whose relative path is the first [relDirLen]
+// chars of walk->relPath (empty or ending with a '/'). On POSIX [dirFd] is owned by this call.
+static int FIT_WalkDirectory(FIT_Context *ctx, FIT_WorkingDirectoryWalk *walk, int dirFd, size_t relDirLen) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(walk);
+
+	char *relPath = walk->relPath;
+	int result = 0;
+
+#ifdef _WIN32
+	{
+		WIN32_FIND_DATAA ffd;
+		HANDLE hFind = INVALID_HANDLE_VALUE;
+
+		// the find first file has to end with a wild card because windows is insane
+		relPath[relDirLen] = '*';
+		relPath[relDirLen + 1] = '\0';
+		char *wildcardPath = FIT_AllocateWorkingPath(ctx, relPath);
+		relPath[relDirLen] = '\0';
+		FIT_ASSERT_LOG_RETURN(wildcardPath, "Unable to build the path of directory [%s].", relPath);
+
+		hFind = FindFirstFileA(wildcardPath, &ffd);
+		free(wildcardPath);
+		FIT_ASSERT_LOG_RETURN(hFind != INVALID_HANDLE_VALUE, "Unable to find first file in directory [%s] [%d].", relPath, GetLastError());
+
+		do
+		{
+			int isDirectory = (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+			result = FIT_WalkDirectoryEntry(ctx, walk, dirFd, relDirLen, ffd.cFileName, isDirectory);
+			if (!result) {
+				FindClose(hFind);
+				return 0;
 			}
+		} while (FindNextFileA(hFind, &ffd) != 0);
+
+		FindClose(hFind);
+	}
+#else
+	{
+		DIR *dir = fdopendir(dirFd);
+		if (!dir) {
+			close(dirFd);
+			FIT_ASSERT_LOG_RETURN(0, "Unable to read directory [%.*s].", (int)relDirLen, relPath);
 		}
 
-		entry = entryNext;
+		struct dirent *dirEntry = NULL;
+		while ((dirEntry = readdir(dir)) != NULL) {
+
+			int isDirectory = 0;
+			if (dirEntry->d_type == DT_DIR) {
+				isDirectory = 1;
+			}
+			else if (dirEntry->d_type != DT_REG) {
+				// Symlinks to directories are not followed so there can be no cycles.
+				struct stat st;
+				if (fstatat(dirfd(dir), dirEntry->d_name, &st, dirEntry->d_type == DT_UNKNOWN ? AT_SYMLINK_NOFOLLOW : 0) != 0) {
+					continue;
+				}
+				if (S_ISDIR(st.st_mode) && dirEntry->d_type == DT_UNKNOWN) {
+					isDirectory = 1;
+				}
+				else if (!S_ISREG(st.st_mode)) {
+					continue;
+				}
+			}
+
+			result = FIT_WalkDirectoryEntry(ctx, walk, dirfd(dir), relDirLen, dirEntry->d_name, isDirectory);
+			if (!result) {
+				closedir(dir);
+				return 0;
+			}
+		}
+
+		closedir(dir);
 	}
+#endif
 
-	FIT_AddToSnapshotList(ctx, snapshot);
+	return 1;
+}
+
+const char *FIT_GetFileName(const char *path, size_t pathLen) {
+	const char *name = path + pathLen;
+	while (name > path && name[-1] != '/' && name[-1] != '\\') {
+		name--;
+	}
+	return name;
+}
+
+int FIT_WalkWorkingDirectory(FIT_Context *ctx, const char *fileStoreStr, size_t fileStoreStrLen, FIT_WorkingFileProc proc, void *user) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(fileStoreStr);
+	FIT_SHOULD_NOT_BE_NULL(proc);
+
+	int result = 0;
+
+	if (!ctx->ignore.loaded) {
+		FILE *ignoreFile = FIT_OpenWorkingFile(ctx, FIT_IGNORE_FILE_NAME, "rb");
+		result = FIT_LoadIgnoreFile(&ctx->ignore, ignoreFile);
+		if (ignoreFile) {
+			fclose(ignoreFile);
+		}
+		FIT_ASSERT_LOG_RETURN(result, "Unable to load the ignore file [%s].", FIT_IGNORE_FILE_NAME);
+	}
+
+	FIT_WorkingDirectoryWalk walk = {0};
+	walk.proc = proc;
+	walk.user = user;
+
+	// The working directory is the directory of the store, so only its name is needed to skip it.
+	walk.fileStoreName = FIT_GetFileName(fileStoreStr, fileStoreStrLen);
+
+	walk.relPath = (char *)calloc(FIT_MAX_ENTRY_PATH, sizeof(char));
+	FIT_ASSERT_LOG_RETURN(walk.relPath, "Out of memory. Unable to allocate path.");
+
+#ifdef _WIN32
+	result = FIT_WalkDirectory(ctx, &walk, -1, 0);
+#else
+	int dirFd = openat(ctx->workingDirectoryFd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	result = dirFd != -1 && FIT_WalkDirectory(ctx, &walk, dirFd, 0);
+#endif
+	free(walk.relPath);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to walk the files in the working directory [%s].", ctx->workingDirectory.buffer);
 
 	return 1;
 }
 
-int FIT_Run(FIT_Context *ctx, int argc, char *argv[]) {
+static int FIT_TrackWorkingFile(FIT_Context *ctx, const char *relPath, size_t relPathLen, void *user) {
+	(void)user;
+	if (FIT_IsPathInTrackingList(ctx, relPath)) {
+		return 1;
+	}
+
+	FIT_FileEntry *entry = FIT_AllocateFileEntry(ctx);
+	FIT_ASSERT_LOG_RETURN(entry, "Unable to allocate file entry");
+
+	char *str = (char *)calloc(relPathLen + 1, sizeof(char));
+	FIT_ASSERT_LOG_RETURN(str, "Out of memory. Unable to allocate string.");
+	memcpy(str, relPath, relPathLen);
+	str[relPathLen] = '\0';
+
+	entry->path = str;
+	entry->pathLen = (uint32_t)relPathLen;
+
+	FIT_AddToTrackingList(ctx, entry);
+	return 1;
+}
+
+int FIT_TrackAll(FIT_Context *ctx, const char *fileStoreStr, size_t fileStoreStrLen) {
 	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(fileStoreStr);
 
-	FIT_Sha1Test();
+	// Go through the working directory and everything below it and track all of those files.
+	uint64_t statsStart = FIT_StatsBegin();
+	int result = FIT_WalkWorkingDirectory(ctx, fileStoreStr, fileStoreStrLen, FIT_TrackWorkingFile, NULL);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to track the files in the working directory [%s].", ctx->workingDirectory.buffer);
+	FIT_StatsEnd(FIT_PHASE_TRACK_ALL, statsStart);
+
+	return 1;
+}
+
+int FIT_CheckFileStoreExists(FIT_Context *ctx, const char *fileName) {
+
+	// Check the file exists 
+	FILE *file = fopen(fileName, "rb");
+	if (file) {
+		fclose(file);
+		return 1;
+	}
+
+	return 0;
+}
+
+#if FIT_IO_URING
+
+struct FIT_IoRing {
+	int fd;
+	uint32_t sqEntryCount;
+	uint32_t *sqHead;
+	uint32_t *sqTail;
+	uint32_t *sqMask;
+	uint32_t *sqArray;
+	uint32_t *cqHead;
+	uint32_t *cqTail;
+	uint32_t *cqMask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sqRing;
+	size_t sqRingSize;
+	void *cqRing;
+	size_t cqRingSize;
+	size_t sqesSize;
+	uint32_t queued;
+};
+
+typedef struct FIT_PrefetchSlot {
+	FIT_FileEntry *entry;
+	struct statx stx;
+	int fd;
+	int statResult;
+	uint64_t size;
+	uint64_t done;
+	char *buffer;
+} FIT_PrefetchSlot;
+
+static FIT_IoRing *FIT_IoRingCreate(uint32_t entryCount) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	int fd = (int)syscall(__NR_io_uring_setup, entryCount, &params);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	FIT_IoRing *ring = (FIT_IoRing *)calloc(1, sizeof(FIT_IoRing));
+	if (!ring) {
+		close(fd);
+		return NULL;
+	}
+	ring->fd = fd;
+	ring->sqEntryCount = params.sq_entries;
+
+	ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cqRingSize > ring->sqRingSize) ring->sqRingSize = ring->cqRingSize;
+		ring->cqRingSize = ring->sqRingSize;
+	}
+
+	ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (ring->sqRing == MAP_FAILED) {
+		close(fd);
+		free(ring);
+		return NULL;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cqRing = ring->sqRing;
+	}
+	else {
+		ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (ring->cqRing == MAP_FAILED) {
+			munmap(ring->sqRing, ring->sqRingSize);
+			close(fd);
+			free(ring);
+			return NULL;
+		}
+	}
+
+	ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		if (ring->cqRing != ring->sqRing) munmap(ring->cqRing, ring->cqRingSize);
+		munmap(ring->sqRing, ring->sqRingSize);
+		close(fd);
+		free(ring);
+		return NULL;
+	}
+
+	char *sq = (char *)ring->sqRing;
+	char *cq = (char *)ring->cqRing;
+	ring->sqHead = (uint32_t *)(sq + params.sq_off.head);
+	ring->sqTail = (uint32_t *)(sq + params.sq_off.tail);
+	ring->sqMask = (uint32_t *)(sq + params.sq_off.ring_mask);
+	ring->sqArray = (uint32_t *)(sq + params.sq_off.array);
+	ring->cqHead = (uint32_t *)(cq + params.cq_off.head);
+	ring->cqTail = (uint32_t *)(cq + params.cq_off.tail);
+	ring->cqMask = (uint32_t *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+	return ring;
+}
+
+// How many more submissions can be queued before the ring is full.
+static uint32_t FIT_IoRingFreeCount(FIT_IoRing *ring) {
+	uint32_t tail = *ring->sqTail + ring->queued;
+	uint32_t head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+	return ring->sqEntryCount - (tail - head);
+}
+
+static struct io_uring_sqe *FIT_IoRingQueue(FIT_IoRing *ring, uint8_t opcode, uint64_t userData) {
+	if (FIT_IoRingFreeCount(ring) == 0) {
+		return NULL;
+	}
+
+	uint32_t tail = *ring->sqTail + ring->queued;
+	uint32_t index = tail & *ring->sqMask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->user_data = userData;
+	ring->sqArray[index] = index;
+	ring->queued++;
+	return sqe;
+}
+
+// Submits everything queued and hands each completion to [onComplete] until all are in.
+static int FIT_IoRingSubmitAndReap(FIT_IoRing *ring, FIT_PrefetchSlot *slots, void (*onComplete)(FIT_PrefetchSlot *slots, uint64_t userData, int32_t res)) {
+	uint32_t submitCount = ring->queued;
+	uint32_t remaining = ring->queued;
+
+	__atomic_store_n(ring->sqTail, *ring->sqTail + ring->queued, __ATOMIC_RELEASE);
+	ring->queued = 0;
+
+	while (remaining) {
+		int ret = (int)syscall(__NR_io_uring_enter, ring->fd, submitCount, remaining, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			return 0;
+		}
+		submitCount -= (uint32_t)ret < submitCount ? (uint32_t)ret : submitCount;
+
+		uint32_t head = *ring->cqHead;
+		uint32_t tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+		for (; head != tail && remaining; head++, remaining--) {
+			struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cqMask];
+			onComplete(slots, cqe->user_data, cqe->res);
+		}
+		__atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+	}
+
+	return 1;
+}
+
+#define FIT_PREFETCH_OPEN 0
+#define FIT_PREFETCH_STAT 1
+#define FIT_PREFETCH_READ 2
+
+static void FIT_PrefetchComplete(FIT_PrefetchSlot *slots, uint64_t userData, int32_t res) {
+	FIT_PrefetchSlot *slot = &slots[userData >> 2];
+	switch (userData & 3) {
+	case FIT_PREFETCH_OPEN: slot->fd = res; break;
+	case FIT_PREFETCH_STAT: slot->statResult = res; break;
+	case FIT_PREFETCH_READ:
+		if (res > 0) {
+			slot->done += (uint64_t)res;
+		}
+		else {
+			// the file shrank or the read failed, let the stdio path deal with it
+			close(slot->fd);
+			slot->fd = -1;
+		}
+		break;
+	}
+}
+
+#endif
+
+void FIT_IoRingDestroy(FIT_IoRing *ring) {
+	if (!ring) {
+		return;
+	}
+#if FIT_IO_URING
+	munmap(ring->sqes, ring->sqesSize);
+	if (ring->cqRing != ring->sqRing) {
+		munmap(ring->cqRing, ring->cqRingSize);
+	}
+	munmap(ring->sqRing, ring->sqRingSize);
+	close(ring->fd);
+	free(ring);
+#endif
+}
+
+FIT_FileEntry *FIT_PrefetchFileContents(FIT_Context *ctx, FIT_FileEntry *head, uint32_t maxCount) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+
+	FIT_FileEntry *end = head;
+	for (uint32_t i = 0; i < maxCount && end; i++) {
+		end = end->snapNext;
+	}
+
+#if FIT_IO_URING
+	if (!ctx->ioRing && !ctx->ioRingUnavailable) {
+		// two submissions per file for the open and statx of a whole batch
+		ctx->ioRing = FIT_IoRingCreate(2 * FIT_PREFETCH_BATCH_SIZE);
+		ctx->ioRingUnavailable = ctx->ioRing == NULL;
+	}
+	if (!ctx->ioRing) {
+		return end;
+	}
+
+	FIT_IoRing *ring = ctx->ioRing;
+	uint64_t statsStart = FIT_StatsBegin();
+	FIT_PrefetchSlot slots[FIT_PREFETCH_BATCH_SIZE];
+	uint32_t slotCount = 0;
+
+	for (FIT_FileEntry *entry = head; entry != end && slotCount < FIT_PREFETCH_BATCH_SIZE; entry = entry->snapNext) {
+		if (entry->buffer) {
+			continue;
+		}
+		// The open and statx go in together, an open queued on its own would leave its fd to no slot.
+		if (FIT_IoRingFreeCount(ring) < 2) {
+			break;
+		}
+
+		FIT_PrefetchSlot *slot = &slots[slotCount];
+		memset(slot, 0, sizeof(FIT_PrefetchSlot));
+		slot->entry = entry;
+		slot->fd = -1;
+		slot->statResult = -1;
+
+		struct io_uring_sqe *open = FIT_IoRingQueue(ring, IORING_OP_OPENAT, ((uint64_t)slotCount << 2) | FIT_PREFETCH_OPEN);
+		struct io_uring_sqe *stat = FIT_IoRingQueue(ring, IORING_OP_STATX, ((uint64_t)slotCount << 2) | FIT_PREFETCH_STAT);
+
+		open->fd = ctx->workingDirectoryFd;
+		open->addr = (uint64_t)(uintptr_t)entry->path;
+		open->open_flags = O_RDONLY | O_CLOEXEC;
+
+		stat->fd = ctx->workingDirectoryFd;
+		stat->addr = (uint64_t)(uintptr_t)entry->path;
+		stat->len = STATX_SIZE;
+		stat->off = (uint64_t)(uintptr_t)&slot->stx;
+
+		slotCount++;
+	}
+
+	if (!slotCount || !FIT_IoRingSubmitAndReap(ring, slots, FIT_PrefetchComplete)) {
+		return end;
+	}
+
+	// Allocate the same way FIT_AllocateFileContents does, so both paths hash identically.
+	for (uint32_t i = 0; i < slotCount; i++) {
+		FIT_PrefetchSlot *slot = &slots[i];
+		if (slot->fd < 0) {
+			continue;
+		}
+		if (slot->statResult < 0) {
+			close(slot->fd);
+			slot->fd = -1;
+			continue;
+		}
+		slot->size = slot->stx.stx_size;
+		slot->buffer = (char *)calloc(slot->size ? slot->size : 1, sizeof(char));
+		if (!slot->buffer) {
+			close(slot->fd);
+			slot->fd = -1;
+		}
+	}
+
+	// Keep reading until every file is complete, short reads just go around again.
+	for (;;) {
+		for (uint32_t i = 0; i < slotCount; i++) {
+			FIT_PrefetchSlot *slot = &slots[i];
+			if (slot->fd < 0 || slot->done >= slot->size) {
+				continue;
+			}
+			uint64_t len = slot->size - slot->done;
+			if (len > (1u << 30)) len = 1u << 30;
+
+			struct io_uring_sqe *read = FIT_IoRingQueue(ring, IORING_OP_READ, ((uint64_t)i << 2) | FIT_PREFETCH_READ);
+			if (!read) {
+				break;
+			}
+			read->fd = slot->fd;
+			read->addr = (uint64_t)(uintptr_t)&slot->buffer[slot->done];
+			read->len = (uint32_t)len;
+			read->off = slot->done;
+		}
+		if (!ring->queued) {
+			break;
+		}
+		if (!FIT_IoRingSubmitAndReap(ring, slots, FIT_PrefetchComplete)) {
+			break;
+		}
+	}
+
+	for (uint32_t i = 0; i < slotCount; i++) {
+		FIT_PrefetchSlot *slot = &slots[i];
+		if (slot->fd >= 0 && slot->done == slot->size) {
+			slot->entry->buffer = slot->buffer;
+			slot->entry->bufferLen = slot->size ? slot->size : 1;
+			FIT_StatsCount(&FIT_stats.bytesRead, slot->size);
+		}
+		else {
+			free(slot->buffer);
+		}
+		if (slot->fd >= 0) {
+			close(slot->fd);
+		}
+	}
+	FIT_StatsEnd(FIT_PHASE_READ_FILES, statsStart);
+#endif
+
+	return end;
+}
+
+int FIT_PathTableInit(FIT_PathTable *table, uint32_t expectedCount) {
+	FIT_SHOULD_NOT_BE_NULL(table);
+
+	memset(table, 0, sizeof(FIT_PathTable));
+	table->slotCount = 16;
+	while (table->slotCount < expectedCount * 2) {
+		table->slotCount *= 2;
+	}
+	table->slots = (FIT_FileEntry **)calloc(table->slotCount, sizeof(FIT_FileEntry *));
+	FIT_ASSERT_LOG_RETURN(table->slots, "Out of memory. Unable to allocate path table.");
+	return 1;
+}
+
+static int FIT_PathTableGrow(FIT_PathTable *table) {
+	FIT_PathTable bigger = {0};
+	bigger.slotCount = table->slotCount * 2;
+	bigger.slots = (FIT_FileEntry **)calloc(bigger.slotCount, sizeof(FIT_FileEntry *));
+	FIT_ASSERT_LOG_RETURN(bigger.slots, "Out of memory. Unable to grow path table.");
+
+	for (uint32_t i = 0; i < table->slotCount; i++) {
+		if (table->slots[i]) {
+			FIT_PathTableInsert(&bigger, table->slots[i]);
+		}
+	}
+	free(table->slots);
+	*table = bigger;
+	return 1;
+}
+
+int FIT_PathTableInsert(FIT_PathTable *table, FIT_FileEntry *entry) {
+	FIT_SHOULD_NOT_BE_NULL(table);
+	FIT_SHOULD_NOT_BE_NULL(entry);
+
+	if ((table->count + 1) * 2 > table->slotCount) {
+		int result = FIT_PathTableGrow(table);
+		FIT_ASSERT_LOG_RETURN(result, "Unable to insert [%s] into path table.", entry->path);
+	}
+
+	uint32_t mask = table->slotCount - 1;
+	uint32_t slot = FIT_HashString(entry->path, entry->pathLen) & mask;
+	while (table->slots[slot]) {
+		FIT_FileEntry *other = table->slots[slot];
+		if (other->pathLen == entry->pathLen && memcmp(other->path, entry->path, entry->pathLen) == 0) {
+			// the first entry inserted for a path wins
+			return 1;
+		}
+		slot = (slot + 1) & mask;
+	}
+	table->slots[slot] = entry;
+	table->count++;
+	return 1;
+}
+
+FIT_FileEntry *FIT_PathTableFind(const FIT_PathTable *table, const char *path, size_t pathLen) {
+	FIT_SHOULD_NOT_BE_NULL(table);
+	FIT_SHOULD_NOT_BE_NULL(path);
+
+	if (!table->slotCount) {
+		return NULL;
+	}
+
+	uint32_t mask = table->slotCount - 1;
+	uint32_t slot = FIT_HashString(path, pathLen) & mask;
+	while (table->slots[slot]) {
+		FIT_FileEntry *entry = table->slots[slot];
+		if (entry->pathLen == pathLen && memcmp(entry->path, path, pathLen) == 0) {
+			return entry;
+		}
+		slot = (slot + 1) & mask;
+	}
+	return NULL;
+}
+
+void FIT_PathTableDeinit(FIT_PathTable *table) {
+	FIT_SHOULD_NOT_BE_NULL(table);
+	free(table->slots);
+	memset(table, 0, sizeof(FIT_PathTable));
+}
+
+int FIT_GetWorkingFileStat(FIT_Context *ctx, const char *relPath, uint64_t *size, uint64_t *modifiedTime) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(relPath);
+	FIT_SHOULD_NOT_BE_NULL(size);
+
+#ifdef _WIN32
+	char *path = FIT_AllocateWorkingPath(ctx, relPath);
+	if (!path) {
+		return 0;
+	}
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	BOOL found = GetFileAttributesExA(path, GetFileExInfoStandard, &data);
+	free(path);
+	if (!found || (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+		return 0;
+	}
+	*size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+	if (modifiedTime) {
+		*modifiedTime = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+	}
+#else
+	struct stat st;
+	if (fstatat(ctx->workingDirectoryFd, relPath, &st, 0) != 0 || !S_ISREG(st.st_mode)) {
+		return 0;
+	}
+	*size = (uint64_t)st.st_size;
+	if (modifiedTime) {
+#ifdef __APPLE__
+		*modifiedTime = (uint64_t)st.st_mtimespec.tv_sec * 1000000000ull + (uint64_t)st.st_mtimespec.tv_nsec;
+#else
+		*modifiedTime = (uint64_t)st.st_mtim.tv_sec * 1000000000ull + (uint64_t)st.st_mtim.tv_nsec;
+#endif
+	}
+#endif
+	return 1;
+}
+
+int FIT_MakeParentDirectories(FIT_Context *ctx, const char *relPath) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(relPath);
+
+	size_t len = strnlen(relPath, FIT_MAX_ENTRY_PATH);
+	char *dir = (char *)calloc(len + 1, sizeof(char));
+	FIT_ASSERT_LOG_RETURN(dir, "Out of memory. Unable to allocate path.");
+	memcpy(dir, relPath, len);
+
+	// Create each directory on the way down, ones that already exist are fine.
+	for (size_t i = 0; i < len; i++) {
+		if (dir[i] != '/') {
+			continue;
+		}
+		dir[i] = '\0';
+#ifdef _WIN32
+		char *path = FIT_AllocateWorkingPath(ctx, dir);
+		if (path) {
+			CreateDirectoryA(path, NULL);
+			free(path);
+		}
+#else
+		mkdirat(ctx->workingDirectoryFd, dir, 0777);
+#endif
+		dir[i] = '/';
+	}
+
+	free(dir);
+	return 1;
+}
+
+FIT_RestoreAction FIT_CompareWorkingFile(FIT_Context *ctx, FIT_FileEntry *entry) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(entry);
+
+	uint64_t size = 0;
+	if (!FIT_GetWorkingFileStat(ctx, entry->path, &size, NULL)) {
+		return FIT_RESTORE_CREATE;
+	}
+
+	// Empty files are stored as a single byte, see FIT_AllocateFileContents.
+	if ((size ? size : 1) != entry->offsetLen) {
+		return FIT_RESTORE_OVERWRITE;
+	}
+
+	// Same size, so only the contents can tell.
+	FIT_Base64Digest digest = {0};
+	if (!FIT_HashWorkingFile(ctx, entry->path, &digest, &size)) {
+		return FIT_RESTORE_OVERWRITE;
+	}
+
+	return strncmp(digest.buffer, entry->hash.buffer, FIT_BASE64_DIGEST_SIZE) == 0 ? FIT_RESTORE_UNCHANGED : FIT_RESTORE_OVERWRITE;
+}
+
+int FIT_PlanRestore(FIT_Context *ctx, FIT_Snapshot *snapshot, FIT_RestorePlan *plan) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(snapshot);
+	FIT_SHOULD_NOT_BE_NULL(plan);
+
+	memset(plan, 0, sizeof(FIT_RestorePlan));
+
+	FIT_PathTable snapshotPaths = {0};
+	int result = FIT_PathTableInit(&snapshotPaths, snapshot->entryCount);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to index the snapshot.");
+
+	for (FIT_FileEntry *entry = snapshot->entryHead;
+		 entry != NULL;
+		 entry = entry->snapNext) {
+
+		entry->restoreAction = FIT_CompareWorkingFile(ctx, entry);
+		switch (entry->restoreAction) {
+		case FIT_RESTORE_CREATE: plan->createCount++; break;
+		case FIT_RESTORE_OVERWRITE: plan->overwriteCount++; break;
+		default: plan->unchangedCount++; break;
+		}
+
+		result = FIT_PathTableInsert(&snapshotPaths, entry);
+		if (!result) {
+			FIT_PathTableDeinit(&snapshotPaths);
+			return 0;
+		}
+	}
+
+	// Tracked files the snapshot does not know about are reported but never deleted.
+	for (FIT_FileEntry *entry = ctx->fsData.entryTrackingHead;
+		 entry != NULL;
+		 entry = entry->trackNext) {
+
+		uint64_t size = 0;
+		entry->restoreAction = FIT_RESTORE_UNCHANGED;
+		if (!FIT_PathTableFind(&snapshotPaths, entry->path, entry->pathLen) &&
+			FIT_GetWorkingFileStat(ctx, entry->path, &size, NULL)) {
+			entry->restoreAction = FIT_RESTORE_NOT_IN_SNAPSHOT;
+			plan->notInSnapshotCount++;
+		}
+	}
+
+	FIT_PathTableDeinit(&snapshotPaths);
+	return 1;
+}
+
+typedef struct FIT_RestoreJob {
+	FIT_Context *ctx;
+	FIT_FileEntry **entries;
+	uint64_t entryCount;
+	volatile uint64_t next;
+	volatile uint64_t failedCount;
+} FIT_RestoreJob;
+
+static int FIT_RestoreFile(FIT_Context *ctx, FIT_FileEntry *entry) {
+	uint64_t traceStart = FIT_TraceBegin();
+	FILE *file = FIT_OpenWorkingFile(ctx, entry->path, "wb");
+	if (!file && entry->restoreAction == FIT_RESTORE_CREATE) {
+		FIT_MakeParentDirectories(ctx, entry->path);
+		file = FIT_OpenWorkingFile(ctx, entry->path, "wb");
+	}
+	FIT_ASSERT_LOG_RETURN(file, "Unable to open file %s%s", ctx->workingDirectory.buffer, entry->path);
+
+#ifdef __linux__
+	// Reserve the space up front so the file is laid out in one go. Not every filesystem can.
+	fallocate(fileno(file), 0, 0, (off_t)entry->offsetLen);
+#endif
+
+	int result = FIT_CopyBlobToFile(ctx, entry, file);
+	result = (fclose(file) == 0) && result;
+	FIT_ASSERT_LOG_RETURN(result, "Unable to write file %s%s", ctx->workingDirectory.buffer, entry->path);
+	FIT_StatsCount(&FIT_stats.bytesWritten, entry->offsetLen);
+	FIT_TraceEnd("restore file", traceStart, entry->path);
+
+	return 1;
+}
+
+static void FIT_RestoreWorker(void *arg) {
+	FIT_RestoreJob *job = (FIT_RestoreJob *)arg;
+
+	for (;;) {
+		uint64_t index = FIT_AtomicAdd(&job->next, 1);
+		if (index >= job->entryCount) {
+			break;
+		}
+
+		if (FIT_IsOperationCancelled(job->ctx)) {
+			break;
+		}
+
+		FIT_FileEntry *entry = job->entries[index];
+		FIT_OperationFileStarted(job->ctx, entry->path);
+		if (FIT_RestoreFile(job->ctx, entry)) {
+			entry->restoreAction = FIT_RESTORE_UNCHANGED;
+			FIT_OperationFileDone(job->ctx, entry->offsetLen);
+		}
+		else {
+			FIT_AtomicAdd(&job->failedCount, 1);
+		}
+	}
+}
+
+int FIT_RestoreSnapshot(FIT_Context *ctx, FIT_Snapshot *snapshot) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(snapshot);
+
+	FIT_RestoreJob job = {0};
+	job.ctx = ctx;
+	job.entries = (FIT_FileEntry **)calloc(snapshot->entryCount ? snapshot->entryCount : 1, sizeof(FIT_FileEntry *));
+	FIT_ASSERT_LOG_RETURN(job.entries, "Out of memory. Unable to allocate the restore list.");
+
+	for (FIT_FileEntry *entry = snapshot->entryHead;
+		 entry != NULL;
+		 entry = entry->snapNext) {
+		if (entry->restoreAction != FIT_RESTORE_UNCHANGED) {
+			job.entries[job.entryCount++] = entry;
+			if (ctx->operation) {
+				ctx->operation->bytesTotal += entry->offsetLen;
+			}
+		}
+	}
+	if (ctx->operation) {
+		ctx->operation->filesTotal = job.entryCount;
+	}
+
+	// Writing lots of small files is bound by the latency of each one, so use more
+	// threads than there are cores.
+	uint32_t threadCount = ctx->threadCount ? ctx->threadCount : FIT_GetCpuCount() * 2;
+	if (threadCount > FIT_MAX_RESTORE_THREADS) threadCount = FIT_MAX_RESTORE_THREADS;
+	if (threadCount > job.entryCount) threadCount = (uint32_t)job.entryCount;
+
+	int result = FIT_RunOnThreads(threadCount, FIT_RestoreWorker, &job);
+	free(job.entries);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to start restoring files.");
+	FIT_ASSERT_LOG_RETURN(!FIT_IsOperationCancelled(ctx), "The load was cancelled, the files written so far are complete.");
+
+	FIT_ASSERT_LOG_RETURN(job.failedCount == 0, "%llu files could not be written, the rest were loaded.", (unsigned long long)job.failedCount);
+
+	return 1;
+}
+
+FIT_Snapshot *FIT_GetSnapshotByIndex(FIT_Context *ctx, long int index) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+
+	long int curIndex = 0;
+	for (FIT_Snapshot *snap = ctx->fsData.snapshotHead;
+		 snap != NULL;
+		 snap = snap->next) {
+		if (curIndex++ == index) {
+			return snap;
+		}
+	}
+	return NULL;
+}
+
+int FIT_PathMatchesPrefix(const char *path, size_t pathLen, const char *pathOrPrefix, size_t prefixLen) {
+	if (prefixLen > pathLen || memcmp(path, pathOrPrefix, prefixLen) != 0) {
+		return 0;
+	}
+	// Either the exact file, or a whole directory.
+	return prefixLen == pathLen || pathOrPrefix[prefixLen - 1] == '/' || path[prefixLen] == '/';
+}
+
+static FILE *FIT_OpenExtractFile(FIT_Context *ctx, const char *destDir, const char *relPath) {
+	if (!destDir) {
+		FILE *file = FIT_OpenWorkingFile(ctx, relPath, "wb");
+		if (!file) {
+			FIT_MakeParentDirectories(ctx, relPath);
+			file = FIT_OpenWorkingFile(ctx, relPath, "wb");
+		}
+		return file;
+	}
+
+	size_t destLen = strlen(destDir);
+	size_t relLen = strlen(relPath);
+	char *path = (char *)malloc(destLen + relLen + 2);
+	FIT_ASSERT_LOG_RETURN(path, "Out of memory. Unable to allocate path.");
+	memcpy(path, destDir, destLen);
+	path[destLen] = '/';
+	memcpy(&path[destLen + 1], relPath, relLen + 1);
+
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		for (size_t i = 1; path[i]; i++) {
+			if (path[i] != '/') {
+				continue;
+			}
+			path[i] = '\0';
+#ifdef _WIN32
+			CreateDirectoryA(path, NULL);
+#else
+			mkdir(path, 0777);
+#endif
+			path[i] = '/';
+		}
+		file = fopen(path, "wb");
+	}
+
+	free(path);
+	return file;
+}
+
+int FIT_ExtractFromSnapshot(FIT_Context *ctx, FIT_Snapshot *snapshot, const char *pathOrPrefix, const char *destDir, uint32_t *extractedCount) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(snapshot);
+	FIT_SHOULD_NOT_BE_NULL(pathOrPrefix);
+	FIT_SHOULD_NOT_BE_NULL(extractedCount);
+
+	*extractedCount = 0;
+	size_t prefixLen = strnlen(pathOrPrefix, FIT_MAX_ENTRY_PATH);
+	FIT_ASSERT_LOG_RETURN(prefixLen, "The path to extract is empty.");
+
+	for (FIT_FileEntry *entry = snapshot->entryHead;
+		 entry != NULL;
+		 entry = entry->snapNext) {
+
+		if (!FIT_PathMatchesPrefix(entry->path, entry->pathLen, pathOrPrefix, prefixLen)) {
+			continue;
+		}
+
+		FILE *file = FIT_OpenExtractFile(ctx, destDir, entry->path);
+		FIT_ASSERT_LOG_RETURN(file, "Unable to open [%s] in [%s] to extract to.", entry->path, destDir ? destDir : ctx->workingDirectory.buffer);
+
+		int result = FIT_CopyBlobToFile(ctx, entry, file);
+		result = (fclose(file) == 0) && result;
+		FIT_ASSERT_LOG_RETURN(result, "Unable to extract [%s].", entry->path);
+
+		(*extractedCount)++;
+	}
+
+	return 1;
+}
+
+static FIT_FileHistory *FIT_FindFileHistory(const FIT_HistoryIndex *index, const char *path, size_t pathLen, uint32_t *slotOut) {
+	uint32_t mask = index->slotCount - 1;
+	uint32_t slot = FIT_HashString(path, pathLen) & mask;
+	while (index->slots[slot]) {
+		FIT_FileHistory *history = &index->histories[index->slots[slot] - 1];
+		if (history->pathLen == pathLen && memcmp(history->path, path, pathLen) == 0) {
+			return history;
+		}
+		slot = (slot + 1) & mask;
+	}
+	if (slotOut) {
+		*slotOut = slot;
+	}
+	return NULL;
+}
+
+static int FIT_HistoryIndexGrow(FIT_HistoryIndex *index) {
+	uint32_t slotCount = index->slotCount ? index->slotCount * 2 : 256;
+	uint32_t *slots = (uint32_t *)calloc(slotCount, sizeof(uint32_t));
+	FIT_ASSERT_LOG_RETURN(slots, "Out of memory. Unable to grow the history index.");
+
+	uint32_t mask = slotCount - 1;
+	for (uint32_t i = 0; i < index->historyCount; i++) {
+		FIT_FileHistory *history = &index->histories[i];
+		uint32_t slot = FIT_HashString(history->path, history->pathLen) & mask;
+		while (slots[slot]) {
+			slot = (slot + 1) & mask;
+		}
+		slots[slot] = i + 1;
+	}
+
+	free(index->slots);
+	index->slots = slots;
+	index->slotCount = slotCount;
+	return 1;
+}
+
+int FIT_HistoryIndexAddSnapshot(FIT_HistoryIndex *index, FIT_Snapshot *snapshot) {
+	FIT_SHOULD_NOT_BE_NULL(index);
+	FIT_SHOULD_NOT_BE_NULL(snapshot);
+
+	for (FIT_FileEntry *entry = snapshot->entryHead;
+		 entry != NULL;
+		 entry = entry->snapNext) {
+
+		if ((index->historyCount + 1) * 2 > index->slotCount) {
+			int result = FIT_HistoryIndexGrow(index);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to add [%s] to the history index.", entry->path);
+		}
+
+		uint32_t slot = 0;
+		FIT_FileHistory *history = FIT_FindFileHistory(index, entry->path, entry->pathLen, &slot);
+		if (!history) {
+			if (index->historyCount == index->historyCapacity) {
+				uint32_t capacity = index->historyCapacity ? index->historyCapacity * 2 : 128;
+				FIT_FileHistory *histories = (FIT_FileHistory *)realloc(index->histories, capacity * sizeof(FIT_FileHistory));
+				FIT_ASSERT_LOG_RETURN(histories, "Out of memory. Unable to grow the history index.");
+				index->histories = histories;
+				index->historyCapacity = capacity;
+			}
+
+			history = &index->histories[index->historyCount];
+			memset(history, 0, sizeof(FIT_FileHistory));
+			history->path = (char *)malloc(entry->pathLen + 1);
+			FIT_ASSERT_LOG_RETURN(history->path, "Out of memory. Unable to allocate string.");
+			memcpy(history->path, entry->path, entry->pathLen + 1);
+			history->pathLen = entry->pathLen;
+			index->slots[slot] = ++index->historyCount;
+		}
+
+		if (history->versionCount == history->versionCapacity) {
+			uint32_t capacity = history->versionCapacity ? history->versionCapacity * 2 : 4;
+			FIT_FileVersion *versions = (FIT_FileVersion *)realloc(history->versions, capacity * sizeof(FIT_FileVersion));
+			FIT_ASSERT_LOG_RETURN(versions, "Out of memory. Unable to grow the history of [%s].", entry->path);
+			history->versions = versions;
+			history->versionCapacity = capacity;
+		}
+
+		// Snapshots are only ever added at the end, so versions stay oldest first.
+		FIT_FileVersion *version = &history->versions[history->versionCount++];
+		version->snapshot = snapshot;
+		version->entry = entry;
+	}
+
+	return 1;
+}
+
+void FIT_HistoryIndexRemoveSnapshot(FIT_HistoryIndex *index, FIT_Snapshot *snapshot) {
+	FIT_SHOULD_NOT_BE_NULL(index);
+	FIT_SHOULD_NOT_BE_NULL(snapshot);
+
+	if (!index->slotCount) {
+		return;
+	}
+
+	for (FIT_FileEntry *entry = snapshot->entryHead;
+		 entry != NULL;
+		 entry = entry->snapNext) {
+
+		FIT_FileHistory *history = FIT_FindFileHistory(index, entry->path, entry->pathLen, NULL);
+		if (!history) {
+			continue;
+		}
+
+		// Paths with no versions left keep their slot, they just have nothing to show.
+		uint32_t kept = 0;
+		for (uint32_t i = 0; i < history->versionCount; i++) {
+			if (history->versions[i].snapshot != snapshot) {
+				history->versions[kept++] = history->versions[i];
+			}
+		}
+		history->versionCount = kept;
+	}
+}
+
+const FIT_FileHistory *FIT_GetFileHistory(FIT_Context *ctx, const char *path, size_t pathLen) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(path);
+
+	if (!ctx->history.slotCount) {
+		return NULL;
+	}
+	FIT_FileHistory *history = FIT_FindFileHistory(&ctx->history, path, pathLen, NULL);
+	return history && history->versionCount ? history : NULL;
+}
+
+void FIT_HistoryIndexDeinit(FIT_HistoryIndex *index) {
+	FIT_SHOULD_NOT_BE_NULL(index);
+	for (uint32_t i = 0; i < index->historyCount; i++) {
+		free(index->histories[i].path);
+		free(index->histories[i].versions);
+	}
+	free(index->histories);
+	free(index->slots);
+	memset(index, 0, sizeof(FIT_HistoryIndex));
+}
+
+int FIT_HashWorkingFile(FIT_Context *ctx, const char *relPath, FIT_Base64Digest *digest, uint64_t *size) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(relPath);
+	FIT_SHOULD_NOT_BE_NULL(digest);
+	FIT_SHOULD_NOT_BE_NULL(size);
+
+	uint64_t traceStart = FIT_TraceBegin();
+	FILE *file = FIT_OpenWorkingFile(ctx, relPath, "rb");
+	if (!file) {
+		return 0;
+	}
+
+	char *buffer = NULL;
+	uint64_t bufferLen = 0;
+	int result = FIT_AllocateFileContents(file, &buffer, &bufferLen);
+	fclose(file);
+	if (!result) {
+		return 0;
+	}
+
+	FIT_HashBuffer(digest, buffer, bufferLen);
+	*size = bufferLen;
+	free(buffer);
+
+	FIT_TraceEnd("hash file", traceStart, relPath);
+	return 1;
+}
+
+FIT_Snapshot *FIT_SnapshotWorkingDirectory(FIT_Context *ctx) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+
+	// Not added to the snapshot list, it only lives as long as the context.
+	FIT_Snapshot *snapshot = FIT_AllocateSnapshot(ctx);
+	FIT_ASSERT_LOG_RETURN(snapshot, "Unable to allocate snapshot for the working directory.");
+
+	for (FIT_FileEntry *tracked = ctx->fsData.entryTrackingHead;
+		 tracked != NULL;
+		 tracked = tracked->trackNext) {
+
+		FIT_Base64Digest digest = {0};
+		uint64_t size = 0;
+		if (!FIT_HashWorkingFile(ctx, tracked->path, &digest, &size)) {
+			continue;
+		}
+
+		FIT_FileEntry *entry = FIT_AllocateFileEntry(ctx);
+		FIT_ASSERT_LOG_RETURN(entry, "Unable to allocate file entry");
+
+		FIT_CopyFileEntry(entry, tracked);
+		FIT_ASSERT_LOG_RETURN(entry->path, "Unable to copy file entry [%s].", tracked->path);
+		memcpy(entry->hash.buffer, digest.buffer, FIT_BASE64_DIGEST_SIZE);
+		entry->offsetLen = size;
+
+		FIT_AddToSnapshotFileEntryList(snapshot, entry);
+	}
+
+	return snapshot;
+}
+
+static int FIT_DiffPush(FIT_Diff *diff, FIT_DiffKind kind, FIT_FileEntry *from, FIT_FileEntry *to) {
+	if (diff->itemCount == diff->itemCapacity) {
+		uint32_t capacity = diff->itemCapacity ? diff->itemCapacity * 2 : 64;
+		FIT_DiffItem *items = (FIT_DiffItem *)realloc(diff->items, capacity * sizeof(FIT_DiffItem));
+		FIT_ASSERT_LOG_RETURN(items, "Out of memory. Unable to grow the diff.");
+		diff->items = items;
+		diff->itemCapacity = capacity;
+	}
+
+	FIT_DiffItem *item = &diff->items[diff->itemCount++];
+	item->kind = kind;
+	item->from = from;
+	item->to = to;
+	return 1;
+}
+
+static int FIT_DigestsEqual(const FIT_FileEntry *a, const FIT_FileEntry *b) {
+	return strncmp(a->hash.buffer, b->hash.buffer, FIT_BASE64_DIGEST_SIZE) == 0;
+}
+
+int FIT_DiffSnapshots(FIT_Snapshot *from, FIT_Snapshot *to, FIT_Diff *diff) {
+	FIT_SHOULD_NOT_BE_NULL(from);
+	FIT_SHOULD_NOT_BE_NULL(to);
+	FIT_SHOULD_NOT_BE_NULL(diff);
+
+	memset(diff, 0, sizeof(FIT_Diff));
+
+	int result = 0;
+	FIT_PathTable fromPaths = {0};
+	FIT_PathTable toPaths = {0};
+
+	result = FIT_PathTableInit(&fromPaths, from->entryCount) && FIT_PathTableInit(&toPaths, to->entryCount);
+	for (FIT_FileEntry *entry = from->entryHead; result && entry != NULL; entry = entry->snapNext) {
+		result = FIT_PathTableInsert(&fromPaths, entry);
+	}
+	for (FIT_FileEntry *entry = to->entryHead; result && entry != NULL; entry = entry->snapNext) {
+		result = FIT_PathTableInsert(&toPaths, entry);
+	}
+
+	// Paths in both are modified or unchanged, paths only in one are added or removed for now.
+	for (FIT_FileEntry *entry = to->entryHead; result && entry != NULL; entry = entry->snapNext) {
+		FIT_FileEntry *old = FIT_PathTableFind(&fromPaths, entry->path, entry->pathLen);
+		if (!old) {
+			result = FIT_DiffPush(diff, FIT_DIFF_ADDED, NULL, entry);
+		}
+		else if (!FIT_DigestsEqual(old, entry)) {
+			result = FIT_DiffPush(diff, FIT_DIFF_MODIFIED, old, entry);
+			diff->modifiedCount++;
+		}
+		else {
+			diff->unchangedCount++;
+		}
+	}
+
+	uint32_t addedEnd = diff->itemCount;
+	for (FIT_FileEntry *entry = from->entryHead; result && entry != NULL; entry = entry->snapNext) {
+		if (!FIT_PathTableFind(&toPaths, entry->path, entry->pathLen)) {
+			result = FIT_DiffPush(diff, FIT_DIFF_REMOVED, entry, NULL);
+		}
+	}
+
+	FIT_PathTableDeinit(&fromPaths);
+	FIT_PathTableDeinit(&toPaths);
+	if (!result) {
+		FIT_DiffDeinit(diff);
+		FIT_ASSERT_LOG_RETURN(result, "Unable to diff the snapshots.");
+	}
+
+	// A removed path and an added path with the same contents is a rename. Removed items
+	// are indexed by digest, and the ones that get paired up are dropped from the list.
+	uint32_t removedCount = diff->itemCount - addedEnd;
+	uint32_t digestSlotCount = 16;
+	while (digestSlotCount < removedCount * 2) {
+		digestSlotCount *= 2;
+	}
+
+	int32_t *removedByDigest = (int32_t *)malloc(digestSlotCount * sizeof(int32_t));
+	if (!removedByDigest) {
+		FIT_DiffDeinit(diff);
+		FIT_ASSERT_LOG_RETURN(0, "Out of memory. Unable to detect renames.");
+	}
+	memset(removedByDigest, 0xFF, digestSlotCount * sizeof(int32_t));
+
+	uint32_t mask = digestSlotCount - 1;
+	for (uint32_t i = addedEnd; i < diff->itemCount; i++) {
+		const FIT_Base64Digest *hash = &diff->items[i].from->hash;
+		uint32_t slot = FIT_HashString(hash->buffer, strnlen(hash->buffer, FIT_BASE64_DIGEST_SIZE)) & mask;
+		while (removedByDigest[slot] != -1) {
+			slot = (slot + 1) & mask;
+		}
+		removedByDigest[slot] = (int32_t)i;
+	}
+
+	for (uint32_t i = 0; i < addedEnd; i++) {
+		FIT_DiffItem *item = &diff->items[i];
+		if (item->kind != FIT_DIFF_ADDED) {
+			continue;
+		}
+
+		const FIT_Base64Digest *hash = &item->to->hash;
+		uint32_t slot = FIT_HashString(hash->buffer, strnlen(hash->buffer, FIT_BASE64_DIGEST_SIZE)) & mask;
+		for (; removedByDigest[slot] != -1; slot = (slot + 1) & mask) {
+			FIT_DiffItem *candidate = &diff->items[removedByDigest[slot]];
+			if (candidate->kind == FIT_DIFF_REMOVED && FIT_DigestsEqual(candidate->from, item->to)) {
+				item->kind = FIT_DIFF_RENAMED;
+				item->from = candidate->from;
+				candidate->kind = FIT_DIFF_UNCHANGED;
+				diff->renamedCount++;
+				break;
+			}
+		}
+		if (item->kind == FIT_DIFF_ADDED) {
+			diff->addedCount++;
+		}
+	}
+	free(removedByDigest);
+
+	uint32_t kept = addedEnd;
+	for (uint32_t i = addedEnd; i < diff->itemCount; i++) {
+		if (diff->items[i].kind == FIT_DIFF_REMOVED) {
+			diff->items[kept++] = diff->items[i];
+			diff->removedCount++;
+		}
+	}
+	diff->itemCount = kept;
+
+	return 1;
+}
+
+void FIT_DiffDeinit(FIT_Diff *diff) {
+	FIT_SHOULD_NOT_BE_NULL(diff);
+	free(diff->items);
+	memset(diff, 0, sizeof(FIT_Diff));
+}
+
+int FIT_ReadBlob(FIT_Context *ctx, FIT_FileEntry *entry, char **buffer, uint64_t *bufferLen) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(entry);
+	FIT_SHOULD_NOT_BE_NULL(buffer);
+	FIT_SHOULD_NOT_BE_NULL(bufferLen);
+
+	*buffer = (char *)malloc(entry->offsetLen ? entry->offsetLen : 1);
+	FIT_ASSERT_LOG_RETURN(*buffer, "Out of memory. Unable to allocate the contents of [%s].", entry->path);
+	*bufferLen = entry->offsetLen;
+
+	if (ctx->fsData.buffer) {
+		memcpy(*buffer, &ctx->fsData.buffer[entry->offset], entry->offsetLen);
+		return 1;
+	}
+
+	FIT_ASSERT_LOG_RETURN(entry->offset + entry->offsetLen <= ctx->fsData.bufferCount, "The contents of [%s] are outside the file store buffer.", entry->path);
+	int result = FIT_ReadStoreRange(ctx, ctx->blobStoreOffset + entry->offset, *buffer, entry->offsetLen);
+	if (!result) {
+		free(*buffer);
+		*buffer = NULL;
+		FIT_ASSERT_LOG_RETURN(result, "Unable to read the contents of [%s] from the file store.", entry->path);
+	}
+	return 1;
+}
+
+static uint32_t FIT_CountTrailingZeros(uint32_t value) {
+#ifdef _MSC_VER
+	unsigned long index = 0;
+	_BitScanForward(&index, value);
+	return (uint32_t)index;
+#else
+	return (uint32_t)__builtin_ctz(value);
+#endif
+}
+
+static int FIT_PushLineStart(FIT_TextLines *lines, uint64_t start) {
+	if (lines->lineCount + 1 >= lines->lineCapacity) {
+		uint32_t capacity = lines->lineCapacity ? lines->lineCapacity * 2 : 1024;
+		uint64_t *starts = (uint64_t *)realloc(lines->lineStarts, capacity * sizeof(uint64_t));
+		FIT_ASSERT_LOG_RETURN(starts, "Out of memory. Unable to grow the line list.");
+		lines->lineStarts = starts;
+		lines->lineCapacity = capacity;
+	}
+	lines->lineStarts[lines->lineCount++] = start;
+	return 1;
+}
+
+// Line i is lineStarts[i] up to lineStarts[i + 1], including its '\n'. The extra start
+// at the end is the length of the text.
+static int FIT_SplitLines(FIT_TextLines *lines, const char *text, uint64_t textLen) {
+	memset(lines, 0, sizeof(FIT_TextLines));
+	lines->text = text;
+	lines->textLen = textLen;
+
+	int result = FIT_PushLineStart(lines, 0);
+	uint64_t i = 0;
+
+#if FIT_SSE2
+	// Sixteen bytes are checked for '\n' at once, most of a line is skipped in a couple of compares.
+	const __m128i newline = _mm_set1_epi8('\n');
+	for (; result && i + 16 <= textLen; i += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)(text + i));
+		uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+		while (mask && result) {
+			result = FIT_PushLineStart(lines, i + FIT_CountTrailingZeros(mask) + 1);
+			mask &= mask - 1;
+		}
+	}
+#endif
+	for (; result && i < textLen; i++) {
+		if (text[i] == '\n') {
+			result = FIT_PushLineStart(lines, i + 1);
+		}
+	}
+	FIT_ASSERT_LOG_RETURN(result, "Unable to split the text into lines.");
+
+	// The start pushed for a trailing '\n' is already the end, otherwise the last line needs one.
+	if (lines->lineStarts[lines->lineCount - 1] != textLen) {
+		result = FIT_PushLineStart(lines, textLen);
+		FIT_ASSERT_LOG_RETURN(result, "Unable to split the text into lines.");
+	}
+	lines->lineCount--;
+
+	lines->ids = (uint32_t *)malloc((lines->lineCount ? lines->lineCount : 1) * sizeof(uint32_t));
+	FIT_ASSERT_LOG_RETURN(lines->ids, "Out of memory. Unable to allocate line ids.");
+	return 1;
+}
+
+typedef struct FIT_LineInterner {
+	const char **texts;	// a representative line for each id
+	uint32_t *lengths;
+	uint32_t *slots;	// id + 1, 0 is empty
+	uint32_t slotCount;
+	uint32_t count;
+} FIT_LineInterner;
+
+// Gives every distinct line the same small id on both sides, so the diff only compares integers.
+static int FIT_InternLines(FIT_LineInterner *interner, FIT_TextLines *lines) {
+	for (uint32_t i = 0; i < lines->lineCount; i++) {
+		const char *line = &lines->text[lines->lineStarts[i]];
+		uint32_t len = (uint32_t)(lines->lineStarts[i + 1] - lines->lineStarts[i]);
+
+		uint32_t mask = interner->slotCount - 1;
+		uint32_t slot = FIT_HashString(line, len) & mask;
+		for (;;) {
+			uint32_t id = interner->slots[slot];
+			if (!id) {
+				id = interner->count++;
+				interner->texts[id] = line;
+				interner->lengths[id] = len;
+				interner->slots[slot] = id + 1;
+				lines->ids[i] = id;
+				break;
+			}
+			id--;
+			if (interner->lengths[id] == len && memcmp(interner->texts[id], line, len) == 0) {
+				lines->ids[i] = id;
+				break;
+			}
+			slot = (slot + 1) & mask;
+		}
+	}
+	return 1;
+}
+
+typedef struct FIT_LineDiffState {
+	const uint32_t *a;
+	const uint32_t *b;
+	uint8_t *aChanged;
+	uint8_t *bChanged;
+	int64_t *v1;
+	int64_t *v2;
+} FIT_LineDiffState;
+
+static void FIT_LineDiffCompare(FIT_LineDiffState *state, int64_t aLo, int64_t aHi, int64_t bLo, int64_t bHi);
+
+// Myers' middle snake in linear space. Finds a point on an optimal edit path between
+// a[aLo, aHi) and b[bLo, bHi), and diffs the two halves on either side of it.
+static void FIT_LineDiffBisect(FIT_LineDiffState *state, int64_t aLo, int64_t aHi, int64_t bLo, int64_t bHi) {
+	const uint32_t *a = state->a;
+	const uint32_t *b = state->b;
+	int64_t aLen = aHi - aLo;
+	int64_t bLen = bHi - bLo;
+	int64_t maxD = (aLen + bLen + 1) / 2;
+	int64_t vOffset = maxD + 1;
+	int64_t vLength = 2 * maxD + 3;
+	int64_t *v1 = state->v1;
+	int64_t *v2 = state->v2;
+
+	for (int64_t i = 0; i < vLength; i++) {
+		v1[i] = -1;
+		v2[i] = -1;
+	}
+	v1[vOffset + 1] = 0;
+	v2[vOffset + 1] = 0;
+
+	int64_t delta = aLen - bLen;
+	int front = (delta & 1) != 0;
+	int64_t k1Start = 0, k1End = 0, k2Start = 0, k2End = 0;
+
+	for (int64_t d = 0; d < maxD; d++) {
+		for (int64_t k1 = -d + k1Start; k1 <= d - k1End; k1 += 2) {
+			int64_t k1Offset = vOffset + k1;
+			int64_t x1 = (k1 == -d || (k1 != d && v1[k1Offset - 1] < v1[k1Offset + 1])) ? v1[k1Offset + 1] : v1[k1Offset - 1] + 1;
+			int64_t y1 = x1 - k1;
+			while (x1 < aLen && y1 < bLen && a[aLo + x1] == b[bLo + y1]) {
+				x1++;
+				y1++;
+			}
+			v1[k1Offset] = x1;
+			if (x1 > aLen) {
+				k1End += 2;
+			}
+			else if (y1 > bLen) {
+				k1Start += 2;
+			}
+			else if (front) {
+				int64_t k2Offset = vOffset + delta - k1;
+				if (k2Offset >= 0 && k2Offset < vLength && v2[k2Offset] != -1 && x1 >= aLen - v2[k2Offset]) {
+					FIT_LineDiffCompare(state, aLo, aLo + x1, bLo, bLo + y1);
+					FIT_LineDiffCompare(state, aLo + x1, aHi, bLo + y1, bHi);
+					return;
+				}
+			}
+		}
+
+		if (d >= FIT_LINE_DIFF_MAX_COST) {
+			break;
+		}
+
+		for (int64_t k2 = -d + k2Start; k2 <= d - k2End; k2 += 2) {
+			int64_t k2Offset = vOffset + k2;
+			int64_t x2 = (k2 == -d || (k2 != d && v2[k2Offset - 1] < v2[k2Offset + 1])) ? v2[k2Offset + 1] : v2[k2Offset - 1] + 1;
+			int64_t y2 = x2 - k2;
+			while (x2 < aLen && y2 < bLen && a[aHi - x2 - 1] == b[bHi - y2 - 1]) {
+				x2++;
+				y2++;
+			}
+			v2[k2Offset] = x2;
+			if (x2 > aLen) {
+				k2End += 2;
+			}
+			else if (y2 > bLen) {
+				k2Start += 2;
+			}
+			else if (!front) {
+				int64_t k1Offset = vOffset + delta - k2;
+				if (k1Offset >= 0 && k1Offset < vLength && v1[k1Offset] != -1) {
+					int64_t x1 = v1[k1Offset];
+					int64_t y1 = vOffset + x1 - k1Offset;
+					if (x1 >= aLen - x2) {
+						FIT_LineDiffCompare(state, aLo, aLo + x1, bLo, bLo + y1);
+						FIT_LineDiffCompare(state, aLo + x1, aHi, bLo + y1, bHi);
+						return;
+					}
+				}
+			}
+		}
+	}
+
+	// Too expensive to finish, so split at whichever end got furthest. The result is
+	// still a correct diff, just not always the smallest one.
+	int64_t bestX = 0, bestY = 0, bestProgress = 0;
+	for (int64_t k = -maxD; k <= maxD; k++) {
+		int64_t x1 = v1[vOffset + k];
+		int64_t y1 = x1 - k;
+		if (x1 >= 0 && x1 <= aLen && y1 >= 0 && y1 <= bLen && x1 + y1 > bestProgress) {
+			bestX = x1;
+			bestY = y1;
+			bestProgress = x1 + y1;
+		}
+		int64_t x2 = v2[vOffset + k];
+		int64_t y2 = x2 - k;
+		if (x2 >= 0 && x2 <= aLen && y2 >= 0 && y2 <= bLen && x2 + y2 > bestProgress) {
+			bestX = aLen - x2;
+			bestY = bLen - y2;
+			bestProgress = x2 + y2;
+		}
+	}
+
+	if (bestProgress > 0 && bestProgress < aLen + bLen) {
+		FIT_LineDiffCompare(state, aLo, aLo + bestX, bLo, bLo + bestY);
+		FIT_LineDiffCompare(state, aLo + bestX, aHi, bLo + bestY, bHi);
+		return;
+	}
+
+	memset(&state->aChanged[aLo], 1, (size_t)aLen);
+	memset(&state->bChanged[bLo], 1, (size_t)bLen);
+}
+
+static void FIT_LineDiffCompare(FIT_LineDiffState *state, int64_t aLo, int64_t aHi, int64_t bLo, int64_t bHi) {
+	// Equal lines at either end are never part of the edit.
+	while (aLo < aHi && bLo < bHi && state->a[aLo] == state->b[bLo]) {
+		aLo++;
+		bLo++;
+	}
+	while (aLo < aHi && bLo < bHi && state->a[aHi - 1] == state->b[bHi - 1]) {
+		aHi--;
+		bHi--;
+	}
+
+	if (aLo == aHi) {
+		memset(&state->bChanged[bLo], 1, (size_t)(bHi - bLo));
+	}
+	else if (bLo == bHi) {
+		memset(&state->aChanged[aLo], 1, (size_t)(aHi - aLo));
+	}
+	else {
+		FIT_LineDiffBisect(state, aLo, aHi, bLo, bHi);
+	}
+}
+
+int FIT_DiffLines(const char *from, uint64_t fromLen, const char *to, uint64_t toLen, FIT_LineDiff *diff) {
+	FIT_SHOULD_NOT_BE_NULL(diff);
+
+	memset(diff, 0, sizeof(FIT_LineDiff));
+
+	int result = FIT_SplitLines(&diff->from, from, fromLen) && FIT_SplitLines(&diff->to, to, toLen);
+	if (!result) {
+		FIT_LineDiffDeinit(diff);
+		FIT_ASSERT_LOG_RETURN(result, "Unable to split the files into lines.");
+	}
+
+	uint32_t fromCount = diff->from.lineCount;
+	uint32_t toCount = diff->to.lineCount;
+
+	FIT_LineInterner interner = {0};
+	interner.slotCount = 16;
+	while (interner.slotCount < (fromCount + toCount) * 2) {
+		interner.slotCount *= 2;
+	}
+	interner.slots = (uint32_t *)calloc(interner.slotCount, sizeof(uint32_t));
+	interner.texts = (const char **)malloc((fromCount + toCount + 1) * sizeof(const char *));
+	interner.lengths = (uint32_t *)malloc((fromCount + toCount + 1) * sizeof(uint32_t));
+
+	FIT_LineDiffState state = {0};
+	state.v1 = (int64_t *)malloc(((uint64_t)fromCount + toCount + 4) * sizeof(int64_t));
+	state.v2 = (int64_t *)malloc(((uint64_t)fromCount + toCount + 4) * sizeof(int64_t));
+	diff->fromChanged = (uint8_t *)calloc(fromCount + 1, sizeof(uint8_t));
+	diff->toChanged = (uint8_t *)calloc(toCount + 1, sizeof(uint8_t));
+
+	result = interner.slots && interner.texts && interner.lengths && state.v1 && state.v2 && diff->fromChanged && diff->toChanged;
+	if (result) {
+		FIT_InternLines(&interner, &diff->from);
+		FIT_InternLines(&interner, &diff->to);
+
+		state.a = diff->from.ids;
+		state.b = diff->to.ids;
+		state.aChanged = diff->fromChanged;
+		state.bChanged = diff->toChanged;
+		FIT_LineDiffCompare(&state, 0, fromCount, 0, toCount);
+
+		for (uint32_t i = 0; i < fromCount; i++) diff->deletedCount += diff->fromChanged[i];
+		for (uint32_t i = 0; i < toCount; i++) diff->insertedCount += diff->toChanged[i];
+	}
+
+	free(interner.slots);
+	free((void *)interner.texts);
+	free(interner.lengths);
+	free(state.v1);
+	free(state.v2);
+	if (!result) {
+		FIT_LineDiffDeinit(diff);
+		FIT_ASSERT_LOG_RETURN(result, "Out of memory. Unable to diff the lines.");
+	}
+
+	return 1;
+}
+
+static void FIT_WriteDiffLine(FILE *out, char prefix, const FIT_TextLines *lines, uint32_t line) {
+	uint64_t start = lines->lineStarts[line];
+	uint64_t end = lines->lineStarts[line + 1];
+	fputc(prefix, out);
+	fwrite(&lines->text[start], 1, (size_t)(end - start), out);
+	if (end == start || lines->text[end - 1] != '\n') {
+		fputs("\n\\ No newline at end of file\n", out);
+	}
+}
+
+int FIT_WriteUnifiedDiff(const FIT_LineDiff *diff, const char *fromLabel, const char *toLabel, uint32_t contextLines, FILE *out) {
+	FIT_SHOULD_NOT_BE_NULL(diff);
+	FIT_SHOULD_NOT_BE_NULL(out);
+
+	if (!diff->deletedCount && !diff->insertedCount) {
+		return 1;
+	}
+
+	fprintf(out, "--- %s\n+++ %s\n", fromLabel ? fromLabel : "a", toLabel ? toLabel : "b");
+
+	uint32_t fromCount = diff->from.lineCount;
+	uint32_t toCount = diff->to.lineCount;
+	uint32_t i = 0, j = 0;
+
+	while (i < fromCount || j < toCount) {
+		// Skip to the next change, both sides stay in step over equal lines.
+		uint32_t changeI = i, changeJ = j;
+		while (changeI < fromCount && changeJ < toCount && !diff->fromChanged[changeI] && !diff->toChanged[changeJ]) {
+			changeI++;
+			changeJ++;
+		}
+		if (changeI == fromCount && changeJ == toCount) {
+			break;
+		}
+
+		uint32_t context = changeI - i < contextLines ? changeI - i : contextLines;
+		uint32_t hunkI = changeI - context;
+		uint32_t hunkJ = changeJ - context;
+
+		// Grow the hunk over changes that are no more than twice the context apart.
+		uint32_t endI = changeI, endJ = changeJ;
+		for (;;) {
+			while (endI < fromCount && diff->fromChanged[endI]) endI++;
+			while (endJ < toCount && diff->toChanged[endJ]) endJ++;
+
+			uint32_t equal = 0;
+			while (endI + equal < fromCount && endJ + equal < toCount &&
+				   !diff->fromChanged[endI + equal] && !diff->toChanged[endJ + equal]) {
+				equal++;
+			}
+
+			int moreChanges = endI + equal < fromCount || endJ + equal < toCount;
+			if (!moreChanges || equal > 2 * contextLines) {
+				uint32_t trailing = equal < contextLines ? equal : contextLines;
+				endI += trailing;
+				endJ += trailing;
+				break;
+			}
+			endI += equal;
+			endJ += equal;
+		}
+
+		fprintf(out, "@@ -%u,%u +%u,%u @@\n",
+			endI - hunkI ? hunkI + 1 : hunkI, endI - hunkI,
+			endJ - hunkJ ? hunkJ + 1 : hunkJ, endJ - hunkJ);
+
+		uint32_t a = hunkI, b = hunkJ;
+		while (a < endI || b < endJ) {
+			if (a < endI && diff->fromChanged[a]) {
+				FIT_WriteDiffLine(out, '-', &diff->from, a++);
+			}
+			else if (b < endJ && diff->toChanged[b]) {
+				FIT_WriteDiffLine(out, '+', &diff->to, b++);
+			}
+			else {
+				FIT_WriteDiffLine(out, ' ', &diff->from, a++);
+				b++;
+			}
+		}
+
+		i = endI;
+		j = endJ;
+	}
+
+	return 1;
+}
+
+void FIT_LineDiffDeinit(FIT_LineDiff *diff) {
+	FIT_SHOULD_NOT_BE_NULL(diff);
+	free(diff->from.lineStarts);
+	free(diff->from.ids);
+	free(diff->to.lineStarts);
+	free(diff->to.ids);
+	free(diff->fromChanged);
+	free(diff->toChanged);
+	memset(diff, 0, sizeof(FIT_LineDiff));
+}
+
+static int FIT_ReadDiffSide(FIT_Context *ctx, FIT_FileEntry *entry, int fromWorkingDirectory, char **buffer, uint64_t *bufferLen) {
+	*buffer = NULL;
+	*bufferLen = 0;
+	if (!entry) {
+		return 1;
+	}
+
+	int result = 0;
+	if (fromWorkingDirectory) {
+		FILE *file = FIT_OpenWorkingFile(ctx, entry->path, "rb");
+		FIT_ASSERT_LOG_RETURN(file, "Unable to open [%s%s].", ctx->workingDirectory.buffer, entry->path);
+		result = FIT_AllocateFileContents(file, buffer, bufferLen);
+		fclose(file);
+	}
+	else {
+		result = FIT_ReadBlob(ctx, entry, buffer, bufferLen);
+	}
+	FIT_ASSERT_LOG_RETURN(result, "Unable to read the contents of [%s].", entry->path);
+
+	// Empty files are stored as a single byte, see FIT_AllocateFileContents.
+	if (*bufferLen == 1 && (*buffer)[0] == '\0') {
+		*bufferLen = 0;
+	}
+	return 1;
+}
+
+static int FIT_LooksBinary(const char *buffer, uint64_t bufferLen) {
+	return memchr(buffer, '\0', (size_t)(bufferLen < 8000 ? bufferLen : 8000)) != NULL;
+}
+
+int FIT_WriteFileContentDiff(FIT_Context *ctx, FIT_FileEntry *from, FIT_FileEntry *to, int toWorkingDirectory, FILE *out) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(out);
+	FIT_ASSERT_LOG_RETURN(from || to, "There is no file to diff.");
+
+	char *fromBuffer = NULL, *toBuffer = NULL;
+	uint64_t fromLen = 0, toLen = 0;
+	int result = FIT_ReadDiffSide(ctx, from, 0, &fromBuffer, &fromLen) &&
+				 FIT_ReadDiffSide(ctx, to, toWorkingDirectory, &toBuffer, &toLen);
+
+	if (result) {
+		const char *fromPath = from ? from->path : to->path;
+		const char *toPath = to ? to->path : from->path;
+
+		if ((fromBuffer && FIT_LooksBinary(fromBuffer, fromLen)) || (toBuffer && FIT_LooksBinary(toBuffer, toLen))) {
+			fprintf(out, "Binary files a/%s and b/%s differ\n", fromPath, toPath);
+		}
+		else {
+			FIT_LineDiff diff = {0};
+			result = FIT_DiffLines(fromBuffer, fromLen, toBuffer, toLen, &diff);
+			if (result) {
+				// room for "a/" and for "/dev/null"
+				size_t fromLabelLen = strlen(fromPath) + 16;
+				size_t toLabelLen = strlen(toPath) + 16;
+				char *fromLabel = (char *)malloc(fromLabelLen);
+				char *toLabel = (char *)malloc(toLabelLen);
+				result = fromLabel && toLabel;
+				if (result) {
+					snprintf(fromLabel, fromLabelLen, from ? "a/%s" : "/dev/null", fromPath);
+					snprintf(toLabel, toLabelLen, to ? "b/%s" : "/dev/null", toPath);
+					result = FIT_WriteUnifiedDiff(&diff, fromLabel, toLabel, 3, out);
+				}
+				free(fromLabel);
+				free(toLabel);
+				FIT_LineDiffDeinit(&diff);
+			}
+		}
+	}
+
+	free(fromBuffer);
+	free(toBuffer);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to diff the contents of [%s].", from ? from->path : to->path);
+	return 1;
+}
+
+static int FIT_StatusPush(FIT_Status *status, FIT_StatusKind kind, const char *path, size_t pathLen) {
+	if (status->itemCount == status->itemCapacity) {
+		uint32_t capacity = status->itemCapacity ? status->itemCapacity * 2 : 64;
+		FIT_StatusItem *items = (FIT_StatusItem *)realloc(status->items, capacity * sizeof(FIT_StatusItem));
+		FIT_ASSERT_LOG_RETURN(items, "Out of memory. Unable to grow the status.");
+		status->items = items;
+		status->itemCapacity = capacity;
+	}
+
+	char *copy = (char *)malloc(pathLen + 1);
+	FIT_ASSERT_LOG_RETURN(copy, "Out of memory. Unable to allocate string.");
+	memcpy(copy, path, pathLen);
+	copy[pathLen] = '\0';
+
+	FIT_StatusItem *item = &status->items[status->itemCount++];
+	item->kind = kind;
+	item->path = copy;
+
+	switch (kind) {
+	case FIT_STATUS_NEW: status->newCount++; break;
+	case FIT_STATUS_MODIFIED: status->modifiedCount++; break;
+	case FIT_STATUS_DELETED: status->deletedCount++; break;
+	case FIT_STATUS_UNTRACKED: status->untrackedCount++; break;
+	}
+	return 1;
+}
+
+typedef struct FIT_StatusWalk {
+	FIT_PathTable *tracked;
+	FIT_Status *status;
+} FIT_StatusWalk;
+
+static int FIT_StatusVisitFile(FIT_Context *ctx, const char *relPath, size_t relPathLen, void *user) {
+	(void)ctx;
+	FIT_StatusWalk *walk = (FIT_StatusWalk *)user;
+	if (FIT_PathTableFind(walk->tracked, relPath, relPathLen)) {
+		return 1;
+	}
+	return FIT_StatusPush(walk->status, FIT_STATUS_UNTRACKED, relPath, relPathLen);
+}
+
+int FIT_GetStatus(FIT_Context *ctx, int includeUntracked, FIT_Status *status) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(status);
+
+	memset(status, 0, sizeof(FIT_Status));
+
+	FIT_Snapshot *latest = ctx->fsData.snapshotTail;
+
+	// A file written in the same tick as the store can have the time the snapshot
+	// recorded and still be different, so those are always hashed.
+	uint64_t storeSize = 0;
+	uint64_t storeModifiedTime = 0;
+	size_t fileStoreLen = strnlen(ctx->fileStoreAbsolutePath.buffer, FIT_MAX_PATH);
+	const char *fileStoreName = FIT_GetFileName(ctx->fileStoreAbsolutePath.buffer, fileStoreLen);
+	FIT_GetWorkingFileStat(ctx, fileStoreName, &storeSize, &storeModifiedTime);
+
+	int result = 0;
+	FIT_PathTable latestPaths = {0};
+	FIT_PathTable trackedPaths = {0};
+
+	result = FIT_PathTableInit(&latestPaths, latest ? latest->entryCount : 0) && FIT_PathTableInit(&trackedPaths, ctx->fsData.trackingCount);
+	for (FIT_FileEntry *entry = latest ? latest->entryHead : NULL; result && entry != NULL; entry = entry->snapNext) {
+		result = FIT_PathTableInsert(&latestPaths, entry);
+	}
+
+	for (FIT_FileEntry *tracked = ctx->fsData.entryTrackingHead; result && tracked != NULL; tracked = tracked->trackNext) {
+		result = FIT_PathTableInsert(&trackedPaths, tracked);
+		if (!result) {
+			break;
+		}
+
+		uint64_t size = 0;
+		uint64_t modifiedTime = 0;
+		int exists = FIT_GetWorkingFileStat(ctx, tracked->path, &size, &modifiedTime);
+
+		FIT_FileEntry *saved = FIT_PathTableFind(&latestPaths, tracked->path, tracked->pathLen);
+		if (!saved) {
+			// Tracked files that are gone and were never saved have nothing to report.
+			if (exists) {
+				result = FIT_StatusPush(status, FIT_STATUS_NEW, tracked->path, tracked->pathLen);
+			}
+			continue;
+		}
+
+		if (!exists) {
+			result = FIT_StatusPush(status, FIT_STATUS_DELETED, tracked->path, tracked->pathLen);
+			continue;
+		}
+
+		// Empty files are stored as a single byte, see FIT_AllocateFileContents.
+		if ((size ? size : 1) != saved->offsetLen) {
+			result = FIT_StatusPush(status, FIT_STATUS_MODIFIED, tracked->path, tracked->pathLen);
+			continue;
+		}
+
+		int statIsEnough = saved->modifiedTime != 0 &&
+			saved->modifiedTime == modifiedTime &&
+			saved->modifiedTime < storeModifiedTime;
+		if (statIsEnough) {
+			FIT_StatsCount(&FIT_stats.filesSkipped, 1);
+			status->cleanCount++;
+			continue;
+		}
+
+		FIT_Base64Digest digest = {0};
+		status->hashedCount++;
+		if (FIT_HashWorkingFile(ctx, tracked->path, &digest, &size) &&
+			strncmp(digest.buffer, saved->hash.buffer, FIT_BASE64_DIGEST_SIZE) == 0) {
+			status->cleanCount++;
+		}
+		else {
+			result = FIT_StatusPush(status, FIT_STATUS_MODIFIED, tracked->path, tracked->pathLen);
+		}
+	}
+
+	// Saved files that are no longer tracked will not be in the next snapshot.
+	for (FIT_FileEntry *entry = latest ? latest->entryHead : NULL; result && entry != NULL; entry = entry->snapNext) {
+		if (!FIT_PathTableFind(&trackedPaths, entry->path, entry->pathLen)) {
+			result = FIT_StatusPush(status, FIT_STATUS_DELETED, entry->path, entry->pathLen);
+		}
+	}
+
+	if (result && includeUntracked) {
+		FIT_StatusWalk walk = { &trackedPaths, status };
+		result = FIT_WalkWorkingDirectory(ctx, ctx->fileStoreAbsolutePath.buffer, fileStoreLen, FIT_StatusVisitFile, &walk);
+	}
+
+	FIT_PathTableDeinit(&latestPaths);
+	FIT_PathTableDeinit(&trackedPaths);
+	if (!result) {
+		FIT_StatusDeinit(status);
+		FIT_ASSERT_LOG_RETURN(result, "Unable to get the status of the working directory [%s].", ctx->workingDirectory.buffer);
+	}
+
+	return 1;
+}
+
+void FIT_StatusDeinit(FIT_Status *status) {
+	FIT_SHOULD_NOT_BE_NULL(status);
+	for (uint32_t i = 0; i < status->itemCount; i++) {
+		free(status->items[i].path);
+	}
+	free(status->items);
+	memset(status, 0, sizeof(FIT_Status));
+}
+
+int FIT_PrepareSnapshotForSave(FIT_Context *ctx) {
+
+	int result = 0;
+	int newChanges = 0;
+
+	if (ctx->fsData.trackingCount == 0) {
+		FIT_LOG("There are no tracked files that can be saved.");
+		return 0;
+	}
+
+	FIT_Snapshot *snapshot = FIT_AllocateSnapshot(ctx);
+	FIT_ASSERT_LOG_RETURN(snapshot, "Unable to allocate the new snapshot.");
+	FIT_Snapshot *lastSnapshot = ctx->fsData.snapshotTail;
+
+	FIT_PathTable lastPaths = {0};
+	result = FIT_PathTableInit(&lastPaths, lastSnapshot ? lastSnapshot->entryCount : 0);
+	for (FIT_FileEntry *b = lastSnapshot ? lastSnapshot->entryHead : NULL; result && b != NULL; b = b->snapNext) {
+		result = FIT_PathTableInsert(&lastPaths, b);
+	}
+	if (!result) {
+		FIT_PathTableDeinit(&lastPaths);
+		FIT_ASSERT_LOG_RETURN(result, "Unable to index the last snapshot.");
+	}
+
+	if (ctx->operation) {
+		ctx->operation->filesTotal = ctx->fsData.trackingCount;
+	}
+
+	// The new snapshot gets its own copy of each tracked entry, so the tracking list can be
+	// saved again later without its entries being linked into an older snapshot.
+	for (FIT_FileEntry *tracked = ctx->fsData.entryTrackingHead;
+			tracked != NULL;
+			tracked = tracked->trackNext) {
+
+		FIT_FileEntry *entry = FIT_AllocateFileEntry(ctx);
+		result = entry && FIT_CopyFileEntry(entry, tracked);
+		if (!result) {
+			FIT_PathTableDeinit(&lastPaths);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to copy tracked file entry [%s].", tracked->path);
+		}
+
+		FIT_FileEntry *b = FIT_PathTableFind(&lastPaths, entry->path, entry->pathLen);
+		if (b) {
+			entry->inSnapshot = 1;
+			entry->offset = b->offset;
+			entry->offsetLen = b->offsetLen;
+			entry->modifiedTime = b->modifiedTime;
+			memcpy(entry->hash.buffer, b->hash.buffer, FIT_BASE64_DIGEST_SIZE);
+		}
+
+		// Taken before anything is read, so a write during the save leaves the time
+		// older than the file and status will hash it rather than trust it.
+		uint64_t size = 0;
+		if (!(ctx->trustCleanEntries && b && !tracked->dirty) &&
+			!FIT_GetWorkingFileStat(ctx, entry->path, &size, &entry->modifiedTime)) {
+			entry->modifiedTime = 0;
+		}
+		if (ctx->operation) {
+			ctx->operation->bytesTotal += size;
+		}
+
+		if (!entry->inSnapshot) {
+			FIT_LOG(" - A new file [*%s] has been added to the store.", entry->path);
+			newChanges++;
+		}
+
+		FIT_AddToSnapshotFileEntryList(snapshot, entry);
+	}
+
+	FIT_PathTableDeinit(&lastPaths);
+
+	FIT_FileEntry *prefetchEnd = snapshot->entryHead;
+
+	// Both lists are in the same order and lose the same entries, so they are walked together.
+	FIT_FileEntry *tracked = ctx->fsData.entryTrackingHead;
+
+	for (FIT_FileEntry *entry = snapshot->entryHead; entry != NULL;) {
+		FIT_FileEntry *entryNext = entry->snapNext;
+		FIT_FileEntry *trackedNext = tracked->trackNext;
+
+		if (FIT_IsOperationCancelled(ctx)) {
+			FIT_LOG("The save was cancelled, nothing was written to the file store.");
+			return 0;
+		}
+
+		if (ctx->trustCleanEntries && entry->inSnapshot && !tracked->dirty) {
+			FIT_StatsCount(&FIT_stats.filesSkipped, 1);
+			FIT_OperationFileDone(ctx, 0);
+			entry = entryNext;
+			tracked = trackedNext;
+			continue;
+		}
+
+		FIT_OperationFileStarted(ctx, entry->path);
+		uint64_t traceStart = FIT_TraceBegin();
+
+		if (entry == prefetchEnd && !ctx->trustCleanEntries) {
+			// Read the next batch of files at once when there is a batched backend.
+			prefetchEnd = FIT_PrefetchFileContents(ctx, entry, FIT_PREFETCH_BATCH_SIZE);
+		}
+
+		if (!entry->buffer) {
+			FILE *file = FIT_OpenWorkingFile(ctx, entry->path, "rb");
+			if (file) {
+				result = FIT_AllocateFileContents(file, &entry->buffer, &entry->bufferLen);
+				fclose(file);
+				FIT_ASSERT_LOG_RETURN(result, "TODO");
+			}
+		}
+
+		if (!entry->buffer) { // If we cannot open the file, then we assume the change is that this file has been deleted.
+
+			FIT_LOG(" - It appears that file [%s] has been renamed or deleted since the last snapshot.", entry->path);
+			newChanges++;
+			// remove entry from the current snapshot and track list
+			FIT_RemoveFromSnapshotFileEntryList(snapshot, entry);
+			FIT_RemoveFromTrackList(ctx, tracked);
+		}
+		else {
+
+			if (entry->inSnapshot) {
+				FIT_Base64Digest digest = {0};
+				result = FIT_HashBuffer(&digest, entry->buffer, entry->bufferLen);
+				FIT_ASSERT_LOG_RETURN(result, "TODO");
+
+				// if the hash changes then we need to save the new buffer
+				if (strncmp(digest.buffer, entry->hash.buffer, FIT_MAX_PATH) != 0) {
+
+					memcpy(entry->hash.buffer, digest.buffer, FIT_BASE64_DIGEST_SIZE);
+
+					entry->offset = ctx->fsData.bufferCount;
+					ctx->fsData.bufferCount += entry->bufferLen;
+					entry->offsetLen = entry->bufferLen;
+
+					uint64_t statsStart = FIT_StatsBegin();
+					char *newBuffer = realloc(ctx->fsData.buffer, ctx->fsData.bufferCount);
+					FIT_ASSERT_LOG_RETURN(newBuffer, "TODO");
+					FIT_StatsEnd(FIT_PHASE_GROW_BUFFER, statsStart);
+					ctx->fsData.buffer = newBuffer;
+					memcpy(&ctx->fsData.buffer[entry->offset], entry->buffer, entry->offsetLen);
+
+					FIT_LOG(" - A file [*%s] has changed since the last snapshot. It's new contents will be added to the store.", entry->path);
+					newChanges++;
+				}
+			}
+			else {
+				result = FIT_HashBuffer(&entry->hash, entry->buffer, entry->bufferLen);
+				FIT_ASSERT_LOG_RETURN(result, "TODO");
+
+				entry->offset = ctx->fsData.bufferCount;
+				ctx->fsData.bufferCount += entry->bufferLen;
+				entry->offsetLen = entry->bufferLen;
+				entry->inSnapshot = 1;
+
+				uint64_t statsStart = FIT_StatsBegin();
+				char *newBuffer = realloc(ctx->fsData.buffer, ctx->fsData.bufferCount);
+				FIT_ASSERT_LOG_RETURN(newBuffer, "TODO");
+				FIT_StatsEnd(FIT_PHASE_GROW_BUFFER, statsStart);
+				ctx->fsData.buffer = newBuffer;
+				memcpy(&ctx->fsData.buffer[entry->offset], entry->buffer, entry->offsetLen);
+			}
+
+			// The contents are in the store buffer now, no need to hold every file in memory twice.
+			free(entry->buffer);
+			entry->buffer = NULL;
+
+			memcpy(tracked->hash.buffer, entry->hash.buffer, FIT_BASE64_DIGEST_SIZE);
+			tracked->offset = entry->offset;
+			tracked->offsetLen = entry->offsetLen;
+			tracked->modifiedTime = entry->modifiedTime;
+		}
+
+		FIT_TraceEnd("save file", traceStart, entry->path);
+		FIT_OperationFileDone(ctx, entry->bufferLen);
+		entry = entryNext;
+		tracked = trackedNext;
+	}
+
+	snapshot->savedTime = (uint64_t)time(NULL);
+	FIT_AddToSnapshotList(ctx, snapshot);
+
+	result = FIT_HistoryIndexAddSnapshot(&ctx->history, snapshot);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to index the new snapshot.");
+
+	return 1;
+}
+
+#ifndef _WIN32
+static volatile sig_atomic_t FIT_stopRequested = 0;
+
+static void FIT_StopSignalHandler(int signal) {
+	(void)signal;
+	FIT_stopRequested = 1;
+}
+
+// Ctrl+C and kill set FIT_stopRequested and interrupt whatever call is blocking, so long
+// running commands can finish what they are doing and clean up.
+static void FIT_InstallStopHandlers(void) {
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = FIT_StopSignalHandler;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+}
+
+static int FIT_WriteAll(int fd, const void *data, size_t len) {
+	const char *bytes = (const char *)data;
+	while (len) {
+		ssize_t written = write(fd, bytes, len);
+		if (written < 0 && errno == EINTR) {
+			continue;
+		}
+		if (written <= 0) {
+			return 0;
+		}
+		bytes += written;
+		len -= (size_t)written;
+	}
+	return 1;
+}
+
+static int FIT_ReadAll(int fd, void *data, size_t len) {
+	char *bytes = (char *)data;
+	while (len) {
+		ssize_t read = recv(fd, bytes, len, 0);
+		if (read < 0 && errno == EINTR) {
+			continue;
+		}
+		if (read <= 0) {
+			return 0;
+		}
+		bytes += read;
+		len -= (size_t)read;
+	}
+	return 1;
+}
+
+static int FIT_SendFrame(int fd, const void *data, uint32_t len) {
+	return FIT_WriteAll(fd, &len, sizeof(uint32_t)) && FIT_WriteAll(fd, data, len);
+}
+
+// [data] is NUL terminated so string payloads can be used in place.
+static int FIT_ReceiveFrame(int fd, char **data, uint32_t *len, uint32_t maxLen) {
+	*data = NULL;
+	if (!FIT_ReadAll(fd, len, sizeof(uint32_t)) || *len > maxLen) {
+		return 0;
+	}
+	*data = (char *)malloc((size_t)*len + 1);
+	if (!*data) {
+		return 0;
+	}
+	if (!FIT_ReadAll(fd, *data, *len)) {
+		free(*data);
+		*data = NULL;
+		return 0;
+	}
+	(*data)[*len] = '\0';
+	return 1;
+}
+
+static int FIT_GetServeSocketAddress(const char *fileStoreStr, struct sockaddr_un *address) {
+	FIT_Path fileStorePath = {0};
+	int result = FIT_GetAbsolutePath(&fileStorePath, fileStoreStr);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to find file store [%s]. Does it exist?", fileStoreStr);
+
+	memset(address, 0, sizeof(struct sockaddr_un));
+	address->sun_family = AF_UNIX;
+	int len = snprintf(address->sun_path, sizeof(address->sun_path), "%s%s", fileStorePath.buffer, FIT_SERVE_SOCKET_SUFFIX);
+	FIT_ASSERT_LOG_RETURN(len > 0 && (size_t)len < sizeof(address->sun_path), "The path of file store [%s] is too long for a socket.", fileStorePath.buffer);
+	return 1;
+}
+
+static int FIT_GetStoreStat(const char *path, struct stat *st) {
+	memset(st, 0, sizeof(struct stat));
+	return stat(path, st) == 0;
+}
+
+static int FIT_StoreStatChanged(const struct stat *a, const struct stat *b) {
+#ifdef __APPLE__
+	int timeChanged = a->st_mtimespec.tv_sec != b->st_mtimespec.tv_sec || a->st_mtimespec.tv_nsec != b->st_mtimespec.tv_nsec;
+#else
+	int timeChanged = a->st_mtim.tv_sec != b->st_mtim.tv_sec || a->st_mtim.tv_nsec != b->st_mtim.tv_nsec;
+#endif
+	return timeChanged || a->st_ino != b->st_ino || a->st_size != b->st_size;
+}
+
+typedef struct FIT_ServeState {
+	FIT_Path fileStorePath;
+	struct stat loadedStat;
+	uint32_t loadedEntryCount;
+} FIT_ServeState;
+
+static int FIT_ServeLoad(FIT_Context *ctx, FIT_ServeState *state) {
+	FIT_ContextDeinit(ctx);
+	FIT_ContextInit(ctx);
+	ctx->nonInteractive = 1;
+
+	// Taken first, so a write that lands during the load is picked up by the next request.
+	FIT_GetStoreStat(state->fileStorePath.buffer, &state->loadedStat);
+
+	int result = FIT_LoadFileStoreAndSetWorkingDirectory(ctx, state->fileStorePath.buffer);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to load file store [%s].", state->fileStorePath.buffer);
+
+	state->loadedEntryCount = ctx->entryPoolCount;
+	return 1;
+}
+
+// Runs one request with stdout going into [output], so every command can be served as is.
+static int FIT_ServeRequest(FIT_Context *ctx, FIT_ServeState *state, char *request, uint32_t requestLen, FILE *output) {
+	char *argv[256];
+	int argc = 0;
+	argv[argc++] = (char *)"fit";
+
+	const char *clientDirectory = request;
+	for (uint32_t i = (uint32_t)strlen(request) + 1; i < requestLen && argc < 255; i += (uint32_t)strlen(&request[i]) + 1) {
+		argv[argc++] = &request[i];
+	}
+	argv[argc] = NULL;
+
+	fflush(stdout);
+	int savedStdout = dup(STDOUT_FILENO);
+	FIT_ASSERT_LOG_RETURN(savedStdout != -1, "Unable to redirect the output of a request.");
+	dup2(fileno(output), STDOUT_FILENO);
+
+	int result = 0;
+	FIT_Path requestStorePath = {0};
+	struct stat currentStat;
+	if (chdir(clientDirectory) != 0) {
+		FIT_LOG("Unable to change to the directory of the client [%s].", clientDirectory);
+	}
+	else if (argc < 3 || !FIT_GetAbsolutePath(&requestStorePath, argv[2]) || strcmp(requestStorePath.buffer, state->fileStorePath.buffer) != 0) {
+		FIT_LOG("This server only runs commands on the file store [%s].", state->fileStorePath.buffer);
+	}
+	else if (!FIT_GetStoreStat(state->fileStorePath.buffer, &currentStat) ||
+			 (FIT_StoreStatChanged(&currentStat, &state->loadedStat) && !FIT_ServeLoad(ctx, state))) {
+		FIT_LOG("The file store [%s] changed and could not be loaded again.", state->fileStorePath.buffer);
+	}
+	else {
+		result = FIT_Run(ctx, argc, argv);
+	}
+
+	// A failed command can leave the context half changed, so it starts again from what is on
+	// disk. Otherwise the store is only different if the command saved it.
+	if (!result || ctx->entryPoolCount - state->loadedEntryCount > FIT_SERVE_MAX_SCRATCH_ENTRIES) {
+		FIT_ServeLoad(ctx, state);
+	}
+	else {
+		FIT_GetStoreStat(state->fileStorePath.buffer, &state->loadedStat);
+	}
+
+	fflush(stdout);
+	dup2(savedStdout, STDOUT_FILENO);
+	close(savedStdout);
+
+	// Patterns can change between requests.
+	FIT_IgnoreMatcherDeinit(&ctx->ignore);
+
+	return result;
+}
+#endif
+
+int FIT_Serve(FIT_Context *ctx, const char *fileStoreStr) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(fileStoreStr);
+
+#ifdef _WIN32
+	FIT_ASSERT_LOG_RETURN(0, "Serving a file store needs Unix domain sockets, which are not supported on Windows yet.");
+#else
+	FIT_ServeState state;
+	memset(&state, 0, sizeof(state));
+	int result = FIT_GetAbsolutePath(&state.fileStorePath, fileStoreStr);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to find file store [%s]. Does it exist?", fileStoreStr);
+
+	struct sockaddr_un address;
+	result = FIT_GetServeSocketAddress(state.fileStorePath.buffer, &address);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to serve file store [%s].", fileStoreStr);
+
+	result = FIT_ServeLoad(ctx, &state);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to serve file store [%s].", fileStoreStr);
+
+	int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	FIT_ASSERT_LOG_RETURN(listenFd != -1, "Unable to create a socket.");
+
+	result = bind(listenFd, (struct sockaddr *)&address, sizeof(address)) == 0;
+	if (!result && errno == EADDRINUSE) {
+		// Left behind by a server that did not shut down, unless one still answers.
+		int probeFd = socket(AF_UNIX, SOCK_STREAM, 0);
+		int inUse = probeFd != -1 && connect(probeFd, (struct sockaddr *)&address, sizeof(address)) == 0;
+		if (probeFd != -1) {
+			close(probeFd);
+		}
+		if (!inUse) {
+			unlink(address.sun_path);
+			result = bind(listenFd, (struct sockaddr *)&address, sizeof(address)) == 0;
+		}
+	}
+	if (!result || listen(listenFd, 16) != 0) {
+		close(listenFd);
+		FIT_ASSERT_LOG_RETURN(0, "Unable to listen on [%s]. Is the file store already being served?", address.sun_path);
+	}
+
+	FIT_InstallStopHandlers();
+	signal(SIGPIPE, SIG_IGN);
+
+	FIT_LOG("Serving [%s] on [%s].", state.fileStorePath.buffer, address.sun_path);
+
+	int stop = 0;
+	while (!stop && !FIT_stopRequested) {
+		int clientFd = accept(listenFd, NULL, NULL);
+		if (clientFd == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			FIT_LOG("Unable to accept a client [%d].", errno);
+			break;
+		}
+
+		struct timeval timeout = {0};
+		timeout.tv_sec = FIT_SERVE_FRAME_TIMEOUT_SECONDS;
+		if (setsockopt(clientFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0 ||
+			setsockopt(clientFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) != 0) {
+			FIT_LOG("Unable to set a timeout on a client [%d].", errno);
+			close(clientFd);
+			continue;
+		}
+
+		char *request = NULL;
+		uint32_t requestLen = 0;
+		if (!FIT_ReceiveFrame(clientFd, &request, &requestLen, FIT_SERVE_MAX_REQUEST_SIZE) || !requestLen) {
+			free(request);
+			close(clientFd);
+			continue;
+		}
+
+		FILE *output = tmpfile();
+		int32_t commandResult = 0;
+
+		size_t directoryLen = strlen(request);
+		const char *command = directoryLen + 1 < requestLen ? &request[directoryLen + 1] : "";
+		if (!output) {
+			FIT_LOG("Unable to create a file for the output of a request.");
+		}
+		else if (strcmp(command, "stop") == 0) {
+			fprintf(output, "Stopped serving [%s].\n", state.fileStorePath.buffer);
+			commandResult = 1;
+			stop = 1;
+		}
+		else {
+			commandResult = FIT_ServeRequest(ctx, &state, request, requestLen, output);
+		}
+		free(request);
+
+		char *outputBuffer = NULL;
+		int64_t outputLen = 0;
+		if (output) {
+			outputLen = FIT_FSEEK(output, 0, SEEK_END) == 0 ? FIT_FTELL(output) : -1;
+			outputBuffer = outputLen > 0 && outputLen < UINT32_MAX ? (char *)malloc((size_t)outputLen) : NULL;
+			if (!outputBuffer || FIT_FSEEK(output, 0, SEEK_SET) != 0 || fread(outputBuffer, (size_t)outputLen, 1, output) != 1) {
+				outputLen = 0;
+			}
+			fclose(output);
+		}
+
+		FIT_SendFrame(clientFd, outputBuffer, (uint32_t)outputLen);
+		FIT_SendFrame(clientFd, &commandResult, sizeof(int32_t));
+		free(outputBuffer);
+		close(clientFd);
+	}
+
+	close(listenFd);
+	unlink(address.sun_path);
+	FIT_LOG("Stopped serving [%s].", state.fileStorePath.buffer);
+
+	return 1;
+#endif
+}
+
+int FIT_RunClient(int argc, char *argv[]) {
+	FIT_SHOULD_NOT_BE_NULL(argv);
+
+#ifdef _WIN32
+	FIT_ASSERT_LOG_RETURN(0, "Serving a file store needs Unix domain sockets, which are not supported on Windows yet.");
+#else
+	FIT_ASSERT_LOG_RETURN(argc >= 2, "Usage: fit client <command> <fileStore> [arguments...]");
+
+	struct sockaddr_un address;
+	int result = FIT_GetServeSocketAddress(argv[1], &address);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to find the server of file store [%s].", argv[1]);
+
+	FIT_Path clientDirectory = {0};
+	FIT_ASSERT_LOG_RETURN(getcwd(clientDirectory.buffer, FIT_MAX_PATH), "Unable to get the current directory.");
+
+	size_t requestLen = strlen(clientDirectory.buffer) + 1;
+	for (int i = 0; i < argc; i++) {
+		requestLen += strlen(argv[i]) + 1;
+	}
+	FIT_ASSERT_LOG_RETURN(requestLen <= FIT_SERVE_MAX_REQUEST_SIZE, "The command is too long to send to the server.");
+
+	char *request = (char *)malloc(requestLen);
+	FIT_ASSERT_LOG_RETURN(request, "Out of memory. Unable to allocate the request.");
+	size_t offset = 0;
+	for (int i = -1; i < argc; i++) {
+		const char *str = i < 0 ? clientDirectory.buffer : argv[i];
+		size_t len = strlen(str) + 1;
+		memcpy(&request[offset], str, len);
+		offset += len;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+		if (fd != -1) {
+			close(fd);
+		}
+		free(request);
+		FIT_ASSERT_LOG_RETURN(0, "Unable to connect to [%s]. Is \"fit serve %s\" running?", address.sun_path, argv[1]);
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	result = FIT_SendFrame(fd, request, (uint32_t)requestLen);
+	free(request);
+
+	char *output = NULL;
+	uint32_t outputLen = 0;
+	char *commandResult = NULL;
+	uint32_t commandResultLen = 0;
+	result = result &&
+		FIT_ReceiveFrame(fd, &output, &outputLen, UINT32_MAX - 1) &&
+		FIT_ReceiveFrame(fd, &commandResult, &commandResultLen, sizeof(int32_t));
+	close(fd);
+
+	int32_t value = 0;
+	if (result) {
+		fwrite(output, 1, outputLen, stdout);
+		fflush(stdout);
+		result = commandResultLen == sizeof(int32_t);
+		if (result) {
+			memcpy(&value, commandResult, sizeof(int32_t));
+		}
+	}
+	free(output);
+	free(commandResult);
+	FIT_ASSERT_LOG_RETURN(result, "The server of [%s] did not answer.", argv[1]);
+
+	return value;
+#endif
+}
+
+#ifdef __linux__
+typedef struct FIT_WatchState {
+	FIT_Path fileStorePath;
+	struct stat savedStat;
+	int fd;
+	char **directories; // relative directory of each watch descriptor, NULL when not watched
+	uint32_t directoryCount;
+	FIT_PathTable trackedPaths;
+	uint32_t dirtyCount;
+} FIT_WatchState;
+
+static void FIT_WatchMarkDirty(FIT_WatchState *state, FIT_FileEntry *entry) {
+	if (!entry->dirty) {
+		entry->dirty = 1;
+		state->dirtyCount++;
+	}
+}
+
+// A NULL [dir] marks every tracked file, for when events were lost.
+static void FIT_WatchMarkDirectoryDirty(FIT_Context *ctx, FIT_WatchState *state, const char *dir) {
+	size_t dirLen = dir ? strlen(dir) : 0;
+	for (FIT_FileEntry *entry = ctx->fsData.entryTrackingHead;
+		 entry != NULL;
+		 entry = entry->trackNext) {
+		if (!dirLen || FIT_PathMatchesPrefix(entry->path, entry->pathLen, dir, dirLen)) {
+			FIT_WatchMarkDirty(state, entry);
+		}
+	}
+}
+
+static int FIT_WatchDirectory(FIT_Context *ctx, FIT_WatchState *state, const char *relPath, size_t relDirLen) {
+	char *dir = (char *)malloc(relDirLen + 1);
+	FIT_ASSERT_LOG_RETURN(dir, "Out of memory. Unable to allocate path.");
+	memcpy(dir, relPath, relDirLen);
+	dir[relDirLen] = '\0';
+
+	char *path = FIT_AllocateWorkingPath(ctx, dir);
+	int wd = path ? inotify_add_watch(state->fd, path, IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE |
+		IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR) : -1;
+	free(path);
+
+	if (wd < 0) {
+		free(dir);
+		return 0;
+	}
+
+	if ((uint32_t)wd >= state->directoryCount) {
+		uint32_t count = state->directoryCount ? state->directoryCount : 64;
+		while (count <= (uint32_t)wd) {
+			count *= 2;
+		}
+		char **directories = (char **)realloc(state->directories, count * sizeof(char *));
+		if (!directories) {
+			free(dir);
+			FIT_ASSERT_LOG_RETURN(0, "Out of memory. Unable to watch directory [%d].", wd);
+		}
+		memset(&directories[state->directoryCount], 0, (count - state->directoryCount) * sizeof(char *));
+		state->directories = directories;
+		state->directoryCount = count;
+	}
+
+	// Watching a directory again gives back the same descriptor.
+	if (state->directories[wd]) {
+		free(dir);
+	}
+	else {
+		state->directories[wd] = dir;
+	}
+	return 1;
+}
+
+// Indexes the tracking list and watches every directory with a tracked file in it.
+static int FIT_WatchTrackedFiles(FIT_Context *ctx, FIT_WatchState *state) {
+	FIT_PathTableDeinit(&state->trackedPaths);
+	int result = FIT_PathTableInit(&state->trackedPaths, ctx->fsData.trackingCount);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to index the tracked files.");
+
+	const char *lastDir = NULL;
+	size_t lastDirLen = 0;
+	int lastWatched = 0;
+
+	for (FIT_FileEntry *entry = ctx->fsData.entryTrackingHead;
+		 entry != NULL;
+		 entry = entry->trackNext) {
+
+		result = FIT_PathTableInsert(&state->trackedPaths, entry);
+		FIT_ASSERT_LOG_RETURN(result, "Unable to index [%s].", entry->path);
+
+		size_t dirLen = (size_t)(FIT_GetFileName(entry->path, entry->pathLen) - entry->path);
+
+		// Files of a directory are usually next to each other in the list.
+		if (!lastDir || dirLen != lastDirLen || memcmp(entry->path, lastDir, dirLen) != 0) {
+			lastDir = entry->path;
+			lastDirLen = dirLen;
+			lastWatched = FIT_WatchDirectory(ctx, state, entry->path, dirLen);
+		}
+
+		// Without a directory there is nothing to tell when the file comes back, so the
+		// next snapshot has to look.
+		if (!lastWatched) {
+			FIT_WatchMarkDirty(state, entry);
+		}
+	}
+
+	return 1;
+}
+
+// Returns 1 when the event was about tracked files, other files in the directories do not
+// hold back a snapshot.
+static int FIT_WatchHandleEvent(FIT_Context *ctx, FIT_WatchState *state, const struct inotify_event *event, char *relPath) {
+	if (event->mask & IN_Q_OVERFLOW) {
+		FIT_WatchMarkDirectoryDirty(ctx, state, NULL);
+		return 1;
+	}
+	if (event->wd < 0 || (uint32_t)event->wd >= state->directoryCount || !state->directories[event->wd]) {
+		return 0;
+	}
+
+	char *dir = state->directories[event->wd];
+	if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+		// Everything in it went with it.
+		FIT_WatchMarkDirectoryDirty(ctx, state, dir[0] ? dir : NULL);
+		if (event->mask & IN_IGNORED) {
+			free(dir);
+			state->directories[event->wd] = NULL;
+		}
+		return 1;
+	}
+	if (!event->len) {
+		return 0;
+	}
+
+	size_t dirLen = strlen(dir);
+	size_t nameLen = strnlen(event->name, event->len);
+	if (dirLen + nameLen >= FIT_MAX_ENTRY_PATH) {
+		return 0;
+	}
+	memcpy(relPath, dir, dirLen);
+	memcpy(&relPath[dirLen], event->name, nameLen);
+
+	FIT_FileEntry *entry = FIT_PathTableFind(&state->trackedPaths, relPath, dirLen + nameLen);
+	if (!entry) {
+		return 0;
+	}
+	FIT_WatchMarkDirty(state, entry);
+	return 1;
+}
+
+static int FIT_WatchLoad(FIT_Context *ctx, FIT_WatchState *state) {
+	FIT_ContextDeinit(ctx);
+	FIT_ContextInit(ctx);
+
+	FIT_GetStoreStat(state->fileStorePath.buffer, &state->savedStat);
+
+	int result = FIT_LoadFileStoreAndSetWorkingDirectory(ctx, state->fileStorePath.buffer);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to load file store [%s].", state->fileStorePath.buffer);
+	return 1;
+}
+
+static int FIT_WatchSave(FIT_Context *ctx, FIT_WatchState *state) {
+	int result = 0;
+
+	// When something else saved the store, its snapshot is the one to build on, and nothing
+	// is known about which of its files are dirty.
+	int reloaded = 0;
+	struct stat currentStat;
+	if (!FIT_GetStoreStat(state->fileStorePath.buffer, &currentStat) || FIT_StoreStatChanged(&currentStat, &state->savedStat)) {
+		result = FIT_WatchLoad(ctx, state);
+		FIT_ASSERT_LOG_RETURN(result, "The file store [%s] changed and could not be loaded again.", state->fileStorePath.buffer);
+		reloaded = 1;
+	}
+
+	uint32_t dirtyCount = reloaded ? ctx->fsData.trackingCount : state->dirtyCount;
+
+	ctx->trustCleanEntries = !reloaded;
+	result = FIT_PrepareSnapshotForSave(ctx);
+	result = result && FIT_SaveFileStoreFromFile(ctx, state->fileStorePath.buffer);
+	ctx->trustCleanEntries = 0;
+
+	if (result) {
+		FIT_GetStoreStat(state->fileStorePath.buffer, &state->savedStat);
+		FIT_LOG("Saved snapshot [%u] after %u files changed.", ctx->fsData.snapshotCount - 1, dirtyCount);
+	}
+	else {
+		// The context can be half way through the save, start again from what is on disk.
+		FIT_WatchLoad(ctx, state);
+	}
+
+	for (FIT_FileEntry *entry = ctx->fsData.entryTrackingHead;
+		 entry != NULL;
+		 entry = entry->trackNext) {
+		entry->dirty = 0;
+	}
+	state->dirtyCount = 0;
+
+	// Tracked files can be gone, and their directories with them.
+	int watched = FIT_WatchTrackedFiles(ctx, state);
+	FIT_ASSERT_LOG_RETURN(result && watched, "Unable to save a snapshot of [%s].", state->fileStorePath.buffer);
+	return 1;
+}
+
+// Files changed while nothing was watching are found the way status finds them.
+static int FIT_WatchMarkChangedSinceSnapshot(FIT_Context *ctx, FIT_WatchState *state) {
+	FIT_Status status = {0};
+	int result = FIT_GetStatus(ctx, 0, &status);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to compare the tracked files with the latest snapshot.");
+
+	for (uint32_t i = 0; i < status.itemCount; i++) {
+		FIT_FileEntry *entry = FIT_PathTableFind(&state->trackedPaths, status.items[i].path, strlen(status.items[i].path));
+		if (entry) {
+			FIT_WatchMarkDirty(state, entry);
+		}
+	}
+
+	FIT_StatusDeinit(&status);
+	return 1;
+}
+#endif
+
+int FIT_Watch(FIT_Context *ctx, const char *fileStoreStr, uint32_t quietMilliseconds) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(fileStoreStr);
+
+#ifndef __linux__
+	FIT_ASSERT_LOG_RETURN(0, "Watching a file store needs inotify, which is only on Linux.");
+#else
+	FIT_WatchState state;
+	memset(&state, 0, sizeof(state));
+
+	int result = FIT_GetAbsolutePath(&state.fileStorePath, fileStoreStr);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to find file store [%s]. Does it exist?", fileStoreStr);
+
+	result = FIT_WatchLoad(ctx, &state);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to watch file store [%s].", fileStoreStr);
+	FIT_ASSERT_LOG_RETURN(ctx->fsData.trackingCount, "The file store [%s] is not tracking any files to watch.", fileStoreStr);
+
+	state.fd = inotify_init1(IN_CLOEXEC);
+	FIT_ASSERT_LOG_RETURN(state.fd != -1, "Unable to start watching files [%d].", errno);
+
+	char *relPath = (char *)calloc(FIT_MAX_ENTRY_PATH, sizeof(char));
+	const size_t eventBufferSize = 64 * 1024;
+	char *eventBuffer = (char *)malloc(eventBufferSize);
+
+	result = relPath && eventBuffer &&
+		FIT_WatchTrackedFiles(ctx, &state) &&
+		FIT_WatchMarkChangedSinceSnapshot(ctx, &state);
+
+	if (result) {
+		FIT_InstallStopHandlers();
+		FIT_LOG("Watching %u tracked files of [%s]. A snapshot is saved %u ms after the last change.", ctx->fsData.trackingCount, state.fileStorePath.buffer, quietMilliseconds);
+		fflush(stdout);
+	}
+
+	uint64_t lastEventTime = FIT_GetTimeNanoseconds();
+	while (result && !FIT_stopRequested) {
+
+		int timeout = -1;
+		if (state.dirtyCount) {
+			uint64_t quietFor = (FIT_GetTimeNanoseconds() - lastEventTime) / 1000000;
+			timeout = quietFor >= quietMilliseconds ? 0 : (int)(quietMilliseconds - quietFor);
+		}
+
+		struct pollfd pollFd = {0};
+		pollFd.fd = state.fd;
+		pollFd.events = POLLIN;
+		int ready = poll(&pollFd, 1, timeout);
+		if (ready < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			FIT_LOG("Unable to wait for changes [%d].", errno);
+			break;
+		}
+
+		if (ready) {
+			ssize_t len = read(state.fd, eventBuffer, eventBufferSize);
+			int tracked = 0;
+			for (ssize_t offset = 0; offset < len;) {
+				const struct inotify_event *event = (const struct inotify_event *)&eventBuffer[offset];
+				tracked |= FIT_WatchHandleEvent(ctx, &state, event, relPath);
+				offset += (ssize_t)(sizeof(struct inotify_event) + event->len);
+			}
+			// A log or build output written all the time next to tracked files would otherwise
+			// keep the snapshot waiting forever.
+			if (tracked) {
+				lastEventTime = FIT_GetTimeNanoseconds();
+			}
+			continue;
+		}
+
+		// Quiet for long enough, a failed save is logged and tried again after the next change.
+		FIT_WatchSave(ctx, &state);
+		fflush(stdout);
+	}
+
+	// Changes that have not had their quiet period yet are still worth keeping.
+	if (result && state.dirtyCount) {
+		FIT_WatchSave(ctx, &state);
+	}
+
+	for (uint32_t i = 0; i < state.directoryCount; i++) {
+		free(state.directories[i]);
+	}
+	free(state.directories);
+	FIT_PathTableDeinit(&state.trackedPaths);
+	free(eventBuffer);
+	free(relPath);
+	close(state.fd);
+
+	FIT_ASSERT_LOG_RETURN(result, "Unable to watch file store [%s].", fileStoreStr);
+	FIT_LOG("Stopped watching [%s].", state.fileStorePath.buffer);
+	return 1;
+#endif
+}
+
+// Splits [line] in place into arguments separated by spaces or tabs. Double quotes keep
+// spaces in an argument and a backslash in quotes escapes the next char. Returns -1 when
+// the line cannot be split.
+static int FIT_SplitCommandLine(char *line, char **args, int maxArgs) {
+	int argCount = 0;
+	char *read = line;
+	while (*read) {
+		while (*read == ' ' || *read == '\t') {
+			read++;
+		}
+		if (!*read) {
+			break;
+		}
+		if (argCount == maxArgs) {
+			FIT_LOG("There are more than %d arguments.", maxArgs);
+			return -1;
+		}
+
+		char *write = read;
+		args[argCount++] = write;
+		int quoted = 0;
+		while (*read && (quoted || (*read != ' ' && *read != '\t'))) {
+			if (*read == '"') {
+				quoted = !quoted;
+				read++;
+			}
+			else if (quoted && *read == '\\' && read[1]) {
+				*write++ = read[1];
+				read += 2;
+			}
+			else {
+				*write++ = *read++;
+			}
+		}
+		if (quoted) {
+			FIT_LOG("A quote is not closed.");
+			return -1;
+		}
+		if (*read) {
+			read++;
+		}
+		*write = '\0';
+	}
+	return argCount;
+}
+
+int FIT_RunBatch(FIT_Context *ctx, const char *fileStoreStr, FILE *script) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(fileStoreStr);
+	FIT_SHOULD_NOT_BE_NULL(script);
+
+	int result = FIT_LoadFileStoreAndSetWorkingDirectory(ctx, fileStoreStr);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to load file store [%s]. Does it exist?", fileStoreStr);
+
+	ctx->nonInteractive = 1;
+	ctx->deferSave = 1;
+
+	const size_t lineSize = FIT_MAX_ENTRY_PATH + 1024;
+	char *line = (char *)malloc(lineSize);
+	FIT_ASSERT_LOG_RETURN(line, "Out of memory. Unable to allocate a line.");
+
+	uint32_t lineNumber = 0;
+	uint32_t commandCount = 0;
+	while (result && fgets(line, (int)lineSize, script)) {
+		lineNumber++;
+
+		size_t len = strlen(line);
+		if (len == lineSize - 1 && line[len - 1] != '\n' && !feof(script)) {
+			FIT_LOG("Line %u is longer than %u chars.", lineNumber, (uint32_t)lineSize - 2);
+			result = 0;
+			break;
+		}
+		while (len && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+			line[--len] = '\0';
+		}
+
+		// The store goes in front of the arguments of every command.
+		char *argv[FIT_BATCH_MAX_ARGS + 3];
+		int argCount = FIT_SplitCommandLine(line, &argv[2], FIT_BATCH_MAX_ARGS);
+		if (argCount < 0) {
+			FIT_LOG("Unable to read the command on line %u.", lineNumber);
+			result = 0;
+			break;
+		}
+		if (argCount == 0 || argv[2][0] == '#') {
+			continue;
+		}
+
+		argv[0] = (char *)"fit";
+		argv[1] = argv[2];
+		argv[2] = (char *)fileStoreStr;
+		argv[argCount + 2] = NULL;
+
+		result = FIT_Run(ctx, argCount + 2, argv);
+		if (!result) {
+			FIT_LOG("The command [%s] on line %u failed.", argv[1], lineNumber);
+		}
+		commandCount++;
+	}
+	free(line);
+
+	ctx->deferSave = 0;
+
+	// Nothing is written unless every command worked, the store is as it was before the batch.
+	FIT_ASSERT_LOG_RETURN(result && !ferror(script), "Stopped the batch, the file store [%s] has not been changed.", fileStoreStr);
+
+	int saved = ctx->savePending;
+	if (saved) {
+		result = FIT_SaveFileStoreFromFile(ctx, ctx->fileStoreAbsolutePath.buffer);
+		FIT_ASSERT_LOG_RETURN(result, "Unable to save the file store [%s].", ctx->fileStoreAbsolutePath.buffer);
+		ctx->savePending = 0;
+	}
+
+	FIT_LOG("Ran %u commands, %s.", commandCount, saved ? "the file store was saved once" : "nothing needed saving");
+	return 1;
+}
+
+static int FIT_RunSaveOperation(FIT_Operation *operation) {
+	FIT_Context *ctx = operation->ctx;
+	const char *fileStoreStr = operation->fileStorePath.buffer;
+
+	int result = FIT_LoadFileStoreAndSetWorkingDirectory(ctx, fileStoreStr);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to load file store [%s]. Does it exist?", fileStoreStr);
+
+	result = FIT_PrepareSnapshotForSave(ctx);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to snapshot the tracked files.");
+
+	result = FIT_SaveFileStoreFromFile(ctx, ctx->fileStoreAbsolutePath.buffer);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to save file store [%s].", fileStoreStr);
+
+	return 1;
+}
+
+static int FIT_RunLoadOperation(FIT_Operation *operation) {
+	FIT_Context *ctx = operation->ctx;
+	const char *fileStoreStr = operation->fileStorePath.buffer;
+
+	int result = FIT_SetWorkingDirectoryFromFileStore(ctx, fileStoreStr);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to find file store [%s]. Does it exist?", fileStoreStr);
+
+	result = FIT_LoadFileStoreMetadataFromFile(ctx, fileStoreStr);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to load file store [%s]. Does it exist?", fileStoreStr);
+
+	FIT_Snapshot *snapshot = operation->snapshotIndex < 0 ? ctx->fsData.snapshotTail : FIT_GetSnapshotByIndex(ctx, operation->snapshotIndex);
+	FIT_ASSERT_LOG_RETURN(snapshot, "There is no snapshot [%ld] in the file store [%s] to load.", operation->snapshotIndex, fileStoreStr);
+
+	FIT_RestorePlan plan = {0};
+	result = FIT_PlanRestore(ctx, snapshot, &plan);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to compare the snapshot with the working directory.");
+
+	result = FIT_RestoreSnapshot(ctx, snapshot);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to load the snapshot.");
+
+	return 1;
+}
+
+static void FIT_SaveOperationProc(void *arg) {
+	FIT_Operation *operation = (FIT_Operation *)arg;
+	int result = FIT_RunSaveOperation(operation);
+	operation->state = result ? FIT_OPERATION_SUCCEEDED : operation->cancelRequested ? FIT_OPERATION_CANCELLED : FIT_OPERATION_FAILED;
+	FIT_ReportOperationProgress(operation, 1);
+}
+
+static void FIT_LoadOperationProc(void *arg) {
+	FIT_Operation *operation = (FIT_Operation *)arg;
+	int result = FIT_RunLoadOperation(operation);
+	operation->state = result ? FIT_OPERATION_SUCCEEDED : operation->cancelRequested ? FIT_OPERATION_CANCELLED : FIT_OPERATION_FAILED;
+	FIT_ReportOperationProgress(operation, 1);
+}
+
+static FIT_Operation *FIT_StartOperation(FIT_Context *ctx, const char *fileStoreStr, long int snapshotIndex, FIT_ThreadProc threadProc, FIT_ProgressProc proc, void *user) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(fileStoreStr);
+
+	// Anything that would abort has to be refused here, not on the thread.
+	FIT_ASSERT_LOG_RETURN(!ctx->operation, "The context is already running an operation.");
+	FIT_ASSERT_LOG_RETURN(!ctx->storeLoaded && !ctx->fileStore && !ctx->blobStore, "An operation needs a context that has not loaded a file store.");
+
+	size_t fileStoreStrLen = strnlen(fileStoreStr, FIT_MAX_PATH);
+	FIT_ASSERT_LOG_RETURN(fileStoreStrLen && fileStoreStrLen < FIT_MAX_PATH, "The file store path [%s] is empty or too long.", fileStoreStr);
+
+	FIT_Operation *operation = (FIT_Operation *)calloc(1, sizeof(FIT_Operation));
+	FIT_ASSERT_LOG_RETURN(operation, "Out of memory. Unable to allocate the operation.");
+
+	operation->ctx = ctx;
+	memcpy(operation->fileStorePath.buffer, fileStoreStr, fileStoreStrLen + 1);
+	operation->snapshotIndex = snapshotIndex;
+	operation->proc = proc;
+	operation->user = user;
+	operation->state = FIT_OPERATION_RUNNING;
+	operation->startTime = FIT_GetTimeNanoseconds();
+
+	ctx->operation = operation;
+	if (!FIT_ThreadCreate(&operation->thread, threadProc, operation)) {
+		ctx->operation = NULL;
+		free(operation);
+		FIT_ASSERT_LOG_RETURN(0, "Unable to start a thread for the operation.");
+	}
+
+	return operation;
+}
+
+FIT_Operation *FIT_StartSave(FIT_Context *ctx, const char *fileStoreStr, FIT_ProgressProc proc, void *user) {
+	return FIT_StartOperation(ctx, fileStoreStr, 0, FIT_SaveOperationProc, proc, user);
+}
+
+FIT_Operation *FIT_StartLoad(FIT_Context *ctx, const char *fileStoreStr, long int snapshotIndex, FIT_ProgressProc proc, void *user) {
+	return FIT_StartOperation(ctx, fileStoreStr, snapshotIndex, FIT_LoadOperationProc, proc, user);
+}
+
+void FIT_CancelOperation(FIT_Operation *operation) {
+	FIT_SHOULD_NOT_BE_NULL(operation);
+	operation->cancelRequested = 1;
+}
+
+FIT_OperationState FIT_FinishOperation(FIT_Operation *operation) {
+	FIT_SHOULD_NOT_BE_NULL(operation);
+
+	FIT_ThreadJoin(operation->thread);
+
+	FIT_OperationState state = (FIT_OperationState)operation->state;
+	operation->ctx->operation = NULL;
+	free(operation);
+	return state;
+}
+
+// Slots for an open addressing table of int32_t indices that is at most half full with [count]
+// items, or 0 when that many items would not fit.
+static uint32_t FIT_GetIndexSlotCount(uint64_t count) {
+	if (count > (1ull << 30)) {
+		return 0;
+	}
+	uint32_t slotCount = 16;
+	while (slotCount < count * 2) {
+		slotCount *= 2;
+	}
+	return slotCount;
+}
+
+typedef struct FIT_StoreBlob {
+	uint64_t offset;
+	uint64_t len;
+	const FIT_FileEntry *entry;	// the first entry to use it
+	uint32_t pathIndex;
+} FIT_StoreBlob;
+
+static int FIT_CompareStoreBlobOffsets(const void *a, const void *b) {
+	const FIT_StoreBlob *x = (const FIT_StoreBlob *)a;
+	const FIT_StoreBlob *y = (const FIT_StoreBlob *)b;
+	return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+static int FIT_ComparePathStoreStats(const void *a, const void *b) {
+	const FIT_PathStoreStats *x = (const FIT_PathStoreStats *)a;
+	const FIT_PathStoreStats *y = (const FIT_PathStoreStats *)b;
+	return x->storedBytes > y->storedBytes ? -1 : x->storedBytes < y->storedBytes;
+}
+
+int FIT_ComputeStoreStats(FIT_Context *ctx, uint32_t topPathCount, FIT_StoreStats *stats) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(stats);
+
+	memset(stats, 0, sizeof(FIT_StoreStats));
+	stats->bufferBytes = ctx->fsData.bufferCount;
+	stats->snapshotCount = ctx->fsData.snapshotCount;
+	stats->pathCount = ctx->history.historyCount;
+
+	uint64_t entryCount = 0;
+	for (FIT_Snapshot *snapshot = ctx->fsData.snapshotHead; snapshot != NULL; snapshot = snapshot->next) {
+		entryCount += snapshot->entryCount;
+	}
+
+	// Blobs are keyed by offset, unchanged files share the offset of the version they came from.
+	uint32_t slotCount = FIT_GetIndexSlotCount(entryCount);
+	FIT_ASSERT_LOG_RETURN(slotCount, "The store has too many files to work out its stats [%llu].", (unsigned long long)entryCount);
+	stats->snapshots = (FIT_SnapshotStoreStats *)calloc(stats->snapshotCount ? stats->snapshotCount : 1, sizeof(FIT_SnapshotStoreStats));
+	FIT_PathStoreStats *paths = (FIT_PathStoreStats *)calloc(stats->pathCount ? stats->pathCount : 1, sizeof(FIT_PathStoreStats));
+	FIT_StoreBlob *blobs = (FIT_StoreBlob *)malloc((entryCount ? entryCount : 1) * sizeof(FIT_StoreBlob));
+	int32_t *slots = (int32_t *)malloc(slotCount * sizeof(int32_t));
+	if (!stats->snapshots || !paths || !blobs || !slots) {
+		free(paths);
+		free(blobs);
+		free(slots);
+		FIT_StoreStatsDeinit(stats);
+		FIT_ASSERT_LOG_RETURN(0, "Out of memory. Unable to work out the store stats.");
+	}
+	memset(slots, 0xFF, slotCount * sizeof(int32_t));
+
+	for (uint32_t i = 0; i < stats->pathCount; i++) {
+		paths[i].path = ctx->history.histories[i].path;
+		paths[i].versionCount = ctx->history.histories[i].versionCount;
+	}
+
+	uint32_t mask = slotCount - 1;
+	uint32_t snapshotIndex = 0;
+	for (FIT_Snapshot *snapshot = ctx->fsData.snapshotHead; snapshot != NULL; snapshot = snapshot->next, snapshotIndex++) {
+		FIT_SnapshotStoreStats *snapshotStats = &stats->snapshots[snapshotIndex];
+		snapshotStats->entryCount = snapshot->entryCount;
+
+		for (FIT_FileEntry *entry = snapshot->entryHead; entry != NULL; entry = entry->snapNext) {
+			snapshotStats->logicalBytes += entry->offsetLen;
+
+			uint32_t slot = (uint32_t)((entry->offset * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+			while (slots[slot] != -1 && blobs[slots[slot]].offset != entry->offset) {
+				slot = (slot + 1) & mask;
+			}
+			if (slots[slot] != -1) {
+				continue;
+			}
+
+			const FIT_FileHistory *history = FIT_GetFileHistory(ctx, entry->path, entry->pathLen);
+			uint32_t pathIndex = history ? (uint32_t)(history - ctx->history.histories) : UINT32_MAX;
+
+			slots[slot] = (int32_t)stats->blobCount;
+			FIT_StoreBlob *blob = &blobs[stats->blobCount++];
+			blob->offset = entry->offset;
+			blob->len = entry->offsetLen;
+			blob->entry = entry;
+			blob->pathIndex = pathIndex;
+
+			snapshotStats->addedBytes += entry->offsetLen;
+			if (pathIndex != UINT32_MAX) {
+				paths[pathIndex].blobCount++;
+				paths[pathIndex].storedBytes += entry->offsetLen;
+			}
+		}
+		stats->logicalBytes += snapshotStats->logicalBytes;
+	}
+
+	// Walking the blobs in buffer order finds the holes, and the first blob with a digest
+	// is the original so the rest are duplicates.
+	qsort(blobs, (size_t)stats->blobCount, sizeof(FIT_StoreBlob), FIT_CompareStoreBlobOffsets);
+	memset(slots, 0xFF, slotCount * sizeof(int32_t));
+
+	uint64_t covered = 0;
+	for (uint64_t i = 0; i < stats->blobCount; i++) {
+		FIT_StoreBlob *blob = &blobs[i];
+		if (blob->offset > covered) {
+			uint64_t hole = blob->offset - covered;
+			stats->holeCount++;
+			stats->largestHoleBytes = hole > stats->largestHoleBytes ? hole : stats->largestHoleBytes;
+		}
+		uint64_t end = blob->offset + blob->len;
+		if (end > covered) {
+			stats->referencedBytes += end - (blob->offset > covered ? blob->offset : covered);
+			covered = end;
+		}
+
+		const FIT_Base64Digest *hash = &blob->entry->hash;
+		uint32_t slot = FIT_HashString(hash->buffer, strnlen(hash->buffer, FIT_BASE64_DIGEST_SIZE)) & mask;
+		int duplicate = 0;
+		for (; slots[slot] != -1; slot = (slot + 1) & mask) {
+			const FIT_StoreBlob *other = &blobs[slots[slot]];
+			if (other->len == blob->len && strncmp(other->entry->hash.buffer, hash->buffer, FIT_BASE64_DIGEST_SIZE) == 0) {
+				duplicate = 1;
+				break;
+			}
+		}
+		if (duplicate) {
+			stats->duplicateBlobCount++;
+			stats->duplicateBytes += blob->len;
+		}
+		else {
+			slots[slot] = (int32_t)i;
+		}
+	}
+	if (stats->bufferBytes > covered) {
+		uint64_t hole = stats->bufferBytes - covered;
+		stats->holeCount++;
+		stats->largestHoleBytes = hole > stats->largestHoleBytes ? hole : stats->largestHoleBytes;
+	}
+	stats->unreachableBytes = stats->bufferBytes > stats->referencedBytes ? stats->bufferBytes - stats->referencedBytes : 0;
+
+	free(blobs);
+	free(slots);
+
+	qsort(paths, stats->pathCount, sizeof(FIT_PathStoreStats), FIT_ComparePathStoreStats);
+	stats->topPathCount = topPathCount < stats->pathCount ? topPathCount : stats->pathCount;
+	stats->topPaths = paths;
+
+	return 1;
+}
+
+int FIT_WriteStoreStatsJson(const FIT_StoreStats *stats, FILE *out) {
+	FIT_SHOULD_NOT_BE_NULL(stats);
+	FIT_SHOULD_NOT_BE_NULL(out);
+
+	fprintf(out, "{\n");
+	fprintf(out, "\t\"bufferBytes\": %llu,\n", (unsigned long long)stats->bufferBytes);
+	fprintf(out, "\t\"logicalBytes\": %llu,\n", (unsigned long long)stats->logicalBytes);
+	fprintf(out, "\t\"referencedBytes\": %llu,\n", (unsigned long long)stats->referencedBytes);
+	fprintf(out, "\t\"unreachableBytes\": %llu,\n", (unsigned long long)stats->unreachableBytes);
+	fprintf(out, "\t\"blobCount\": %llu,\n", (unsigned long long)stats->blobCount);
+	fprintf(out, "\t\"duplicateBlobCount\": %llu,\n", (unsigned long long)stats->duplicateBlobCount);
+	fprintf(out, "\t\"duplicateBytes\": %llu,\n", (unsigned long long)stats->duplicateBytes);
+	fprintf(out, "\t\"holeCount\": %u,\n", stats->holeCount);
+	fprintf(out, "\t\"largestHoleBytes\": %llu,\n", (unsigned long long)stats->largestHoleBytes);
+	fprintf(out, "\t\"pathCount\": %u,\n", stats->pathCount);
+
+	fprintf(out, "\t\"snapshots\": [\n");
+	for (uint32_t i = 0; i < stats->snapshotCount; i++) {
+		const FIT_SnapshotStoreStats *snapshot = &stats->snapshots[i];
+		fprintf(out, "\t\t{ \"index\": %u, \"files\": %u, \"logicalBytes\": %llu, \"addedBytes\": %llu }%s\n",
+			i, snapshot->entryCount, (unsigned long long)snapshot->logicalBytes, (unsigned long long)snapshot->addedBytes,
+			i + 1 < stats->snapshotCount ? "," : "");
+	}
+	fprintf(out, "\t],\n");
+
+	fprintf(out, "\t\"topPaths\": [\n");
+	for (uint32_t i = 0; i < stats->topPathCount; i++) {
+		const FIT_PathStoreStats *path = &stats->topPaths[i];
+		fprintf(out, "\t\t{ \"path\": \"");
+		FIT_WriteJsonString(out, path->path);
+		fprintf(out, "\", \"versions\": %u, \"blobs\": %u, \"storedBytes\": %llu }%s\n",
+			path->versionCount, path->blobCount, (unsigned long long)path->storedBytes,
+			i + 1 < stats->topPathCount ? "," : "");
+	}
+	fprintf(out, "\t]\n");
+	fprintf(out, "}\n");
+
+	FIT_ASSERT_LOG_RETURN(!ferror(out), "Unable to write the store stats.");
+	return 1;
+}
+
+void FIT_StoreStatsDeinit(FIT_StoreStats *stats) {
+	FIT_SHOULD_NOT_BE_NULL(stats);
+	free(stats->snapshots);
+	free(stats->topPaths);
+	memset(stats, 0, sizeof(FIT_StoreStats));
+}
+
+typedef struct FIT_RepackBlob {
+	uint64_t oldOffset;
+	uint64_t newOffset;
+	uint64_t len;
+	const FIT_FileEntry *entry;	// the first entry with these contents
+} FIT_RepackBlob;
+
+typedef struct FIT_RepackTable {
+	FIT_RepackBlob *blobs;
+	uint64_t blobCount;
+	int32_t *slots;
+	uint32_t mask;
+} FIT_RepackTable;
+
+static int FIT_CompareHistoryPaths(const void *a, const void *b) {
+	const FIT_FileHistory *x = *(const FIT_FileHistory **)a;
+	const FIT_FileHistory *y = *(const FIT_FileHistory **)b;
+	return strcmp(x->path, y->path);
+}
+
+// Blobs are keyed by digest and size, so copies of the same contents at different offsets are one blob.
+static int32_t *FIT_FindRepackSlot(FIT_RepackTable *table, const FIT_FileEntry *entry) {
+	const FIT_Base64Digest *hash = &entry->hash;
+	uint32_t slot = FIT_HashString(hash->buffer, strnlen(hash->buffer, FIT_BASE64_DIGEST_SIZE)) & table->mask;
+	for (; table->slots[slot] != -1; slot = (slot + 1) & table->mask) {
+		const FIT_RepackBlob *blob = &table->blobs[table->slots[slot]];
+		if (blob->len == entry->offsetLen && strncmp(blob->entry->hash.buffer, hash->buffer, FIT_BASE64_DIGEST_SIZE) == 0) {
+			break;
+		}
+	}
+	return &table->slots[slot];
+}
+
+// Points every entry at its blob in the new layout, or back at the old one.
+static void FIT_RepackMoveOffsets(FIT_Context *ctx, FIT_RepackTable *table, int toNew) {
+	for (FIT_Snapshot *snapshot = ctx->fsData.snapshotHead; snapshot != NULL; snapshot = snapshot->next) {
+		for (FIT_FileEntry *entry = snapshot->entryHead; entry != NULL; entry = entry->snapNext) {
+			int32_t *slot = FIT_FindRepackSlot(table, entry);
+			FIT_RELEASE_ASSERT(*slot != -1, "Every snapshot entry was given a blob");
+			entry->offset = toNew ? table->blobs[*slot].newOffset : table->blobs[*slot].oldOffset;
+		}
+	}
+
+	// Tracked entries only remember where their last save put them, the ones without a blob are left be.
+	for (FIT_FileEntry *entry = ctx->fsData.entryTrackingHead; entry != NULL; entry = entry->trackNext) {
+		int32_t *slot = FIT_FindRepackSlot(table, entry);
+		if (*slot != -1) {
+			entry->offset = toNew ? table->blobs[*slot].newOffset : table->blobs[*slot].oldOffset;
+		}
+	}
+}
+
+static int FIT_WriteRepackedStore(FIT_Context *ctx, FIT_RepackTable *table, uint64_t newBufferCount, FILE *file, uint64_t *metadataSize) {
+	// The metadata goes first with the new buffer count, the copies still check against the old one.
+	uint64_t oldBufferCount = ctx->fsData.bufferCount;
+	ctx->fsData.bufferCount = newBufferCount;
+	int result = FIT_SaveFileStoreMetadataFromBuffer(ctx, file);
+	ctx->fsData.bufferCount = oldBufferCount;
+	FIT_ASSERT_LOG_RETURN(result, "Unable to write the file store metadata.");
+
+	int64_t position = FIT_FTELL(file);
+	FIT_ASSERT_LOG_RETURN(position >= 0, "Unable to tell where the file store metadata ends.");
+	*metadataSize = (uint64_t)position;
+
+	for (uint64_t i = 0; i < table->blobCount; i++) {
+		const FIT_RepackBlob *blob = &table->blobs[i];
+		FIT_FileEntry old = *blob->entry;
+		old.offset = blob->oldOffset;
+		result = FIT_CopyBlobToFile(ctx, &old, file);
+		FIT_ASSERT_LOG_RETURN(result, "Unable to copy [%s] to the new file store.", old.path);
+	}
+
+	result = FIT_SyncFile(file);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to sync the new file store.");
+
+	// The copies can go around stdio, so check the size on the file itself.
+	result = FIT_FSEEK(file, 0, SEEK_END) == 0 && FIT_FTELL(file) == (int64_t)(*metadataSize + newBufferCount);
+	FIT_ASSERT_LOG_RETURN(result, "The new file store is not the size it should be.");
+	return 1;
+}
+
+int FIT_RepackFileStore(FIT_Context *ctx, const char *fileStoreStr, FIT_RepackResult *repack) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(fileStoreStr);
+	FIT_SHOULD_NOT_BE_NULL(repack);
+
+	memset(repack, 0, sizeof(FIT_RepackResult));
+
+	// Held until the context is done with the store, a save in between would be lost.
+	int result = FIT_LockFileStore(ctx, fileStoreStr);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to lock file store [%s] to repack it.", fileStoreStr);
+
+	if (ctx->storeLoaded) {
+		FIT_ASSERT_LOG_RETURN(FIT_LoadedStoreIsCurrent(ctx, fileStoreStr), "The file store [%s] was changed by something else since it was loaded. Load it again and retry.", fileStoreStr);
+		repack->oldSize = ctx->loadedStore.size;
+	}
+	else {
+		result = FIT_LoadFileStoreMetadataFromFile(ctx, fileStoreStr);
+		FIT_ASSERT_LOG_RETURN(result, "Unable to load file store [%s]. Does it exist?", fileStoreStr);
+		repack->oldSize = ctx->blobStoreOffset + ctx->fsData.bufferCount;
+	}
+	repack->oldBufferBytes = ctx->fsData.bufferCount;
+
+	for (FIT_Snapshot *snapshot = ctx->fsData.snapshotHead; snapshot != NULL; snapshot = snapshot->next) {
+		repack->entryCount += snapshot->entryCount;
+	}
+
+	uint32_t historyCount = ctx->history.historyCount;
+	uint32_t slotCount = FIT_GetIndexSlotCount(repack->entryCount);
+	FIT_ASSERT_LOG_RETURN(slotCount, "The store has too many files to repack [%llu].", (unsigned long long)repack->entryCount);
+
+	FIT_RepackTable table = {0};
+	table.blobs = (FIT_RepackBlob *)malloc((repack->entryCount ? repack->entryCount : 1) * sizeof(FIT_RepackBlob));
+	table.slots = (int32_t *)malloc(slotCount * sizeof(int32_t));
+	table.mask = slotCount - 1;
+	FIT_FileHistory **histories = (FIT_FileHistory **)malloc((historyCount ? historyCount : 1) * sizeof(FIT_FileHistory *));
+	if (!table.blobs || !table.slots || !histories) {
+		free(table.blobs);
+		free(table.slots);
+		free(histories);
+		FIT_ASSERT_LOG_RETURN(0, "Out of memory. Unable to plan the repack.");
+	}
+	memset(table.slots, 0xFF, slotCount * sizeof(int32_t));
+
+	// Each path's versions end up next to each other, oldest first, and paths in order so
+	// files in the same directory are close too.
+	for (uint32_t i = 0; i < historyCount; i++) {
+		histories[i] = &ctx->history.histories[i];
+	}
+	qsort(histories, historyCount, sizeof(FIT_FileHistory *), FIT_CompareHistoryPaths);
+
+	uint64_t newBufferCount = 0;
+	for (uint32_t i = 0; i < historyCount; i++) {
+		const FIT_FileHistory *history = histories[i];
+		for (uint32_t v = 0; v < history->versionCount; v++) {
+			const FIT_FileEntry *entry = history->versions[v].entry;
+			int32_t *slot = FIT_FindRepackSlot(&table, entry);
+			if (*slot != -1) {
+				continue;
+			}
+
+			*slot = (int32_t)table.blobCount;
+			FIT_RepackBlob *blob = &table.blobs[table.blobCount++];
+			blob->oldOffset = entry->offset;
+			blob->newOffset = newBufferCount;
+			blob->len = entry->offsetLen;
+			blob->entry = entry;
+			newBufferCount += entry->offsetLen;
+		}
+	}
+	free(histories);
+
+	// A store loaded whole keeps its buffer in the new layout too, made before anything is replaced.
+	char *newBuffer = NULL;
+	if (ctx->fsData.buffer && newBufferCount) {
+		newBuffer = (char *)malloc(newBufferCount);
+		if (!newBuffer) {
+			free(table.blobs);
+			free(table.slots);
+			FIT_ASSERT_LOG_RETURN(0, "Out of memory. Unable to allocate the repacked buffer.");
+		}
+	}
+
+	char *tempPath = FIT_AllocateStorePath(fileStoreStr, FIT_STORE_TEMP_SUFFIX);
+	if (!tempPath) {
+		free(newBuffer);
+		free(table.blobs);
+		free(table.slots);
+		return 0;
+	}
+
+	uint64_t metadataSize = 0;
+	FILE *file = fopen(tempPath, "wb");
+	if (file) {
+		FIT_RepackMoveOffsets(ctx, &table, 1);
+		result = FIT_WriteRepackedStore(ctx, &table, newBufferCount, file, &metadataSize);
+		FIT_RepackMoveOffsets(ctx, &table, result);
+		result = (fclose(file) == 0) && result;
+	}
+	else {
+		FIT_LOG("Unable to open [%s] to write the new file store.", tempPath);
+		result = 0;
+	}
+
+	// The old store has to be closed before it can be replaced on Windows.
+	int reopen = ctx->blobStore != NULL;
+	if (result) {
+		if (reopen) {
+			fclose(ctx->blobStore);
+			ctx->blobStore = NULL;
+		}
+		result = FIT_ReplaceFile(tempPath, fileStoreStr);
+	}
+	if (!result) {
+		remove(tempPath);
+		free(newBuffer);
+	}
+	else if (ctx->fsData.buffer) {
+		for (uint64_t i = 0; i < table.blobCount; i++) {
+			const FIT_RepackBlob *blob = &table.blobs[i];
+			memcpy(&newBuffer[blob->newOffset], &ctx->fsData.buffer[blob->oldOffset], blob->len);
+		}
+		free(ctx->fsData.buffer);
+		ctx->fsData.buffer = newBuffer;
+	}
+	free(tempPath);
+	free(table.blobs);
+	free(table.slots);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to repack file store [%s], it has been left as it was.", fileStoreStr);
+
+	ctx->fsData.bufferCount = newBufferCount;
+	if (reopen) {
+		ctx->blobStore = FIT_OpenStoreForReading(fileStoreStr);
+		FIT_ASSERT_LOG_RETURN(ctx->blobStore, "Unable to open the repacked file store [%s].", fileStoreStr);
+		FIT_GetStoreIdentity(ctx->blobStore, &ctx->loadedStore);
+		ctx->blobStoreOffset = metadataSize;
+	}
+	else {
+		FIT_GetStoreIdentityFromPath(fileStoreStr, &ctx->loadedStore);
+	}
+
+	repack->newBufferBytes = newBufferCount;
+	repack->newSize = metadataSize + newBufferCount;
+	repack->blobCount = table.blobCount;
+	return 1;
+}
+
+// Stores from before version 2 do not have the saved time, the newest file in the snapshot is close to it.
+static uint64_t FIT_GetSnapshotTime(const FIT_Snapshot *snapshot) {
+	if (snapshot->savedTime) {
+		return snapshot->savedTime;
+	}
+
+	uint64_t newest = 0;
+	for (FIT_FileEntry *entry = snapshot->entryHead; entry != NULL; entry = entry->snapNext) {
+		newest = entry->modifiedTime > newest ? entry->modifiedTime : newest;
+	}
+#ifdef _WIN32
+	// 100ns intervals since 1601.
+	const uint64_t unixEpoch = 116444736000000000ull;
+	return newest > unixEpoch ? (newest - unixEpoch) / 10000000ull : 0;
+#else
+	return newest / 1000000000ull;
+#endif
+}
+
+typedef struct FIT_LiveRange {
+	uint64_t offset;
+	uint64_t len;
+	uint64_t newOffset;
+} FIT_LiveRange;
+
+static int FIT_CompareLiveRanges(const void *a, const void *b) {
+	const FIT_LiveRange *x = (const FIT_LiveRange *)a;
+	const FIT_LiveRange *y = (const FIT_LiveRange *)b;
+	return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+// The range [offset] is in, the ranges are sorted and do not touch.
+static const FIT_LiveRange *FIT_FindLiveRange(const FIT_LiveRange *ranges, uint64_t rangeCount, uint64_t offset) {
+	uint64_t lo = 0;
+	uint64_t hi = rangeCount;
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (ranges[mid].offset <= offset) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	if (lo == 0 || offset > ranges[lo - 1].offset + ranges[lo - 1].len) {
+		return NULL;
+	}
+	return &ranges[lo - 1];
+}
+
+// Moves the blobs the snapshots still use down over the ones none of them do, in one pass, and
+// points every snapshot and tracked entry at the new offsets. Blobs can be shared by any number
+// of paths and snapshots and be in any order, so this works on ranges rather than on entries.
+static int FIT_CompactStoreBuffer(FIT_Context *ctx) {
+	// Mark every range the snapshots use, then merge the ones that overlap or touch so each
+	// run can be moved down as one.
+	uint64_t entryCount = 0;
+	for (FIT_Snapshot *snapshot = ctx->fsData.snapshotHead; snapshot != NULL; snapshot = snapshot->next) {
+		entryCount += snapshot->entryCount;
+	}
+	FIT_LiveRange *ranges = (FIT_LiveRange *)malloc((entryCount ? entryCount : 1) * sizeof(FIT_LiveRange));
+	FIT_ASSERT_LOG_RETURN(ranges, "Out of memory. Unable to find the blobs still in use.");
+
+	uint64_t rangeCount = 0;
+	for (FIT_Snapshot *snapshot = ctx->fsData.snapshotHead; snapshot != NULL; snapshot = snapshot->next) {
+		for (FIT_FileEntry *entry = snapshot->entryHead; entry != NULL; entry = entry->snapNext) {
+			ranges[rangeCount].offset = entry->offset;
+			ranges[rangeCount].len = entry->offsetLen;
+			rangeCount++;
+		}
+	}
+	qsort(ranges, (size_t)rangeCount, sizeof(FIT_LiveRange), FIT_CompareLiveRanges);
+
+	uint64_t runCount = 0;
+	for (uint64_t i = 0; i < rangeCount; i++) {
+		FIT_LiveRange *run = runCount ? &ranges[runCount - 1] : NULL;
+		if (run && ranges[i].offset <= run->offset + run->len) {
+			uint64_t end = ranges[i].offset + ranges[i].len;
+			if (end > run->offset + run->len) {
+				run->len = end - run->offset;
+			}
+		}
+		else {
+			ranges[runCount++] = ranges[i];
+		}
+	}
+
+	uint64_t cursor = 0;
+	for (uint64_t i = 0; i < runCount; i++) {
+		FIT_LiveRange *run = &ranges[i];
+		if (run->offset != cursor && run->len) {
+			memmove(&ctx->fsData.buffer[cursor], &ctx->fsData.buffer[run->offset], run->len);
+		}
+		run->newOffset = cursor;
+		cursor += run->len;
+	}
+	ctx->fsData.bufferCount = cursor;
+
+	for (FIT_Snapshot *snapshot = ctx->fsData.snapshotHead; snapshot != NULL; snapshot = snapshot->next) {
+		for (FIT_FileEntry *entry = snapshot->entryHead; entry != NULL; entry = entry->snapNext) {
+			const FIT_LiveRange *run = FIT_FindLiveRange(ranges, runCount, entry->offset);
+			FIT_RELEASE_ASSERT(run, "Every snapshot entry was marked");
+			entry->offset = run->newOffset + (entry->offset - run->offset);
+		}
+	}
+
+	// Tracked entries only remember where their last save put them, ones no snapshot uses are left be.
+	for (FIT_FileEntry *entry = ctx->fsData.entryTrackingHead; entry != NULL; entry = entry->trackNext) {
+		const FIT_LiveRange *run = FIT_FindLiveRange(ranges, runCount, entry->offset);
+		if (run) {
+			entry->offset = run->newOffset + (entry->offset - run->offset);
+		}
+	}
+
+	free(ranges);
+	return 1;
+}
+
+int FIT_PruneSnapshots(FIT_Context *ctx, const FIT_RetentionPolicy *policy, uint32_t *prunedCount) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(policy);
+	FIT_SHOULD_NOT_BE_NULL(prunedCount);
+
+	*prunedCount = 0;
+	FIT_ASSERT_LOG_RETURN(policy->keepLast || policy->keepDaily || policy->keepWeekly, "The retention policy does not keep any snapshots.");
+	FIT_ASSERT_LOG_RETURN(ctx->fsData.buffer || ctx->fsData.bufferCount == 0, "The whole file store has to be loaded to prune it.");
+
+	uint32_t snapshotCount = ctx->fsData.snapshotCount;
+	uint8_t *keep = (uint8_t *)calloc(snapshotCount ? snapshotCount : 1, sizeof(uint8_t));
+	FIT_ASSERT_LOG_RETURN(keep, "Out of memory. Unable to pick the snapshots to keep.");
+
+	// Newest first, each rule keeps the first snapshot it sees of each day or week until it has kept enough.
+	uint32_t lastCount = 0;
+	uint32_t dailyCount = 0;
+	uint32_t weeklyCount = 0;
+	uint64_t lastDay = UINT64_MAX;
+	uint64_t lastWeek = UINT64_MAX;
+	for (FIT_Snapshot *snapshot = ctx->fsData.snapshotTail; snapshot != NULL; snapshot = snapshot->prev) {
+		uint64_t day = FIT_GetSnapshotTime(snapshot) / (24 * 60 * 60);
+		// The 1st of January 1970 was a Thursday.
+		uint64_t week = (day + 3) / 7;
+
+		if (lastCount < policy->keepLast) {
+			keep[snapshot->index] = 1;
+			lastCount++;
+		}
+		if (day != lastDay && dailyCount < policy->keepDaily) {
+			keep[snapshot->index] = 1;
+			dailyCount++;
+		}
+		if (week != lastWeek && weeklyCount < policy->keepWeekly) {
+			keep[snapshot->index] = 1;
+			weeklyCount++;
+		}
+		lastDay = day;
+		lastWeek = week;
+	}
+
+	uint32_t index = 0;
+	for (FIT_Snapshot *snapshot = ctx->fsData.snapshotHead; snapshot != NULL; index++) {
+		FIT_Snapshot *next = snapshot->next;
+		if (!keep[index]) {
+			time_t savedTime = (time_t)FIT_GetSnapshotTime(snapshot);
+			char dateStr[32] = "an unknown time";
+			struct tm *date = gmtime(&savedTime);
+			if (savedTime && date) {
+				strftime(dateStr, sizeof(dateStr), "%Y-%m-%d %H:%M UTC", date);
+			}
+			FIT_LOG(" - Removing snapshot [%u] from %s.", index, dateStr);
+
+			FIT_HistoryIndexRemoveSnapshot(&ctx->history, snapshot);
+			FIT_RemoveFromSnapshotList(ctx, snapshot);
+			(*prunedCount)++;
+		}
+		snapshot = next;
+	}
+	free(keep);
+
+	if (*prunedCount == 0) {
+		return 1;
+	}
+
+	int result = FIT_CompactStoreBuffer(ctx);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to compact the file store.");
+	return 1;
+}
+
+int FIT_DeleteSnapshot(FIT_Context *ctx, FIT_Snapshot *snapshot) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(snapshot);
+	FIT_ASSERT_LOG_RETURN(ctx->fsData.buffer || ctx->fsData.bufferCount == 0, "The whole file store has to be loaded to delete a snapshot.");
+
+	FIT_HistoryIndexRemoveSnapshot(&ctx->history, snapshot);
+	FIT_RemoveFromSnapshotList(ctx, snapshot);
+
+	int result = FIT_CompactStoreBuffer(ctx);
+	FIT_ASSERT_LOG_RETURN(result, "Unable to compact the file store.");
+	return 1;
+}
+
+typedef struct FIT_VerifyBlob {
+	uint64_t offset;
+	uint64_t len;
+	const FIT_FileEntry *entry;	// the first entry to use it, for the digest
+	uint8_t corrupt;
+} FIT_VerifyBlob;
+
+typedef struct FIT_VerifyJob {
+	FIT_Context *ctx;
+	FIT_VerifyBlob *blobs;
+	uint64_t blobCount;
+	volatile uint64_t next;
+	volatile uint64_t failedCount;
+} FIT_VerifyJob;
+
+typedef struct FIT_CorruptEntry {
+	uint64_t blobIndex;
+	const FIT_FileEntry *entry;
+	uint32_t snapshotIndex;
+} FIT_CorruptEntry;
+
+static int FIT_CompareVerifyBlobOffsets(const void *a, const void *b) {
+	const FIT_VerifyBlob *x = (const FIT_VerifyBlob *)a;
+	const FIT_VerifyBlob *y = (const FIT_VerifyBlob *)b;
+	return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+static int FIT_CompareCorruptEntries(const void *a, const void *b) {
+	const FIT_CorruptEntry *x = (const FIT_CorruptEntry *)a;
+	const FIT_CorruptEntry *y = (const FIT_CorruptEntry *)b;
+	if (x->blobIndex != y->blobIndex) {
+		return x->blobIndex < y->blobIndex ? -1 : 1;
+	}
+	int order = strcmp(x->entry->path, y->entry->path);
+	if (order != 0) {
+		return order;
+	}
+	return x->snapshotIndex < y->snapshotIndex ? -1 : x->snapshotIndex > y->snapshotIndex;
+}
+
+// Entries with the same range and digest are one blob. Ones with the same range but a different
+// digest are checked on their own, only one of them can match.
+static int32_t *FIT_FindVerifySlot(const FIT_VerifyBlob *blobs, int32_t *slots, uint32_t mask, const FIT_FileEntry *entry) {
+	const FIT_Base64Digest *hash = &entry->hash;
+	uint32_t slot = (uint32_t)((entry->offset * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+	for (; slots[slot] != -1; slot = (slot + 1) & mask) {
+		const FIT_VerifyBlob *blob = &blobs[slots[slot]];
+		if (blob->offset == entry->offset && blob->len == entry->offsetLen &&
+			strncmp(blob->entry->hash.buffer, hash->buffer, FIT_BASE64_DIGEST_SIZE) == 0) {
+			break;
+		}
+	}
+	return &slots[slot];
+}
+
+static void FIT_VerifyWorker(void *arg) {
+	FIT_VerifyJob *job = (FIT_VerifyJob *)arg;
+	FIT_Context *ctx = job->ctx;
+
+	char *buffer = NULL;
+	uint64_t bufferCapacity = 0;
+
+	for (;;) {
+		uint64_t index = FIT_AtomicAdd(&job->next, 1);
+		if (index >= job->blobCount) {
+			break;
+		}
+
+		FIT_VerifyBlob *blob = &job->blobs[index];
+		if (blob->offset + blob->len > ctx->fsData.bufferCount || blob->offset + blob->len < blob->offset) {
+			blob->corrupt = 1;
+			continue;
+		}
+
+		// A store loaded whole, as fit serve has it, is hashed where it is.
+		uint64_t traceStart = FIT_TraceBegin();
+		FIT_Base64Digest digest = {0};
+		if (ctx->fsData.buffer) {
+			FIT_HashBuffer(&digest, &ctx->fsData.buffer[blob->offset], blob->len);
+			blob->corrupt = strncmp(digest.buffer, blob->entry->hash.buffer, FIT_BASE64_DIGEST_SIZE) != 0;
+			FIT_TraceEnd("verify file", traceStart, blob->entry->path);
+			continue;
+		}
+
+		if (blob->len > bufferCapacity) {
+			char *grown = (char *)realloc(buffer, (size_t)blob->len);
+			if (!grown) {
+				FIT_LOG("Out of memory. Unable to read [%s] to check it.", blob->entry->path);
+				FIT_AtomicAdd(&job->failedCount, 1);
+				continue;
+			}
+			buffer = grown;
+			bufferCapacity = blob->len;
+		}
+
+		if (blob->len && !FIT_ReadStoreRange(ctx, ctx->blobStoreOffset + blob->offset, buffer, blob->len)) {
+			blob->corrupt = 1;
+			continue;
+		}
+
+		FIT_HashBuffer(&digest, buffer, blob->len);
+		blob->corrupt = strncmp(digest.buffer, blob->entry->hash.buffer, FIT_BASE64_DIGEST_SIZE) != 0;
+		FIT_TraceEnd("verify file", traceStart, blob->entry->path);
+	}
+
+	free(buffer);
+}
+
+int FIT_VerifyFileStore(FIT_Context *ctx, FIT_Snapshot *snapshot, FIT_VerifyResult *verify) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
+	FIT_SHOULD_NOT_BE_NULL(verify);
+
+	memset(verify, 0, sizeof(FIT_VerifyResult));
+	FIT_ASSERT_LOG_RETURN(ctx->blobStore || ctx->fsData.buffer || ctx->fsData.bufferCount == 0, "The file store has to be loaded to verify it.");
+
+	FIT_Snapshot *first = snapshot ? snapshot : ctx->fsData.snapshotHead;
+	FIT_Snapshot *end = snapshot ? snapshot->next : NULL;
+
+	uint64_t entryCount = 0;
+	for (FIT_Snapshot *snap = first; snap != end; snap = snap->next) {
+		entryCount += snap->entryCount;
+	}
+
+	uint32_t slotCount = FIT_GetIndexSlotCount(entryCount);
+	FIT_ASSERT_LOG_RETURN(slotCount, "The snapshots have too many files to verify at once [%llu].", (unsigned long long)entryCount);
+	uint32_t mask = slotCount - 1;
+
+	FIT_VerifyJob job = {0};
+	job.ctx = ctx;
+	job.blobs = (FIT_VerifyBlob *)malloc((entryCount ? entryCount : 1) * sizeof(FIT_VerifyBlob));
+	int32_t *slots = (int32_t *)malloc(slotCount * sizeof(int32_t));
+	if (!job.blobs || !slots) {
+		free(job.blobs);
+		free(slots);
+		FIT_ASSERT_LOG_RETURN(0, "Out of memory. Unable to list the blobs to verify.");
+	}
+	memset(slots, 0xFF, slotCount * sizeof(int32_t));
+
+	for (FIT_Snapshot *snap = first; snap != end; snap = snap->next) {
+		for (FIT_FileEntry *entry = snap->entryHead; entry != NULL; entry = entry->snapNext) {
+			int32_t *slot = FIT_FindVerifySlot(job.blobs, slots, mask, entry);
+			if (*slot != -1) {
+				continue;
+			}
+			*slot = (int32_t)job.blobCount;
+			FIT_VerifyBlob *blob = &job.blobs[job.blobCount++];
+			blob->offset = entry->offset;
+			blob->len = entry->offsetLen;
+			blob->entry = entry;
+			blob->corrupt = 0;
+			verify->bytesChecked += entry->offsetLen;
+		}
+	}
+	verify->blobCount = job.blobCount;
+
+	// In store order, so the threads between them read the store front to back.
+	qsort(job.blobs, (size_t)job.blobCount, sizeof(FIT_VerifyBlob), FIT_CompareVerifyBlobOffsets);
+	memset(slots, 0xFF, slotCount * sizeof(int32_t));
+	for (uint64_t i = 0; i < job.blobCount; i++) {
+		*FIT_FindVerifySlot(job.blobs, slots, mask, job.blobs[i].entry) = (int32_t)i;
+	}
+
+	// Hashing is the slow part, so one thread per core.
+	uint32_t threadCount = ctx->threadCount ? ctx->threadCount : FIT_GetCpuCount();
+	if (threadCount > FIT_MAX_RESTORE_THREADS) threadCount = FIT_MAX_RESTORE_THREADS;
+	if (threadCount > job.blobCount) threadCount = (uint32_t)job.blobCount;
+
+	int result = FIT_RunOnThreads(threadCount, FIT_VerifyWorker, &job);
+	if (!result || job.failedCount) {
+		free(job.blobs);
+		free(slots);
+		FIT_ASSERT_LOG_RETURN(0, "Unable to check every blob, %llu could not be read.", (unsigned long long)job.failedCount);
+	}
+
+	for (uint64_t i = 0; i < job.blobCount; i++) {
+		verify->corruptBlobCount += job.blobs[i].corrupt;
+	}
+
+	FIT_CorruptEntry *corrupt = NULL;
+	uint8_t *corruptSnapshots = NULL;
+	if (verify->corruptBlobCount) {
+		corrupt = (FIT_CorruptEntry *)malloc(entryCount * sizeof(FIT_CorruptEntry));
+		corruptSnapshots = (uint8_t *)calloc(ctx->fsData.snapshotCount, sizeof(uint8_t));
+		result = corrupt && corruptSnapshots;
+	}
+
+	// Every file using a corrupt blob, grouped by blob and path so each is one line.
+	for (FIT_Snapshot *snap = first; result && verify->corruptBlobCount && snap != end; snap = snap->next) {
+		for (FIT_FileEntry *entry = snap->entryHead; entry != NULL; entry = entry->snapNext) {
+			int32_t blobIndex = *FIT_FindVerifySlot(job.blobs, slots, mask, entry);
+			if (!job.blobs[blobIndex].corrupt) {
+				continue;
+			}
+			FIT_CorruptEntry *item = &corrupt[verify->corruptEntryCount++];
+			item->blobIndex = (uint64_t)blobIndex;
+			item->entry = entry;
+			item->snapshotIndex = snap->index;
+			if (!corruptSnapshots[snap->index]) {
+				corruptSnapshots[snap->index] = 1;
+				verify->corruptSnapshotCount++;
+			}
+		}
+	}
+
+	if (result && verify->corruptEntryCount) {
+		qsort(corrupt, (size_t)verify->corruptEntryCount, sizeof(FIT_CorruptEntry), FIT_CompareCorruptEntries);
+	}
+	for (uint64_t i = 0; result && i < verify->corruptEntryCount;) {
+		const FIT_CorruptEntry *item = &corrupt[i];
+
+		char snapshotsStr[128];
+		size_t used = 0;
+		uint64_t j = i;
+		for (; j < verify->corruptEntryCount && corrupt[j].blobIndex == item->blobIndex && strcmp(corrupt[j].entry->path, item->entry->path) == 0; j++) {
+			if (used + 16 < sizeof(snapshotsStr)) {
+				used += (size_t)snprintf(&snapshotsStr[used], sizeof(snapshotsStr) - used, "%s%u", j > i ? ", " : "", corrupt[j].snapshotIndex);
+			}
+			else if (used + 4 < sizeof(snapshotsStr)) {
+				used += (size_t)snprintf(&snapshotsStr[used], sizeof(snapshotsStr) - used, "...");
+			}
+		}
+		FIT_LOG(" - [%s] does not match its digest [%.*s], in snapshots [%s].", item->entry->path,
+			FIT_BASE64_DIGEST_SIZE, item->entry->hash.buffer, snapshotsStr);
+		i = j;
+	}
+
+	free(corrupt);
+	free(corruptSnapshots);
+	free(job.blobs);
+	free(slots);
+	FIT_ASSERT_LOG_RETURN(result, "Out of memory. Unable to list the corrupt files.");
+
+	return 1;
+}
+
+static int FIT_RunCommand(FIT_Context *ctx, int argc, char *argv[]) {
+	FIT_Sha1Test();
+
+	if (argc <= 1) {
+		FIT_LOG(
+			"The FileStore is a program which takes a set of user supplied files\n"
+			"and tracks and stores snapshots of these files within an FileStore file [.fs].\n"
+			"Common usage:\n"
+			"\"fs create <file store name>\" // creates a file store that you can store files in.\n"
+			"\"fs add <file store name> <file to add>\" // adds a file to the file store\n"
+		);
+		return 1;
+	}
+
+	const char *commandStr = argv[1];
+	FIT_ASSERT_LOG_RETURN(commandStr, "Error. The second argument is a NULL.");
+
+	// Work out what the command is.
+	const size_t MAX_COMMAND_LENGTH = 32;
+
+	size_t commandLen = strnlen(commandStr, MAX_COMMAND_LENGTH);
+
+	typedef enum FIT_COMMAND {
+		FIT_CREATE = 0,
+		FIT_SAVE,
+		FIT_TRACK,
+		FIT_TRACK_ALL,
+		FIT_TRACK_LIST,
+		FIT_TRACK_ALL_SAVE,
+		FIT_CREATE_TRACK_ALL_SAVE,
+		FIT_UNTRACK,
+		FIT_SNAPS,
+		FIT_LOAD,
+		FIT_DELETE,
+		FIT_EXTRACT,
+		FIT_CAT,
+		FIT_DIFF,
+		FIT_STATUS,
+		FIT_HISTORY,
+		FIT_SERVE,
+		FIT_CLIENT,
+		FIT_WATCH,
+		FIT_BATCH,
+		FIT_STATS,
+		FIT_REPACK,
+		FIT_PRUNE,
+		FIT_VERIFY,
+
+
+
+		FIT_COMMAND_COUNT
+	} FIT_COMMAND;
+
+	FIT_COMMAND command = FIT_COMMAND_COUNT;
+
+	if (strncmp("create", commandStr, commandLen) == 0) {
+		command = FIT_CREATE;
+	}
+	else if (strncmp("save", commandStr, commandLen) == 0) {
+		command = FIT_SAVE;
+	}
+	else if (strncmp("track", commandStr, commandLen) == 0) {
+		command = FIT_TRACK;
+	}
+	else if (strncmp("track_all", commandStr, commandLen) == 0) {
+		command = FIT_TRACK_ALL;
+	}
+	else if (strncmp("track_all_save", commandStr, commandLen) == 0) {
+		command = FIT_TRACK_ALL_SAVE;
+	}
+	else if (strncmp("create_track_all_save", commandStr, commandLen) == 0) {
+		command = FIT_CREATE_TRACK_ALL_SAVE;
+	}
+	else if (strncmp("tracklist", commandStr, commandLen) == 0) {
+		command = FIT_TRACK_LIST;
+	}
+	else if (strncmp("untrack", commandStr, commandLen) == 0) {
+		command = FIT_UNTRACK;
+	}
+	else if (strncmp("snaps", commandStr, commandLen) == 0) {
+		command = FIT_SNAPS;
+	}
+	else if (strncmp("load", commandStr, commandLen) == 0) {
+		command = FIT_LOAD;
+	}
+	else if (strncmp("delete", commandStr, commandLen) == 0) {
+		command = FIT_DELETE;
+	}
+	else if (strncmp("extract", commandStr, commandLen) == 0) {
+		command = FIT_EXTRACT;
+	}
+	else if (strncmp("cat", commandStr, commandLen) == 0) {
+		command = FIT_CAT;
+	}
+	else if (strncmp("diff", commandStr, commandLen) == 0) {
+		command = FIT_DIFF;
+	}
+	else if (strncmp("status", commandStr, commandLen) == 0) {
+		command = FIT_STATUS;
+	}
+	else if (strncmp("history", commandStr, commandLen) == 0) {
+		command = FIT_HISTORY;
+	}
+	else if (strncmp("serve", commandStr, commandLen) == 0) {
+		command = FIT_SERVE;
+	}
+	else if (strncmp("client", commandStr, commandLen) == 0) {
+		command = FIT_CLIENT;
+	}
+	else if (strncmp("watch", commandStr, commandLen) == 0) {
+		command = FIT_WATCH;
+	}
+	else if (strncmp("batch", commandStr, commandLen) == 0) {
+		command = FIT_BATCH;
+	}
+	else if (strncmp("stats", commandStr, commandLen) == 0) {
+		command = FIT_STATS;
+	}
+	else if (strncmp("repack", commandStr, commandLen) == 0) {
+		command = FIT_REPACK;
+	}
+	else if (strncmp("prune", commandStr, commandLen) == 0) {
+		command = FIT_PRUNE;
+	}
+	else if (strncmp("verify", commandStr, commandLen) == 0) {
+		command = FIT_VERIFY;
+	}
+	else {
+		FIT_LOG("This command [%s] is unrecognised. Try \"fv <cheat>\" to a see a list of useful commands, or \"fv <help>\" for some help.", commandStr);
+		return 0;
+	}
+
+	// Commands that change the store hold the writer lock from before they load it until
+	// FIT_Run returns. The rest only read, and never wait for a writer.
+	switch (command) {
+	case FIT_CREATE:
+	case FIT_UNTRACK:
+	case FIT_SAVE:
+	case FIT_TRACK:
+	case FIT_TRACK_ALL_SAVE:
+	case FIT_CREATE_TRACK_ALL_SAVE:
+	case FIT_TRACK_ALL:
+	case FIT_DELETE:
+	case FIT_BATCH:
+	case FIT_REPACK:
+	case FIT_PRUNE:
+		if (argc >= 3 && argv[2]) {
+			int result = FIT_LockFileStore(ctx, argv[2]);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to lock file store [%s].", argv[2]);
+		}
+		break;
+	default:
+		break;
+	}
+
+	switch (command) {
+	case FIT_CREATE: {
+		if (argc >= 2) {
+			const char *fileName = argv[2];
+			FIT_ASSERT_LOG_RETURN(fileName, "Error. The third argument is a NULL.");
+
+			int result = FIT_CreateStore(ctx, fileName);
+			FIT_ASSERT_LOG_RETURN(result, "Unable create file store. %s", fileName);
+
+			FIT_LOG("Sucessfully created the %s file store.", fileName);
+		}
+		break;
+	}
+	case FIT_TRACK_LIST: {
+
+		if (argc >= 2) {
+
+			int result;
+			
+			const char *fileStoreStr = argv[2];
+			FIT_ASSERT_LOG_RETURN(fileStoreStr, "The <fileStore> argument is a NULL.");
+
+			result = FIT_LoadFileStoreAndSetWorkingDirectory(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to load the file store [%s]. Does this file exist?", ctx->fileStoreAbsolutePath.buffer);
+
+			FIT_LOG(" ");
+
+			if (ctx->fsData.entryTrackingHead) {
+				int index = 0;
+				for (FIT_FileEntry *entry = ctx->fsData.entryTrackingHead;
+					 entry != NULL;
+					 entry = entry->trackNext) {
+
+					FIT_LOG("[%d] %s [%s]", index++, entry->path, entry->hash.buffer);
+				}
+			}
+			else {
+				FIT_LOG("This file store [%s] is not currently tracking any files", fileStoreStr);
+			}
+
+			FIT_LOG(" ");
+		}
+
+		break;
+	}
+	case FIT_UNTRACK: {
+
+		if (argc >= 3) {
+
+			int result;
+
+			const char *fileStoreStr = argv[2];
+			FIT_ASSERT_LOG_RETURN(fileStoreStr, "The <fileStore> argument is a NULL.");
+
+			result = FIT_LoadFileStoreAndSetWorkingDirectory(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to load file store [%s]. Does it exist?", fileStoreStr);
+
+			const char *fileTrackStr = argv[3];
+			FIT_ASSERT_LOG_RETURN(fileTrackStr, "The <fileToTrack> argument is a NULL.");
+
+			FIT_FileEntry *entryToRemove = NULL;
+			for (FIT_FileEntry *entry = ctx->fsData.entryTrackingHead;
+				 entry != NULL;
+				 entry = entry->trackNext) {
+				if (strncmp(entry->path, fileTrackStr, entry->pathLen) == 0) {
+					entryToRemove = entry;
+					break;
+				}
+			}
+
+			if (!entryToRemove) {
+				// check that its an index instead 
+				long int entryIndex = strtol(fileTrackStr, NULL, 0);
+				long int index = 0;
+				for (FIT_FileEntry *entry = ctx->fsData.entryTrackingHead;
+					 entry != NULL;
+					 entry = entry->trackNext) {
+					if (index == entryIndex) {
+						entryToRemove = entry;
+						break;
+					}
+				}
+			}
+
+			if (entryToRemove) {
+				FIT_LOG("\nRemoving [%s] from the tracking list.\n", entryToRemove->path);
+
+				FIT_RemoveFromTrackList(ctx, entryToRemove);
+				result = FIT_SaveFileStoreFromFile(ctx, ctx->fileStoreAbsolutePath.buffer);
+				FIT_ASSERT_LOG_RETURN(result, "TODO");
+			}
+			else {
+				FIT_LOG("\nThis file [%s] is not being tracked and is not in the tracking list.\n", fileTrackStr);
+			}
+		}
+
+		break;
+	}
+	case FIT_SAVE: {
+
+		if (argc >= 2) {
+
+			int result;
+
+			const char *fileStoreStr = argv[2];
+			FIT_ASSERT_LOG_RETURN(fileStoreStr, "The <fileStore> argument is a NULL.");
+
+			result = FIT_LoadFileStoreAndSetWorkingDirectory(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to load file store [%s]. Does it exist?", fileStoreStr);
+
+			int newChanges = 0;
+
+			FIT_LOG(" ");
+
+			result = FIT_PrepareSnapshotForSave(ctx);
+			FIT_ASSERT_LOG_RETURN(result, "TODO.");
+
+			result = FIT_SaveFileStoreFromFile(ctx, ctx->fileStoreAbsolutePath.buffer);
+			FIT_ASSERT_LOG_RETURN(result, "TODO");
+
+			FIT_LOG(" ");
+
+			if (!newChanges) {
+				FIT_LOG("No files have changes since the last snapshot.");
+			}
+
+			FIT_LOG("Saved snapshot [%d] to the file store.\n", ctx->fsData.snapshotCount - 1);
+		}
+		break;
+	}
+	case FIT_TRACK: {
+
+		if (argc >= 3) {
+
+			FIT_LOG(" ");
+
+			int result = 0;
+			
+			const char *fileStoreStr = argv[2];
+			FIT_ASSERT_LOG_RETURN(fileStoreStr, "The <fileStore> argument is a NULL.");
+
+			result = FIT_LoadFileStoreAndSetWorkingDirectory(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(result, "The store [%s] could not be opened. Does it exist?", fileStoreStr);
+
+			const char *fileTrackStr = argv[3];
+			FIT_ASSERT_LOG_RETURN(fileTrackStr, "The <fileToTrack> argument is a NULL.");
+
+			FILE *fileToTrack = FIT_OpenWorkingFile(ctx, fileTrackStr, "rb");
+			FIT_ASSERT_LOG_RETURN(fileToTrack, "Unable to open the [%s%s] file to track. Does this file exist?", ctx->workingDirectory.buffer, fileTrackStr);
+
+			result = fclose(fileToTrack);
+			FIT_ASSERT_LOG_RETURN(result == 0, "Unable to close the [%s%s] file.", ctx->workingDirectory.buffer, fileTrackStr);
+
+			// Check that the file is not already in the tracking list 
+			if (FIT_IsPathInTrackingList(ctx, fileTrackStr)) {
+				FIT_LOG("This file [%s] is already being tracked. Only one instance of a file can be tracked at a time.", fileTrackStr);
+			}
+			else {
+
+				FIT_FileEntry *entry = FIT_AllocateFileEntry(ctx);
+				FIT_ASSERT_LOG_RETURN(entry, "TODO");
+
+				size_t strLen = strnlen(fileTrackStr, FIT_MAX_ENTRY_PATH);
+				FIT_ASSERT_LOG_RETURN(strLen, "The path length of the specified tracked file is 0. This is an error.");
+
+				char *str = (char *)calloc(strLen + 1, sizeof(char));
+				FIT_ASSERT_LOG_RETURN(str, "Out of memory. Unable to allocate string.");
+				strncpy(str, fileTrackStr, strLen);
+				str[strLen] = '\0';
+
+				entry->path = str;
+				entry->pathLen = strLen;
+
+				FIT_AddToTrackingList(ctx, entry);
+
+				result = FIT_SaveFileStoreFromFile(ctx, ctx->fileStoreAbsolutePath.buffer);
+				FIT_ASSERT_LOG_RETURN(result, "TODO");
+
+				FIT_LOG("The file [%s] is now being tracked by the store [%s]\n", entry->path, ctx->fileStoreAbsolutePath.buffer);
+			}
+		}
+		break;
+	}
+	case FIT_TRACK_ALL_SAVE: {
+
+		if (argc >= 3) {
+
+			int result = 0;
+
+			const char *fileStoreStr = argv[2];
+			FIT_ASSERT_LOG_RETURN(fileStoreStr, "The <fileStore> argument is a NULL.");
+
+			size_t fileStoreStrLen = strnlen(fileStoreStr, FIT_MAX_PATH);
+			FIT_ASSERT_LOG_RETURN(fileStoreStrLen, "The <fileStore> length is 0.");
+
+			result = FIT_LoadFileStoreAndSetWorkingDirectory(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(result, "TODO");
+
+			result = FIT_TrackAll(ctx, fileStoreStr, fileStoreStrLen);
+			FIT_ASSERT_LOG_RETURN(result, "TODO");
+
+			result = FIT_PrepareSnapshotForSave(ctx);
+			FIT_ASSERT_LOG_RETURN(result, "TODO.");
+
+			result = FIT_SaveFileStoreFromFile(ctx, ctx->fileStoreAbsolutePath.buffer);
+			FIT_ASSERT_LOG_RETURN(result, "TODO");
+		}
+
+		break;
+	}
+	case FIT_CREATE_TRACK_ALL_SAVE: {
+
+		if (argc >= 3) {
+
+			int result = 0;
+
+			const char *fileStoreStr = argv[2];
+			FIT_ASSERT_LOG_RETURN(fileStoreStr, "The <fileStore> argument is a NULL.");
+
+			size_t fileStoreStrLen = strnlen(fileStoreStr, FIT_MAX_PATH);
+			FIT_ASSERT_LOG_RETURN(fileStoreStrLen, "The <fileStore> length is 0.");
+
+			result = FIT_CheckFileStoreExists(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(!result, "This file store already exists %s", fileStoreStr);
+
+			result = FIT_SaveFileStoreFromFile(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(result, "TODO");
+
+			result = FIT_LoadFileStoreAndSetWorkingDirectory(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(result, "TODO");
+
+			result = FIT_TrackAll(ctx, fileStoreStr, fileStoreStrLen);
+			FIT_ASSERT_LOG_RETURN(result, "TODO");
+
+			result = FIT_PrepareSnapshotForSave(ctx);
+			FIT_ASSERT_LOG_RETURN(result, "TODO.");
+
+			result = FIT_SaveFileStoreFromFile(ctx, ctx->fileStoreAbsolutePath.buffer);
+			FIT_ASSERT_LOG_RETURN(result, "TODO");
+		}
+
+		break;
+	}
+	case FIT_TRACK_ALL: {
+
+		if (argc >= 3) {
+
+			int result = 0;
+			
+			const char *fileStoreStr = argv[2];
+			FIT_ASSERT_LOG_RETURN(fileStoreStr, "The <fileStore> argument is a NULL.");
+
+			size_t fileStoreStrLen = strnlen(fileStoreStr, FIT_MAX_PATH);
+			FIT_ASSERT_LOG_RETURN(fileStoreStrLen, "The <fileStore> length is 0.");
+
+			result = FIT_LoadFileStoreAndSetWorkingDirectory(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(result, "TODO");
+
+			result = FIT_TrackAll(ctx, fileStoreStr, fileStoreStrLen);
+			FIT_ASSERT_LOG_RETURN(result, "TODO");
+
+			for (FIT_FileEntry *entry = ctx->fsData.entryTrackingHead;
+				 entry != NULL;
+				 entry = entry->trackNext) {
+
+				FIT_LOG(" - Tracking [%s]", entry->path);
+			}
+
+			result = FIT_SaveFileStoreFromFile(ctx, ctx->fileStoreAbsolutePath.buffer);
+			FIT_ASSERT_LOG_RETURN(result, "TODO");
+		}
+		break;
+	}
+	case FIT_LOAD: {
+
+		if (argc >= 3) {
+
+			int result = 0;
+
+			const char *fileStoreStr = argv[2];
+			FIT_ASSERT_LOG_RETURN(fileStoreStr, "The <fileStore> argument is a NULL.");
+
+			size_t fileStoreStrLen = strnlen(fileStoreStr, FIT_MAX_PATH);
+			FIT_ASSERT_LOG_RETURN(fileStoreStrLen, "The <fileStore> length is 0.");
+
+			// Blobs are copied straight out of the store, so only the metadata is read up front.
+			result = FIT_SetWorkingDirectoryFromFileStore(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to find file store [%s]. Does it exist?", fileStoreStr);
+
+			result = FIT_LoadFileStoreMetadataFromFile(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to load file store [%s]. Does it exist?", fileStoreStr);
+
+			FIT_Snapshot *snapshot = NULL;
+			long int snapIndex = 0;
+
+			if (argc >= 4) {
+				const char *snapIndexStr = argv[3];
+				FIT_ASSERT_LOG_RETURN(snapIndexStr, "The <snapIndex> argument is a NULL.");
+
+				snapIndex = strtol(snapIndexStr, NULL, 0);
+
+				long int curIndex = 0;
+				// this is slow
+				for (FIT_Snapshot *s = ctx->fsData.snapshotHead;
+					 s != NULL;
+					 s = s->next) {
+					if (curIndex++ == snapIndex) {
+						snapshot = s;
+						break;
+					}
+				}
+				FIT_ASSERT_LOG_RETURN(snapshot, "The provided snapshot index does not reference any snapshot in the store. Omitting the index will load the latest snapshot.");
+			}
+			else {
+				snapshot = ctx->fsData.snapshotTail;
+			}
+
+			FIT_ASSERT_LOG_RETURN(snapshot, "There are no snapshots in the file store [%s] to load.", fileStoreStr);
+
+			FIT_RestorePlan plan = {0};
+			result = FIT_PlanRestore(ctx, snapshot, &plan);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to compare the snapshot with the working directory.");
+
+			FIT_LOG("Loading a snapshot from this file store [%s] will change the following files:\n", fileStoreStr);
+			for (FIT_FileEntry *entry = snapshot->entryHead;
+				 entry != NULL;
+				 entry = entry->snapNext) {
+				if (entry->restoreAction == FIT_RESTORE_CREATE) {
+					FIT_LOG(" - [create] [%s] [%s]", entry->path, entry->hash.buffer);
+				}
+				else if (entry->restoreAction == FIT_RESTORE_OVERWRITE) {
+					FIT_LOG(" - [overwrite] [%s] [%s]", entry->path, entry->hash.buffer);
+				}
+			}
+			for (FIT_FileEntry *entry = ctx->fsData.entryTrackingHead;
+				 entry != NULL;
+				 entry = entry->trackNext) {
+				if (entry->restoreAction == FIT_RESTORE_NOT_IN_SNAPSHOT) {
+					FIT_LOG(" - [not in snapshot, left as is] [%s]", entry->path);
+				}
+			}
+			FIT_LOG("\n %u files to create, %u to overwrite, %u already match the snapshot.", plan.createCount, plan.overwriteCount, plan.unchangedCount);
+
+			if (plan.createCount + plan.overwriteCount == 0) {
+				FIT_Log("The working directory already matches this snapshot. Nothing to load.");
+				break;
+			}
+
+			FIT_LOG("\n This may overwrite existing files in the working directory. Do you want to proceed? [Y/N]");
+			char c = ctx->nonInteractive ? 'y' : getc(stdin);
+
+			if (c == 'y' || c == 'Y') {
+				result = FIT_RestoreSnapshot(ctx, snapshot);
+				FIT_ASSERT_LOG_RETURN(result, "Unable to load the snapshot.");
+
+				if (snapshot == ctx->fsData.snapshotTail) {
+					FIT_Log("Successfully loaded the latest snapshot");
+				}
+				else {
+					FIT_Log("Successfully loaded snapshot %d", snapIndex);
+				}
+			}
+			else {
+				FIT_Log("Did not load any snapshot.");
+			}
+		}
+
+		break;
+	}
+	case FIT_SNAPS: {
+
+		if (argc >= 3) {
+			const char *fileStoreStr = argv[2];
+			FIT_ASSERT_LOG_RETURN(fileStoreStr, "The <fileStore> argument is a NULL.");
+
+			int result = FIT_LoadFileStoreFromFile(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(result, "TODO");
+
+			if (ctx->fsData.snapshotCount) {
+
+				FIT_LOG(" ");
+
+				int index = 0;
+				for (FIT_Snapshot *snap = ctx->fsData.snapshotHead;
+					 snap != NULL;
+					 snap = snap->next) {
+
+					if (index == ctx->fsData.snapshotCount - 1) {
+						FIT_LOG("------ %s | Snapshot [%d] [LATEST] ------\n", fileStoreStr, index++);
+					}
+					else {
+						FIT_LOG("------ %s | Snapshot [%d] ------\n", fileStoreStr, index++);
+					}
+
+					int entryIndex = 0;
+					for (FIT_FileEntry *entry = snap->entryHead;
+						 entry != NULL;
+						 entry = entry->snapNext) {
+						FIT_LOG(" - [%d] [%s] [%s] [%u]", entryIndex++, entry->path, entry->hash.buffer, entry->offset);
+					}
+
+					FIT_LOG(" ");
+				}
 
-	if (argc <= 1) {
-		FIT_LOG(
-			"The FileStore is a program which takes a set of user supplied files\n"
-			"and tracks and stores snapshots of these files within an FileStore file [.fs].\n"
-			"Common usage:\n"
-			"\"fs create <file store name>\" // creates a file store that you can store files in.\n"
-			"\"fs add <file store name> <file to add>\" // adds a file to the file store\n"
-		);
-		return 1;
+			}
+			else {
+				FIT_LOG("There are no saved snap shots to look at.");
+			}
+		}
+		break;
 	}
+	case FIT_DELETE: {
 
-	const char *commandStr = argv[1];
-	FIT_ASSERT_LOG_RETURN(commandStr, "Error. The second argument is a NULL.");
-
-	// Work out what the command is.
-	const size_t MAX_COMMAND_LENGTH = 32;
+		if (argc >= 3) {
+			const char *fileStoreStr = argv[2];
+			FIT_ASSERT_LOG_RETURN(fileStoreStr, "The <fileStore> argument is a NULL.");
 
-	size_t commandLen = strnlen(commandStr, MAX_COMMAND_LENGTH);
+			int result = FIT_LoadFileStoreAndSetWorkingDirectory(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to load the file store [%s]", fileStoreStr);
 
-	typedef enum FIT_COMMAND {
-		FIT_CREATE = 0,
-		FIT_SAVE,
-		FIT_TRACK,
-		FIT_TRACK_ALL,
-		FIT_TRACK_LIST,
-		FIT_TRACK_ALL_SAVE,
-		FIT_CREATE_TRACK_ALL_SAVE,
-		FIT_UNTRACK,
-		FIT_SNAPS,
-		FIT_LOAD,
-		FIT_DELETE,
+			if (ctx->fsData.snapshotCount == 0) {
+				FIT_LOG("There are no snapshots to delete");
+			}
+			else {
 
+				FIT_Snapshot *snapToDelete = NULL; ctx->fsData.snapshotTail;
 
+				if (argc >= 4) {
+					const char *snapIndexStr = argv[3];
+					FIT_ASSERT_LOG_RETURN(snapIndexStr, "The <snapIndex> argument is a NULL.");
+					long int snapIndex = strtol(snapIndexStr, NULL, 0);
 
-		FIT_COMMAND_COUNT
-	} FIT_COMMAND;
+					long int index = 0;
+					for (FIT_Snapshot *snap = ctx->fsData.snapshotHead;
+						 snap != NULL;
+						 snap = snap->next) {
+						if (index == snapIndex) {
+							snapToDelete = snap;
+							break;
+						}
+						index++;
+					}
 
-	FIT_COMMAND command = FIT_COMMAND_COUNT;
+					FIT_ASSERT_LOG_RETURN(snapToDelete, "The <snapIndex> argument does not refer to a valid snapshot.");
+				}
+				else {
+					snapToDelete = ctx->fsData.snapshotTail;
+				}
 
-	if (strncmp("create", commandStr, commandLen) == 0) {
-		command = FIT_CREATE;
-	}
-	else if (strncmp("save", commandStr, commandLen) == 0) {
-		command = FIT_SAVE;
-	}
-	else if (strncmp("track", commandStr, commandLen) == 0) {
-		command = FIT_TRACK;
-	}
-	else if (strncmp("track_all", commandStr, commandLen) == 0) {
-		command = FIT_TRACK_ALL;
-	}
-	else if (strncmp("track_all_save", commandStr, commandLen) == 0) {
-		command = FIT_TRACK_ALL_SAVE;
-	}
-	else if (strncmp("create_track_all_save", commandStr, commandLen) == 0) {
-		command = FIT_CREATE_TRACK_ALL_SAVE;
-	}
-	else if (strncmp("tracklist", commandStr, commandLen) == 0) {
-		command = FIT_TRACK_LIST;
-	}
-	else if (strncmp("untrack", commandStr, commandLen) == 0) {
-		command = FIT_UNTRACK;
-	}
-	else if (strncmp("snaps", commandStr, commandLen) == 0) {
-		command = FIT_SNAPS;
-	}
-	else if (strncmp("load", commandStr, commandLen) == 0) {
-		command = FIT_LOAD;
-	}
-	else if (strncmp("delete", commandStr, commandLen) == 0) {
-		command = FIT_DELETE;
-	}
-	else {
-		FIT_LOG("This command [%s] is unrecognised. Try \"fv <cheat>\" to a see a list of useful commands, or \"fv <help>\" for some help.", commandStr);
-		return 0;
-	}
 
-	switch (command) {
-	case FIT_CREATE: {
-		if (argc >= 2) {
-			const char *fileName = argv[2];
-			FIT_ASSERT_LOG_RETURN(fileName, "Error. The third argument is a NULL.");
+				result = FIT_DeleteSnapshot(ctx, snapToDelete);
+				FIT_ASSERT_LOG_RETURN(result, "Unable to delete the snapshot.");
 
-			int result = FIT_CreateStore(ctx, fileName);
-			FIT_ASSERT_LOG_RETURN(result, "Unable create file store. %s", fileName);
+				result = FIT_SaveFileStoreFromFile(ctx, ctx->fileStoreAbsolutePath.buffer);
+				FIT_ASSERT_LOG_RETURN(result, "Unable to save the file store [%s]", ctx->fileStoreAbsolutePath.buffer);
 
-			FIT_LOG("Sucessfully created the %s file store.", fileName);
+				FIT_LOG("Removed the snapshot");
+			}
 		}
+
 		break;
 	}
-	case FIT_TRACK_LIST: {
+	case FIT_EXTRACT: {
 
-		if (argc >= 2) {
+		if (argc >= 5) {
+
+			int result = 0;
 
-			int result;
-			
 			const char *fileStoreStr = argv[2];
 			FIT_ASSERT_LOG_RETURN(fileStoreStr, "The <fileStore> argument is a NULL.");
 
-			result = FIT_LoadFileStoreAndSetWorkingDirectory(ctx, fileStoreStr);
-			FIT_ASSERT_LOG_RETURN(result, "Unable to load the file store [%s]. Does this file exist?", ctx->fileStoreAbsolutePath.buffer);
+			const char *snapIndexStr = argv[3];
+			FIT_ASSERT_LOG_RETURN(snapIndexStr, "The <snapIndex> argument is a NULL.");
 
-			FIT_LOG(" ");
+			const char *pathStr = argv[4];
+			FIT_ASSERT_LOG_RETURN(pathStr, "The <path> argument is a NULL.");
 
-			if (ctx->fsData.entryTrackingHead) {
-				int index = 0;
-				for (FIT_FileEntry *entry = ctx->fsData.entryTrackingHead;
-					 entry != NULL;
-					 entry = entry->trackNext) {
+			const char *destStr = argc >= 6 ? argv[5] : NULL;
 
-					FIT_LOG("[%d] %s [%s]", index++, entry->path, entry->hash.buffer);
-				}
+			result = FIT_SetWorkingDirectoryFromFileStore(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to find file store [%s]. Does it exist?", fileStoreStr);
+
+			result = FIT_LoadFileStoreMetadataFromFile(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to load file store [%s]. Does it exist?", fileStoreStr);
+
+			FIT_Snapshot *snapshot = FIT_GetSnapshotByIndex(ctx, strtol(snapIndexStr, NULL, 0));
+			FIT_ASSERT_LOG_RETURN(snapshot, "The <snapIndex> argument [%s] does not refer to a valid snapshot.", snapIndexStr);
+
+			uint32_t extractedCount = 0;
+			result = FIT_ExtractFromSnapshot(ctx, snapshot, pathStr, destStr, &extractedCount);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to extract [%s] from snapshot [%s].", pathStr, snapIndexStr);
+
+			if (extractedCount) {
+				FIT_LOG("Extracted %u files matching [%s] from snapshot [%s] into [%s].", extractedCount, pathStr, snapIndexStr, destStr ? destStr : ctx->workingDirectory.buffer);
 			}
 			else {
-				FIT_LOG("This file store [%s] is not currently tracking any files", fileStoreStr);
+				FIT_LOG("There is no file or directory [%s] in snapshot [%s].", pathStr, snapIndexStr);
 			}
-
-			FIT_LOG(" ");
+		}
+		else {
+			FIT_LOG("Usage: fit extract <fileStore> <snapIndex> <path or directory/> [destination directory]");
 		}
 
 		break;
 	}
-	case FIT_UNTRACK: {
+	case FIT_CAT: {
 
-		if (argc >= 3) {
+		if (argc >= 5) {
 
-			int result;
+			int result = 0;
 
 			const char *fileStoreStr = argv[2];
 			FIT_ASSERT_LOG_RETURN(fileStoreStr, "The <fileStore> argument is a NULL.");
 
-			result = FIT_LoadFileStoreAndSetWorkingDirectory(ctx, fileStoreStr);
+			const char *snapIndexStr = argv[3];
+			FIT_ASSERT_LOG_RETURN(snapIndexStr, "The <snapIndex> argument is a NULL.");
+
+			const char *pathStr = argv[4];
+			FIT_ASSERT_LOG_RETURN(pathStr, "The <path> argument is a NULL.");
+
+			result = FIT_LoadFileStoreMetadataFromFile(ctx, fileStoreStr);
 			FIT_ASSERT_LOG_RETURN(result, "Unable to load file store [%s]. Does it exist?", fileStoreStr);
 
-			const char *fileTrackStr = argv[3];
-			FIT_ASSERT_LOG_RETURN(fileTrackStr, "The <fileToTrack> argument is a NULL.");
+			FIT_Snapshot *snapshot = FIT_GetSnapshotByIndex(ctx, strtol(snapIndexStr, NULL, 0));
+			FIT_ASSERT_LOG_RETURN(snapshot, "The <snapIndex> argument [%s] does not refer to a valid snapshot.", snapIndexStr);
 
-			FIT_FileEntry *entryToRemove = NULL;
-			for (FIT_FileEntry *entry = ctx->fsData.entryTrackingHead;
+			FIT_FileEntry *found = NULL;
+			for (FIT_FileEntry *entry = snapshot->entryHead;
 				 entry != NULL;
-				 entry = entry->trackNext) {
-				if (strncmp(entry->path, fileTrackStr, entry->pathLen) == 0) {
-					entryToRemove = entry;
+				 entry = entry->snapNext) {
+				if (strcmp(entry->path, pathStr) == 0) {
+					found = entry;
 					break;
 				}
 			}
+			FIT_ASSERT_LOG_RETURN(found, "There is no file [%s] in snapshot [%s].", pathStr, snapIndexStr);
 
-			if (!entryToRemove) {
-				// check that its an index instead 
-				long int entryIndex = strtol(fileTrackStr, NULL, 0);
-				long int index = 0;
-				for (FIT_FileEntry *entry = ctx->fsData.entryTrackingHead;
-					 entry != NULL;
-					 entry = entry->trackNext) {
-					if (index == entryIndex) {
-						entryToRemove = entry;
-						break;
-					}
-				}
-			}
-
-			if (entryToRemove) {
-				FIT_LOG("\nRemoving [%s] from the tracking list.\n", entryToRemove->path);
-
-				FIT_RemoveFromTrackList(ctx, entryToRemove);
-				result = FIT_SaveFileStoreFromFile(ctx, ctx->fileStoreAbsolutePath.buffer);
-				FIT_ASSERT_LOG_RETURN(result, "TODO");
-			}
-			else {
-				FIT_LOG("\nThis file [%s] is not being tracked and is not in the tracking list.\n", fileTrackStr);
-			}
+#ifdef _WIN32
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+			result = FIT_CopyBlobToFile(ctx, found, stdout);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to write [%s] to the output.", pathStr);
+			fflush(stdout);
+		}
+		else {
+			FIT_LOG("Usage: fit cat <fileStore> <snapIndex> <path>");
 		}
 
 		break;
 	}
-	case FIT_SAVE: {
+	case FIT_DIFF: {
 
-		if (argc >= 2) {
+		if (argc >= 4) {
 
-			int result;
+			int result = 0;
 
 			const char *fileStoreStr = argv[2];
 			FIT_ASSERT_LOG_RETURN(fileStoreStr, "The <fileStore> argument is a NULL.");
 
-			result = FIT_LoadFileStoreAndSetWorkingDirectory(ctx, fileStoreStr);
-			FIT_ASSERT_LOG_RETURN(result, "Unable to load file store [%s]. Does it exist?", fileStoreStr);
+			const char *fromIndexStr = argv[3];
+			FIT_ASSERT_LOG_RETURN(fromIndexStr, "The <snapIndex> argument is a NULL.");
+
+			// A number after the first index is the other snapshot, anything after that is a
+			// file or directory to show the changed lines of. Paths after a -- are never taken
+			// as the other snapshot, so a file named 3 can be diffed too.
+			const char *toIndexStr = NULL;
+			int pathArgStart = 4;
+			if (argc >= 5 && strcmp(argv[4], "--") != 0) {
+				char *end = NULL;
+				strtol(argv[4], &end, 0);
+				if (end != argv[4] && *end == '\0') {
+					toIndexStr = argv[4];
+					pathArgStart = 5;
+				}
+			}
+			if (pathArgStart < argc && strcmp(argv[pathArgStart], "--") == 0) {
+				pathArgStart++;
+			}
 
-			int newChanges = 0;
+			result = FIT_SetWorkingDirectoryFromFileStore(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to find file store [%s]. Does it exist?", fileStoreStr);
 
-			FIT_LOG(" ");
+			// Digests are in the metadata, none of the blobs are needed.
+			result = FIT_LoadFileStoreMetadataFromFile(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to load file store [%s]. Does it exist?", fileStoreStr);
 
-			result = FIT_PrepareSnapshotForSave(ctx);
-			FIT_ASSERT_LOG_RETURN(result, "TODO.");
+			FIT_Snapshot *from = FIT_GetSnapshotByIndex(ctx, strtol(fromIndexStr, NULL, 0));
+			FIT_ASSERT_LOG_RETURN(from, "The <snapIndex> argument [%s] does not refer to a valid snapshot.", fromIndexStr);
 
-			result = FIT_SaveFileStoreFromFile(ctx, ctx->fileStoreAbsolutePath.buffer);
-			FIT_ASSERT_LOG_RETURN(result, "TODO");
+			FIT_Snapshot *to = NULL;
+			if (toIndexStr) {
+				to = FIT_GetSnapshotByIndex(ctx, strtol(toIndexStr, NULL, 0));
+				FIT_ASSERT_LOG_RETURN(to, "The <snapIndex> argument [%s] does not refer to a valid snapshot.", toIndexStr);
+			}
+			else {
+				to = FIT_SnapshotWorkingDirectory(ctx);
+				FIT_ASSERT_LOG_RETURN(to, "Unable to read the working directory [%s].", ctx->workingDirectory.buffer);
+			}
 
+			FIT_Diff diff = {0};
+			result = FIT_DiffSnapshots(from, to, &diff);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to diff snapshot [%s] against [%s].", fromIndexStr, toIndexStr ? toIndexStr : "the working directory");
+
+			FIT_LOG(" ");
+			for (uint32_t i = 0; i < diff.itemCount; i++) {
+				FIT_DiffItem *item = &diff.items[i];
+				switch (item->kind) {
+				case FIT_DIFF_ADDED: FIT_LOG("  + %s", item->to->path); break;
+				case FIT_DIFF_REMOVED: FIT_LOG("  - %s", item->from->path); break;
+				case FIT_DIFF_MODIFIED: FIT_LOG("  ~ %s", item->to->path); break;
+				case FIT_DIFF_RENAMED: FIT_LOG("  > %s -> %s", item->from->path, item->to->path); break;
+				default: break;
+				}
+			}
 			FIT_LOG(" ");
+			FIT_LOG("%u added, %u removed, %u modified, %u renamed, %u unchanged.",
+				diff.addedCount, diff.removedCount, diff.modifiedCount, diff.renamedCount, diff.unchangedCount);
+
+			for (uint32_t i = 0; pathArgStart < argc && i < diff.itemCount; i++) {
+				FIT_DiffItem *item = &diff.items[i];
+				FIT_FileEntry *entry = item->to ? item->to : item->from;
+				if (item->kind == FIT_DIFF_RENAMED) {
+					continue;
+				}
 
-			if (!newChanges) {
-				FIT_LOG("No files have changes since the last snapshot.");
+				for (int arg = pathArgStart; arg < argc; arg++) {
+					if (FIT_PathMatchesPrefix(entry->path, entry->pathLen, argv[arg], strnlen(argv[arg], FIT_MAX_ENTRY_PATH))) {
+						FIT_LOG(" ");
+						result = FIT_WriteFileContentDiff(ctx, item->from, item->to, toIndexStr == NULL, stdout);
+						if (!result) {
+							FIT_LOG("Unable to show the changed lines of [%s].", entry->path);
+							FIT_DiffDeinit(&diff);
+							return 0;
+						}
+						break;
+					}
+				}
 			}
 
-			FIT_LOG("Saved snapshot [%d] to the file store.\n", ctx->fsData.snapshotCount - 1);
+			FIT_DiffDeinit(&diff);
 		}
+		else {
+			FIT_LOG("Usage: fit diff <fileStore> <snapIndex> [otherSnapIndex] [--] [paths or directories/...]");
+			FIT_LOG("Without [otherSnapIndex] the snapshot is compared with the tracked files in the working directory.");
+			FIT_LOG("The changed lines of the files under the given paths are shown as a unified diff.");
+			FIT_LOG("A path that is all digits is taken as [otherSnapIndex] unless it comes after a --.");
+		}
+
 		break;
 	}
-	case FIT_TRACK: {
+	case FIT_STATUS: {
 
 		if (argc >= 3) {
 
-			FIT_LOG(" ");
-
 			int result = 0;
-			
+
 			const char *fileStoreStr = argv[2];
 			FIT_ASSERT_LOG_RETURN(fileStoreStr, "The <fileStore> argument is a NULL.");
 
-			result = FIT_LoadFileStoreAndSetWorkingDirectory(ctx, fileStoreStr);
-			FIT_ASSERT_LOG_RETURN(result, "The store [%s] could not be opened. Does it exist?", fileStoreStr);
-
-			const char *fileTrackStr = argv[3];
-			FIT_ASSERT_LOG_RETURN(fileTrackStr, "The <fileToTrack> argument is a NULL.");
-
-			result = FIT_AppendPath(&ctx->workingDirectory, fileTrackStr, &ctx->trackedFileAbsolutePath);
-			FIT_ASSERT_LOG_RETURN(result, "Unable to append track filename to working directory path.");
-
-			FILE *fileToTrack = fopen(ctx->trackedFileAbsolutePath.buffer, "rb");
-			FIT_ASSERT_LOG_RETURN(fileToTrack, "Unable to open the [%s] file to track. Does this file exist?", ctx->trackedFileAbsolutePath.buffer);
-
-			result = fclose(fileToTrack);
-			FIT_ASSERT_LOG_RETURN(result == 0, "Unable to close the [%s] file.", ctx->trackedFileAbsolutePath.buffer);
-
-			// Check that the file is not already in the tracking list 
-			if (FIT_IsPathInTrackingList(ctx, fileTrackStr)) {
-				FIT_LOG("This file [%s] is already being tracked. Only one instance of a file can be tracked at a time.", fileTrackStr);
-			}
-			else {
-
-				FIT_FileEntry *entry = FIT_AllocateFileEntry(ctx);
-				FIT_ASSERT_LOG_RETURN(entry, "TODO");
-
-				size_t strLen = strnlen(fileTrackStr, FIT_MAX_PATH);
-				FIT_ASSERT_LOG_RETURN(strLen, "The path length of the specified tracked file is 0. This is an error.");
-
-				char *str = (char *)calloc(strLen + 1, sizeof(char));
-				FIT_ASSERT_LOG_RETURN(str, "Out of memory. Unable to allocate string.");
-				strncpy(str, fileTrackStr, strLen);
-				str[strLen] = '\0';
+			result = FIT_SetWorkingDirectoryFromFileStore(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to find file store [%s]. Does it exist?", fileStoreStr);
 
-				entry->path = str;
-				entry->pathLen = strLen;
+			result = FIT_LoadFileStoreMetadataFromFile(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to load file store [%s]. Does it exist?", fileStoreStr);
 
-				FIT_AddToTrackingList(ctx, entry);
+			FIT_Status status = {0};
+			result = FIT_GetStatus(ctx, 1, &status);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to get the status of file store [%s].", fileStoreStr);
 
-				result = FIT_SaveFileStoreFromFile(ctx, ctx->fileStoreAbsolutePath.buffer);
-				FIT_ASSERT_LOG_RETURN(result, "TODO");
+			FIT_LOG(" ");
+			for (uint32_t i = 0; i < status.itemCount; i++) {
+				FIT_StatusItem *item = &status.items[i];
+				switch (item->kind) {
+				case FIT_STATUS_NEW: FIT_LOG("  new:       %s", item->path); break;
+				case FIT_STATUS_MODIFIED: FIT_LOG("  modified:  %s", item->path); break;
+				case FIT_STATUS_DELETED: FIT_LOG("  deleted:   %s", item->path); break;
+				case FIT_STATUS_UNTRACKED: FIT_LOG("  untracked: %s", item->path); break;
+				}
+			}
 
-				FIT_LOG("The file [%s] is now being tracked by the store [%s]\n", entry->path, ctx->fileStoreAbsolutePath.buffer);
+			if (!ctx->fsData.snapshotCount) {
+				FIT_LOG("There are no snapshots yet, every tracked file is new.");
+			}
+			else if (status.newCount + status.modifiedCount + status.deletedCount == 0) {
+				FIT_LOG("Nothing has changed since snapshot [%u].", ctx->fsData.snapshotCount - 1);
+			}
+			else {
+				FIT_LOG(" ");
+				FIT_LOG("%u new, %u modified, %u deleted since snapshot [%u].", status.newCount, status.modifiedCount, status.deletedCount, ctx->fsData.snapshotCount - 1);
+			}
+			if (status.untrackedCount) {
+				FIT_LOG("%u files are not tracked. Use \"fit track\" to track them or list them in [%s] to hide them.", status.untrackedCount, FIT_IGNORE_FILE_NAME);
 			}
+
+			FIT_StatusDeinit(&status);
+		}
+		else {
+			FIT_LOG("Usage: fit status <fileStore>");
 		}
+
 		break;
 	}
-	case FIT_TRACK_ALL_SAVE: {
+	case FIT_HISTORY: {
 
-		if (argc >= 3) {
+		if (argc >= 4) {
 
 			int result = 0;
 
 			const char *fileStoreStr = argv[2];
 			FIT_ASSERT_LOG_RETURN(fileStoreStr, "The <fileStore> argument is a NULL.");
 
-			size_t fileStoreStrLen = strnlen(fileStoreStr, FIT_MAX_PATH);
-			FIT_ASSERT_LOG_RETURN(fileStoreStrLen, "The <fileStore> length is 0.");
+			const char *pathStr = argv[3];
+			FIT_ASSERT_LOG_RETURN(pathStr, "The <path> argument is a NULL.");
 
-			result = FIT_LoadFileStoreAndSetWorkingDirectory(ctx, fileStoreStr);
-			FIT_ASSERT_LOG_RETURN(result, "TODO");
+			result = FIT_LoadFileStoreMetadataFromFile(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to load file store [%s]. Does it exist?", fileStoreStr);
 
-			result = FIT_TrackAll(ctx, fileStoreStr, fileStoreStrLen);
-			FIT_ASSERT_LOG_RETURN(result, "TODO");
+			const FIT_FileHistory *history = FIT_GetFileHistory(ctx, pathStr, strnlen(pathStr, FIT_MAX_ENTRY_PATH));
+			if (!history) {
+				FIT_LOG("No snapshot has a file [%s].", pathStr);
+				break;
+			}
 
-			result = FIT_PrepareSnapshotForSave(ctx);
-			FIT_ASSERT_LOG_RETURN(result, "TODO.");
+			FIT_LOG(" ");
+			uint32_t changeCount = 0;
+			uint32_t distinctCount = 0;
+			for (uint32_t i = 0; i < history->versionCount; i++) {
+				const FIT_FileVersion *version = &history->versions[i];
+				const FIT_FileVersion *previous = i ? &history->versions[i - 1] : NULL;
+
+				int changed = !previous || strncmp(previous->entry->hash.buffer, version->entry->hash.buffer, FIT_BASE64_DIGEST_SIZE) != 0;
+				changeCount += changed && previous;
+
+				// A change back to older contents is not a new version.
+				int seen = 0;
+				for (uint32_t j = 0; changed && !seen && j + 1 < i; j++) {
+					seen = strncmp(history->versions[j].entry->hash.buffer, version->entry->hash.buffer, FIT_BASE64_DIGEST_SIZE) == 0;
+				}
+				distinctCount += changed && !seen;
 
-			result = FIT_SaveFileStoreFromFile(ctx, ctx->fileStoreAbsolutePath.buffer);
-			FIT_ASSERT_LOG_RETURN(result, "TODO");
+				FIT_LOG("  Snapshot [%u] %.12s %llu bytes%s", version->snapshot->index, version->entry->hash.buffer,
+					(unsigned long long)version->entry->offsetLen, changed ? "" : " (unchanged)");
+			}
+			FIT_LOG(" ");
+			FIT_LOG("[%s] is in %u snapshots with %u different versions, and changed %u times.", pathStr, history->versionCount, distinctCount, changeCount);
+		}
+		else {
+			FIT_LOG("Usage: fit history <fileStore> <path>");
 		}
 
 		break;
 	}
-	case FIT_CREATE_TRACK_ALL_SAVE: {
+	case FIT_SERVE: {
 
 		if (argc >= 3) {
-
-			int result = 0;
+			FIT_ASSERT_LOG_RETURN(!ctx->nonInteractive, "A file store cannot be served from here.");
 
 			const char *fileStoreStr = argv[2];
 			FIT_ASSERT_LOG_RETURN(fileStoreStr, "The <fileStore> argument is a NULL.");
 
-			size_t fileStoreStrLen = strnlen(fileStoreStr, FIT_MAX_PATH);
-			FIT_ASSERT_LOG_RETURN(fileStoreStrLen, "The <fileStore> length is 0.");
-
-			result = FIT_CheckFileStoreExists(ctx, fileStoreStr);
-			FIT_ASSERT_LOG_RETURN(!result, "This file store already exists %s", fileStoreStr);
-
-			result = FIT_SaveFileStoreFromFile(ctx, fileStoreStr);
-			FIT_ASSERT_LOG_RETURN(result, "TODO");
-
-			result = FIT_LoadFileStoreAndSetWorkingDirectory(ctx, fileStoreStr);
-			FIT_ASSERT_LOG_RETURN(result, "TODO");
+			int result = FIT_Serve(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to serve file store [%s].", fileStoreStr);
+		}
+		else {
+			FIT_LOG("Usage: fit serve <fileStore>");
+			FIT_LOG("Keeps the file store loaded and runs the commands sent with \"fit client\" until \"fit client stop <fileStore>\".");
+		}
 
-			result = FIT_TrackAll(ctx, fileStoreStr, fileStoreStrLen);
-			FIT_ASSERT_LOG_RETURN(result, "TODO");
+		break;
+	}
+	case FIT_CLIENT: {
 
-			result = FIT_PrepareSnapshotForSave(ctx);
-			FIT_ASSERT_LOG_RETURN(result, "TODO.");
+		if (argc >= 4) {
+			FIT_ASSERT_LOG_RETURN(!ctx->nonInteractive, "A client cannot be run from here.");
 
-			result = FIT_SaveFileStoreFromFile(ctx, ctx->fileStoreAbsolutePath.buffer);
-			FIT_ASSERT_LOG_RETURN(result, "TODO");
+			// The result of the command on the server is the result of this one.
+			return FIT_RunClient(argc - 2, &argv[2]);
+		}
+		else {
+			FIT_LOG("Usage: fit client <command> <fileStore> [arguments...]");
+			FIT_LOG("Runs the command on the server started with \"fit serve <fileStore>\", \"stop\" stops the server.");
 		}
 
 		break;
 	}
-	case FIT_TRACK_ALL: {
+	case FIT_WATCH: {
 
 		if (argc >= 3) {
+			FIT_ASSERT_LOG_RETURN(!ctx->nonInteractive, "A file store cannot be watched from here.");
 
-			int result = 0;
-			
 			const char *fileStoreStr = argv[2];
 			FIT_ASSERT_LOG_RETURN(fileStoreStr, "The <fileStore> argument is a NULL.");
 
-			size_t fileStoreStrLen = strnlen(fileStoreStr, FIT_MAX_PATH);
-			FIT_ASSERT_LOG_RETURN(fileStoreStrLen, "The <fileStore> length is 0.");
-
-			result = FIT_LoadFileStoreAndSetWorkingDirectory(ctx, fileStoreStr);
-			FIT_ASSERT_LOG_RETURN(result, "TODO");
-
-			result = FIT_TrackAll(ctx, fileStoreStr, fileStoreStrLen);
-			FIT_ASSERT_LOG_RETURN(result, "TODO");
-
-			for (FIT_FileEntry *entry = ctx->fsData.entryTrackingHead;
-				 entry != NULL;
-				 entry = entry->trackNext) {
-
-				FIT_LOG(" - Tracking [%s]", entry->path);
+			uint32_t quietMilliseconds = FIT_WATCH_DEFAULT_QUIET_MILLISECONDS;
+			if (argc >= 4) {
+				double seconds = strtod(argv[3], NULL);
+				FIT_ASSERT_LOG_RETURN(seconds > 0.0 && seconds < 86400.0, "The <quietSeconds> argument [%s] is not a number of seconds.", argv[3]);
+				quietMilliseconds = (uint32_t)(seconds * 1000.0);
 			}
 
-			result = FIT_SaveFileStoreFromFile(ctx, ctx->fileStoreAbsolutePath.buffer);
-			FIT_ASSERT_LOG_RETURN(result, "TODO");
+			int result = FIT_Watch(ctx, fileStoreStr, quietMilliseconds);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to watch file store [%s].", fileStoreStr);
+		}
+		else {
+			FIT_LOG("Usage: fit watch <fileStore> [quietSeconds]");
+			FIT_LOG("Saves a snapshot whenever the tracked files have not changed for [quietSeconds], 2 by default.");
 		}
+
 		break;
 	}
-	case FIT_LOAD: {
+	case FIT_BATCH: {
 
 		if (argc >= 3) {
-
-			int result = 0;
+			FIT_ASSERT_LOG_RETURN(!ctx->nonInteractive, "A batch cannot be run from here.");
 
 			const char *fileStoreStr = argv[2];
 			FIT_ASSERT_LOG_RETURN(fileStoreStr, "The <fileStore> argument is a NULL.");
 
-			size_t fileStoreStrLen = strnlen(fileStoreStr, FIT_MAX_PATH);
-			FIT_ASSERT_LOG_RETURN(fileStoreStrLen, "The <fileStore> length is 0.");
+			FILE *script = stdin;
+			if (argc >= 4 && strcmp(argv[3], "-") != 0) {
+				script = fopen(argv[3], "rb");
+				FIT_ASSERT_LOG_RETURN(script, "Unable to open the script [%s].", argv[3]);
+			}
 
-			result = FIT_LoadFileStoreAndSetWorkingDirectory(ctx, fileStoreStr);
-			FIT_ASSERT_LOG_RETURN(result, "Unable to load file store [%s]. Does it exist?", fileStoreStr);
+			int result = FIT_RunBatch(ctx, fileStoreStr, script);
+			if (script != stdin) {
+				fclose(script);
+			}
+			FIT_ASSERT_LOG_RETURN(result, "Unable to run the batch on file store [%s].", fileStoreStr);
+		}
+		else {
+			FIT_LOG("Usage: fit batch <fileStore> [script]");
+			FIT_LOG("Runs the commands in [script], or stdin, one per line without the store, e.g. \"track Content/a.png\".");
+		}
 
-			FIT_Snapshot *snapshot = NULL;
-			long int snapIndex = 0;
+		break;
+	}
+	case FIT_STATS: {
 
-			if (argc >= 4) {
-				const char *snapIndexStr = argv[3];
-				FIT_ASSERT_LOG_RETURN(snapIndexStr, "The <snapIndex> argument is a NULL.");
+		if (argc >= 3) {
 
-				snapIndex = strtol(snapIndexStr, NULL, 0);
+			const char *fileStoreStr = argv[2];
+			FIT_ASSERT_LOG_RETURN(fileStoreStr, "The <fileStore> argument is a NULL.");
 
-				long int curIndex = 0;
-				// this is slow
-				for (FIT_Snapshot *s = ctx->fsData.snapshotHead;
-					 s != NULL;
-					 s = s->next) {
-					if (curIndex++ == snapIndex) {
-						snapshot = s;
-						break;
-					}
+			uint32_t topPathCount = FIT_STORE_STATS_DEFAULT_TOP_PATHS;
+			int json = 0;
+			for (int i = 3; i < argc; i++) {
+				if (strcmp(argv[i], "--json") == 0) {
+					json = 1;
 				}
-				FIT_ASSERT_LOG_RETURN(snapshot, "The provided snapshot index does not reference any snapshot in the store. Omitting the index will load the latest snapshot.");
-			}
-			else {
-				snapshot = ctx->fsData.snapshotTail;
-			}
-
-			FIT_LOG("Loading a snapshot from this file store [%s] will load the following files:\n", fileStoreStr);
-			{
-				int index = 0;
-				for (FIT_FileEntry *entry = snapshot->entryHead;
-					 entry != NULL;
-					 entry = entry->snapNext) {
-					FIT_LOG(" - [%d] [%s] [%s]", index++, entry->path, entry->hash.buffer);
+				else {
+					topPathCount = (uint32_t)strtoul(argv[i], NULL, 0);
 				}
 			}
-			FIT_LOG("\n This may overwrite existing files in the working directory. Do you want to proceed? [Y/N]");
-			char c = getc(stdin);
 
-			if (c == 'y' || c == 'Y') {
-				for (FIT_FileEntry *entry = snapshot->entryHead;
-					 entry != NULL;
-					 entry = entry->snapNext) {
-
-					result = FIT_AppendPath(&ctx->workingDirectory, entry->path, &ctx->trackedFileAbsolutePath);
-					FIT_ASSERT_LOG_RETURN(result, "Unable to append entry relative path to working directory path.");
+			int result = FIT_LoadFileStoreMetadataFromFile(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to load file store [%s]. Does it exist?", fileStoreStr);
 
-					FILE *file = fopen(ctx->trackedFileAbsolutePath.buffer, "wb");
-					FIT_ASSERT_LOG_RETURN(file, "Unable to open file %s", ctx->trackedFileAbsolutePath.buffer);
+			FIT_StoreStats stats;
+			result = FIT_ComputeStoreStats(ctx, topPathCount, &stats);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to work out the stats of file store [%s].", fileStoreStr);
 
-					int result = fwrite(&ctx->fsData.buffer[entry->offset], entry->offsetLen, 1, file);
-					FIT_ASSERT_LOG_RETURN(result == 1, "TODO");
+			if (json) {
+				result = FIT_WriteStoreStatsJson(&stats, stdout);
+				FIT_StoreStatsDeinit(&stats);
+				FIT_ASSERT_LOG_RETURN(result, "Unable to write the stats of file store [%s].", fileStoreStr);
+				break;
+			}
 
-					result = fclose(file);
-					FIT_ASSERT_LOG_RETURN(result == 0, "TODO");
-				}
+			const double MB = 1024.0 * 1024.0;
+			FIT_LOG(" ");
+			FIT_LOG("[%s] holds %.1f MB. Its %u snapshots add up to %.1f MB of files, %.2f times that.",
+				fileStoreStr, stats.bufferBytes / MB, stats.snapshotCount, stats.logicalBytes / MB,
+				stats.bufferBytes ? (double)stats.logicalBytes / (double)stats.bufferBytes : 0.0);
+			FIT_LOG(" - %.1f MB no snapshot uses, in %u holes. The largest is %.1f MB.", stats.unreachableBytes / MB, stats.holeCount, stats.largestHoleBytes / MB);
+			FIT_LOG(" - %.1f MB in %llu of %llu blobs have the same contents as another blob.", stats.duplicateBytes / MB,
+				(unsigned long long)stats.duplicateBlobCount, (unsigned long long)stats.blobCount);
 
-				if (snapshot == ctx->fsData.snapshotTail) {
-					FIT_Log("Successfully loaded the latest snapshot");
-				}
-				else {
-					FIT_Log("Successfully loaded snapshot %d", snapIndex);
-				}
+			FIT_LOG(" ");
+			FIT_LOG("  snapshot      files     files MB     added MB");
+			for (uint32_t i = 0; i < stats.snapshotCount; i++) {
+				const FIT_SnapshotStoreStats *snapshot = &stats.snapshots[i];
+				FIT_LOG("  %8u %10u %12.1f %12.1f", i, snapshot->entryCount, snapshot->logicalBytes / MB, snapshot->addedBytes / MB);
 			}
-			else {
-				FIT_Log("Did not load any snapshot.");
+
+			FIT_LOG(" ");
+			FIT_LOG("  The %u paths taking the most space, of %u:", stats.topPathCount, stats.pathCount);
+			for (uint32_t i = 0; i < stats.topPathCount; i++) {
+				const FIT_PathStoreStats *path = &stats.topPaths[i];
+				FIT_LOG("  %10.1f MB  %4u blobs  %s", path->storedBytes / MB, path->blobCount, path->path);
 			}
+
+			FIT_StoreStatsDeinit(&stats);
+		}
+		else {
+			FIT_LOG("Usage: fit stats <fileStore> [topPathCount] [--json]");
 		}
 
 		break;
 	}
-	case FIT_SNAPS: {
+	case FIT_REPACK: {
 
 		if (argc >= 3) {
+
 			const char *fileStoreStr = argv[2];
 			FIT_ASSERT_LOG_RETURN(fileStoreStr, "The <fileStore> argument is a NULL.");
 
-			int result = FIT_LoadFileStoreFromFile(ctx, fileStoreStr);
-			FIT_ASSERT_LOG_RETURN(result, "TODO");
-
-			if (ctx->fsData.snapshotCount) {
-
-				FIT_LOG(" ");
-
-				int index = 0;
-				for (FIT_Snapshot *snap = ctx->fsData.snapshotHead;
-					 snap != NULL;
-					 snap = snap->next) {
-
-					if (index == ctx->fsData.snapshotCount - 1) {
-						FIT_LOG("------ %s | Snapshot [%d] [LATEST] ------\n", fileStoreStr, index++);
-					}
-					else {
-						FIT_LOG("------ %s | Snapshot [%d] ------\n", fileStoreStr, index++);
-					}
-
-					int entryIndex = 0;
-					for (FIT_FileEntry *entry = snap->entryHead;
-						 entry != NULL;
-						 entry = entry->snapNext) {
-						FIT_LOG(" - [%d] [%s] [%s] [%u]", entryIndex++, entry->path, entry->hash.buffer, entry->offset);
-					}
+			FIT_RepackResult repack;
+			int result = FIT_RepackFileStore(ctx, fileStoreStr, &repack);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to repack file store [%s].", fileStoreStr);
 
-					FIT_LOG(" ");
-				}
+			const double MB = 1024.0 * 1024.0;
+			FIT_LOG("Repacked [%s] from %.1f MB to %.1f MB.", fileStoreStr, repack.oldSize / MB, repack.newSize / MB);
+			FIT_LOG(" - %llu files in %u snapshots now share %llu blobs, %.1f MB of the buffer was unused or duplicated.",
+				(unsigned long long)repack.entryCount, ctx->fsData.snapshotCount, (unsigned long long)repack.blobCount,
+				(repack.oldBufferBytes - repack.newBufferBytes) / MB);
+		}
+		else {
+			FIT_LOG("Usage: fit repack <fileStore>");
+			FIT_LOG("Rewrites the store keeping one copy of each file's contents, in path order, and replaces the old one.");
+		}
 
+		break;
+	}
+	case FIT_PRUNE: {
+
+		FIT_RetentionPolicy policy = {0};
+		int valid = argc >= 5;
+		for (int i = 3; valid && i < argc; i += 2) {
+			uint32_t count = i + 1 < argc ? (uint32_t)strtoul(argv[i + 1], NULL, 0) : 0;
+			if (i + 1 >= argc) {
+				valid = 0;
+			}
+			else if (strcmp(argv[i], "--keep-last") == 0) {
+				policy.keepLast = count;
+			}
+			else if (strcmp(argv[i], "--keep-daily") == 0) {
+				policy.keepDaily = count;
+			}
+			else if (strcmp(argv[i], "--keep-weekly") == 0) {
+				policy.keepWeekly = count;
 			}
 			else {
-				FIT_LOG("There are no saved snap shots to look at.");
+				FIT_LOG("Unknown option [%s].", argv[i]);
+				valid = 0;
 			}
 		}
-		break;
-	}
-	case FIT_DELETE: {
 
-		if (argc >= 3) {
+		if (valid) {
 			const char *fileStoreStr = argv[2];
 			FIT_ASSERT_LOG_RETURN(fileStoreStr, "The <fileStore> argument is a NULL.");
 
 			int result = FIT_LoadFileStoreAndSetWorkingDirectory(ctx, fileStoreStr);
 			FIT_ASSERT_LOG_RETURN(result, "Unable to load the file store [%s]", fileStoreStr);
 
-			if (ctx->fsData.snapshotCount == 0) {
-				FIT_LOG("There are no snapshots to delete");
-			}
-			else {
+			uint64_t oldBufferCount = ctx->fsData.bufferCount;
+			uint32_t prunedCount = 0;
+			result = FIT_PruneSnapshots(ctx, &policy, &prunedCount);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to prune the file store [%s]", fileStoreStr);
 
-				FIT_Snapshot *snapToDelete = NULL; ctx->fsData.snapshotTail;
+			if (prunedCount == 0) {
+				FIT_LOG("Every snapshot is kept, nothing to remove.");
+				break;
+			}
 
-				if (argc >= 4) {
-					const char *snapIndexStr = argv[3];
-					FIT_ASSERT_LOG_RETURN(snapIndexStr, "The <snapIndex> argument is a NULL.");
-					long int snapIndex = strtol(snapIndexStr, NULL, 0);
+			result = FIT_SaveFileStoreFromFile(ctx, ctx->fileStoreAbsolutePath.buffer);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to save the file store [%s]", ctx->fileStoreAbsolutePath.buffer);
 
-					long int index = 0;
-					for (FIT_Snapshot *snap = ctx->fsData.snapshotHead;
-						 snap != NULL;
-						 snap = snap->next) {
-						if (index == snapIndex) {
-							snapToDelete = snap;
-							break;
-						}
-						index++;
-					}
+			FIT_LOG("Removed %u snapshots and %.1f MB, %u snapshots are left.", prunedCount,
+				(oldBufferCount - ctx->fsData.bufferCount) / (1024.0 * 1024.0), ctx->fsData.snapshotCount);
+		}
+		else {
+			FIT_LOG("Usage: fit prune <fileStore> [--keep-last N] [--keep-daily D] [--keep-weekly W]");
+			FIT_LOG("Removes every snapshot that is not one of the last N, the newest of each of the last D days or the newest of each of the last W weeks.");
+		}
 
-					FIT_ASSERT_LOG_RETURN(snapToDelete, "The <snapIndex> argument does not refer to a valid snapshot.");
-				}
-				else {
-					snapToDelete = ctx->fsData.snapshotTail;
-				}
+		break;
+	}
+	case FIT_VERIFY: {
 
+		if (argc == 3 || (argc == 5 && strcmp(argv[3], "--snapshot") == 0)) {
 
-				for (FIT_FileEntry *entry = snapToDelete->entryHead;
-					 entry != NULL;) {
-					FIT_FileEntry *entryNext = entry->snapNext;
-						 {
-							 int index = 0;
-							 for (FIT_Snapshot *snap = ctx->fsData.snapshotHead;
-								  snap != NULL;
-								  snap = snap->next) {
-
-								 if (index == ctx->fsData.snapshotCount - 1) {
-									 FIT_LOG("------ %s | Snapshot [%d] [LATEST] ------\n", fileStoreStr, index++);
-								 }
-								 else {
-									 FIT_LOG("------ %s | Snapshot [%d] ------\n", fileStoreStr, index++);
-								 }
-
-								 int entryIndex = 0;
-								 for (FIT_FileEntry *entry = snap->entryHead;
-									  entry != NULL;
-									  entry = entry->snapNext) {
-									 FIT_LOG(" - [%d] [%s] [%s] [%u]", entryIndex++, entry->path, entry->hash.buffer, entry->offset);
-								 }
-
-								 FIT_LOG(" ");
-							 }
-						 }
-
-
-					// Check if there are any more records of this 
-					// file entry ahead with the same buffer offset.
-					// If not then we can safely delete the contents of the buffer at this 
-					// offset
-
-					int offsetExistsSomewhereElse = 0;
-					FIT_Snapshot *snap = snapToDelete->next;
-					while (snap) {
-						// Find this current entry in any new snaps
-						for (FIT_FileEntry *b = snap->entryHead;
-							 b != NULL;
-							 b = b->snapNext) {
-
-							if (strncmp(entry->path, b->path, entry->pathLen) == 0) {
-
-								// check if there is another entry that has the same offset.
-								if (entry->offset == b->offset) {
-									offsetExistsSomewhereElse = 1;
-									break;
-								}
-							}
-						}
-						if (offsetExistsSomewhereElse) {
-							break;
-						}
-						snap = snap->next;
-					}
+			const char *fileStoreStr = argv[2];
+			FIT_ASSERT_LOG_RETURN(fileStoreStr, "The <fileStore> argument is a NULL.");
 
-					if (!offsetExistsSomewhereElse) {
+			int result = FIT_LoadFileStoreMetadataFromFile(ctx, fileStoreStr);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to load file store [%s]. Does it exist?", fileStoreStr);
 
-						FIT_LOG("about to delete %s %u", entry->path, entry->offsetLen);
+			FIT_Snapshot *snapshot = NULL;
+			if (argc == 5) {
+				snapshot = FIT_GetSnapshotByIndex(ctx, strtol(argv[4], NULL, 0));
+				FIT_ASSERT_LOG_RETURN(snapshot, "The snapshot [%s] does not refer to a valid snapshot.", argv[4]);
+			}
 
-						// Now we need to move the buffer by this hole in the buffer
-						uint64_t holeOffset = entry->offset;
-						uint64_t holeSize = entry->offsetLen;
+			uint64_t start = FIT_GetTimeNanoseconds();
+			FIT_VerifyResult verify;
+			result = FIT_VerifyFileStore(ctx, snapshot, &verify);
+			FIT_ASSERT_LOG_RETURN(result, "Unable to verify file store [%s].", fileStoreStr);
+			double seconds = (FIT_GetTimeNanoseconds() - start) / 1e9;
+
+			FIT_LOG("Checked %llu blobs, %.1f MB in %.1f s.", (unsigned long long)verify.blobCount,
+				verify.bytesChecked / (1024.0 * 1024.0), seconds);
+			FIT_ASSERT_LOG_RETURN(verify.corruptBlobCount == 0, "%llu blobs are corrupt, used by %llu files in %u snapshots.",
+				(unsigned long long)verify.corruptBlobCount, (unsigned long long)verify.corruptEntryCount, verify.corruptSnapshotCount);
+			FIT_LOG("Every blob matches its digest.");
+		}
+		else {
+			FIT_LOG("Usage: fit verify <fileStore> [--snapshot N]");
+			FIT_LOG("Rehashes the contents of every file in the store, or in snapshot N, and lists the ones that do not match.");
+		}
 
-						char *offset = &ctx->fsData.buffer[holeOffset];
-						char *nextOffset = &ctx->fsData.buffer[holeOffset + holeSize];
+		break;
+	}
+	}
 
-						uint64_t size = ctx->fsData.bufferCount - (holeOffset + holeSize);
+	return 1;
+}
 
-						FIT_LOG("holeoffset [%u]", holeOffset);
-						FIT_LOG("hole size [%u]", holeSize);
-						FIT_LOG("size [%u]", size);
-						FIT_LOG("buffco [%u]", ctx->fsData.bufferCount);
+int FIT_Run(FIT_Context *ctx, int argc, char *argv[]) {
+	FIT_SHOULD_NOT_BE_NULL(ctx);
 
-						if (size) {
-							memmove(offset, nextOffset, size);
-						}
-						ctx->fsData.bufferCount -= holeSize;
-
-						FIT_RemoveFromSnapshotFileEntryList(snapToDelete, entry);
-
-						// fix up all the pointers after the snap we want to delete.
-						for (FIT_Snapshot *snap = snapToDelete;
-							 snap != NULL;
-							 snap = snap->next) {
-							for (FIT_FileEntry *b = snap->entryHead;
-								 b != NULL;
-								 b = b->snapNext) {
-								assert(b->offset != holeOffset);
-
-								if (b->offset > holeOffset) {
-									b->offset -= holeSize;
-								}
-							}
-						}
-					}
+	// Options can go anywhere after the program name, the command never sees them.
+	int stats = 0;
+	const char *tracePath = NULL;
+	int kept = 0;
+	for (int i = 0; i < argc; i++) {
+		if (i > 0 && argv[i] && strcmp(argv[i], "--stats") == 0) {
+			stats = 1;
+			continue;
+		}
+		if (i > 0 && argv[i] && strcmp(argv[i], "--trace") == 0) {
+			FIT_ASSERT_LOG_RETURN(i + 1 < argc && argv[i + 1], "--trace needs the file to write the trace to.");
+			tracePath = argv[++i];
+			continue;
+		}
+		argv[kept++] = argv[i];
+	}
+	if (kept < argc) {
+		argv[kept] = NULL;
+	}
 
-					entry = entryNext;
-				}
-		
-				// now remove the snap shot from the snap shot list
-				FIT_RemoveFromSnapshotList(ctx, snapToDelete);
+	if (stats) {
+		FIT_ResetStats();
+		FIT_EnableStats(1);
+	}
+	if (tracePath && !FIT_StartTrace(FIT_TRACE_DEFAULT_EVENT_COUNT)) {
+		tracePath = NULL;
+	}
 
-				result = FIT_SaveFileStoreFromFile(ctx, ctx->fileStoreAbsolutePath.buffer);
-				FIT_ASSERT_LOG_RETURN(result, "Unable to save the file store [%s]", ctx->fileStoreAbsolutePath.buffer);
+	uint8_t wasLocked = ctx->storeLocked;
+	uint64_t traceStart = FIT_TraceBegin();
+	int result = FIT_RunCommand(ctx, kept, argv);
+	FIT_TraceEnd("command", traceStart, kept > 1 ? argv[1] : NULL);
 
-				FIT_LOG("Removed the snapshot");
-			}
-		}
+	// A command run inside a batch leaves the lock to the batch.
+	if (!wasLocked) {
+		FIT_UnlockFileStore(ctx);
+	}
 
-		break;
+	if (stats) {
+		FIT_Stats collected;
+		FIT_GetStats(&collected);
+		FIT_LogStats(&collected);
+		FIT_EnableStats(0);
 	}
+	if (tracePath) {
+		result = FIT_FinishTrace(tracePath) && result;
 	}
 
-	return 1;
+	return result;
 }
 #endif
 
@@ -0,0 +1,253 @@
+#define FIT_IMPLEMENTATION
+#include "fit.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define FIT_HASHBENCH_CYCLES 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define FIT_HASHBENCH_CYCLES 1
+#else
+#define FIT_HASHBENCH_CYCLES 0
+#endif
+
+// Measures how fast the SHA-1 kernels, FIT_HashBuffer and FIT_DigestToBase64 are, for messages
+// from empty up to 1GB, and checks every kernel against the FIT_Sha1Test vectors first. Build it
+// like main.c and run
+//
+//   hashbench [--max-size bytes] [--seconds s] [--out results.json]
+//
+// Cycles are read from the time stamp counter, which counts at a fixed rate on current x86 CPUs,
+// so cycles per byte are in those reference cycles. They are left out on other CPUs.
+
+typedef void (*FIT_Sha1Proc)(const char *message, size_t messageLen, FIT_Sha1Digest *digest);
+
+typedef struct FIT_HashBackend {
+	const char *name;
+	FIT_Sha1Proc proc;
+} FIT_HashBackend;
+
+// The first backend is the one FIT_HashBuffer uses, and the others are checked against it.
+// New kernels go here.
+static const FIT_HashBackend FIT_HASH_BACKENDS[] = {
+	{ "portable", FIT_DoSha1 },
+};
+#define FIT_HASH_BACKEND_COUNT (sizeof(FIT_HASH_BACKENDS) / sizeof(FIT_HASH_BACKENDS[0]))
+
+static const uint64_t FIT_HASHBENCH_SIZES[] = {
+	0, 1, 55, 64, 1024, 4 * 1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024, 256 * 1024 * 1024, 1024 * 1024 * 1024,
+};
+#define FIT_HASHBENCH_SIZE_COUNT (sizeof(FIT_HASHBENCH_SIZES) / sizeof(FIT_HASHBENCH_SIZES[0]))
+
+typedef struct FIT_HashTiming {
+	uint64_t calls;
+	uint64_t nanoseconds;
+	uint64_t cycles;
+} FIT_HashTiming;
+
+static uint64_t FIT_HashBenchCycles(void) {
+#if FIT_HASHBENCH_CYCLES
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+// Keeps the results alive, so the calls being timed are not optimised away.
+static volatile uint8_t FIT_hashBenchSink;
+
+typedef enum FIT_HashBenchKind {
+	FIT_HASHBENCH_SHA1,
+	FIT_HASHBENCH_HASH_BUFFER,
+	FIT_HASHBENCH_BASE64,
+} FIT_HashBenchKind;
+
+// Repeats the call until [seconds] have passed, at least twice, and keeps the fastest call.
+static void FIT_HashBenchTime(FIT_HashBenchKind kind, FIT_Sha1Proc proc, char *buffer, uint64_t size, double seconds, FIT_HashTiming *timing) {
+	memset(timing, 0, sizeof(FIT_HashTiming));
+
+	uint64_t budget = (uint64_t)(seconds * 1e9);
+	uint64_t begin = FIT_GetTimeNanoseconds();
+	uint64_t best = UINT64_MAX;
+	uint64_t bestCycles = 0;
+	uint64_t batch = 1;
+
+	for (uint64_t round = 0; round < 2 || FIT_GetTimeNanoseconds() - begin < budget; round++) {
+		FIT_Sha1Digest digest = {0};
+		FIT_Base64Digest base64 = {0};
+
+		// Small messages are timed in batches, one call is too short for the clock.
+		uint64_t start = FIT_GetTimeNanoseconds();
+		uint64_t startCycles = FIT_HashBenchCycles();
+		for (uint64_t i = 0; i < batch; i++) {
+			switch (kind) {
+			case FIT_HASHBENCH_SHA1: proc(buffer, (size_t)size, &digest); break;
+			case FIT_HASHBENCH_HASH_BUFFER: FIT_HashBuffer(&base64, buffer, size); break;
+			case FIT_HASHBENCH_BASE64: digest.bytes[0] = (uint8_t)i; FIT_DigestToBase64(&digest, &base64); break;
+			}
+		}
+		uint64_t cycles = FIT_HashBenchCycles() - startCycles;
+		uint64_t elapsed = FIT_GetTimeNanoseconds() - start;
+		FIT_hashBenchSink ^= digest.bytes[0] ^ (uint8_t)base64.buffer[0];
+
+		timing->calls += batch;
+		if (elapsed < 1000000 && batch < (1ull << 30)) {
+			batch *= 2;
+			continue;
+		}
+		if (elapsed / batch < best) {
+			best = elapsed / batch;
+			bestCycles = cycles / batch;
+		}
+	}
+
+	timing->nanoseconds = best == UINT64_MAX ? 0 : best;
+	timing->cycles = bestCycles;
+}
+
+static void FIT_HashBenchWriteTiming(FILE *out, const char *name, uint64_t size, const FIT_HashTiming *timing, int last) {
+	double gigabytesPerSecond = timing->nanoseconds ? (double)size / (double)timing->nanoseconds : 0.0;
+	fprintf(out, "\t\t\t\t{ \"function\": \"%s\", \"bytes\": %llu, \"nanosecondsPerCall\": %llu, \"gigabytesPerSecond\": %.3f, ",
+		name, (unsigned long long)size, (unsigned long long)timing->nanoseconds, gigabytesPerSecond);
+	if (FIT_HASHBENCH_CYCLES && size) {
+		fprintf(out, "\"cyclesPerByte\": %.2f }", (double)timing->cycles / (double)size);
+	}
+	else {
+		fprintf(out, "\"cyclesPerByte\": null }");
+	}
+	fprintf(out, "%s\n", last ? "" : ",");
+
+	fprintf(stderr, "  %-15s %11llu B %12llu ns %8.3f GB/s", name, (unsigned long long)size, (unsigned long long)timing->nanoseconds, gigabytesPerSecond);
+	if (FIT_HASHBENCH_CYCLES && size) {
+		fprintf(stderr, " %8.2f cycles/B", (double)timing->cycles / (double)size);
+	}
+	fprintf(stderr, "\n");
+}
+
+// The test vectors first, then every size against the first backend.
+static int FIT_HashBenchCheckBackend(const FIT_HashBackend *backend, char *buffer, uint64_t maxSize) {
+	for (int i = 0; i < FIT_SHA1_TEST_VECTOR_COUNT; i++) {
+		const FIT_Sha1TestVector *vector = &FIT_SHA1_TEST_VECTORS[i];
+		FIT_Sha1Digest digest = {0};
+		FIT_Base64Digest base64 = {0};
+		backend->proc(vector->message, strlen(vector->message), &digest);
+		FIT_DigestToBase64(&digest, &base64);
+		if (strcmp(base64.buffer, vector->base64Digest) != 0) {
+			fprintf(stderr, "The %s backend hashes [%s] to [%s], it should be [%s].\n", backend->name, vector->message, base64.buffer, vector->base64Digest);
+			return 0;
+		}
+	}
+
+	if (backend == &FIT_HASH_BACKENDS[0]) {
+		return 1;
+	}
+	for (uint32_t i = 0; i < FIT_HASHBENCH_SIZE_COUNT && FIT_HASHBENCH_SIZES[i] <= maxSize; i++) {
+		FIT_Sha1Digest expected = {0};
+		FIT_Sha1Digest digest = {0};
+		FIT_HASH_BACKENDS[0].proc(buffer, (size_t)FIT_HASHBENCH_SIZES[i], &expected);
+		backend->proc(buffer, (size_t)FIT_HASHBENCH_SIZES[i], &digest);
+		if (memcmp(expected.bytes, digest.bytes, FIT_SHA1_DIGEST_SIZE) != 0) {
+			fprintf(stderr, "The %s backend does not match the %s backend for %llu bytes.\n", backend->name, FIT_HASH_BACKENDS[0].name, (unsigned long long)FIT_HASHBENCH_SIZES[i]);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t maxSize = 1024 * 1024 * 1024;
+	double seconds = 0.5;
+	const char *outPath = NULL;
+
+	for (int i = 1; i < argc; i += 2) {
+		if (i + 1 >= argc) {
+			printf("hashbench [--max-size bytes] [--seconds s] [--out results.json]\n");
+			return 1;
+		}
+		if (strcmp(argv[i], "--max-size") == 0) {
+			maxSize = strtoull(argv[i + 1], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--seconds") == 0) {
+			seconds = strtod(argv[i + 1], NULL);
+		}
+		else if (strcmp(argv[i], "--out") == 0) {
+			outPath = argv[i + 1];
+		}
+		else {
+			printf("Unknown option [%s].\n", argv[i]);
+			return 1;
+		}
+	}
+
+	char *buffer = (char *)malloc(maxSize ? maxSize : 1);
+	if (!buffer) {
+		printf("Out of memory. Unable to allocate %llu bytes, try a smaller --max-size.\n", (unsigned long long)maxSize);
+		return 1;
+	}
+	uint64_t state = 0x9E3779B97F4A7C15ull;
+	for (uint64_t i = 0; i < maxSize; i++) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		buffer[i] = (char)state;
+	}
+
+	for (uint32_t i = 0; i < FIT_HASH_BACKEND_COUNT; i++) {
+		if (!FIT_HashBenchCheckBackend(&FIT_HASH_BACKENDS[i], buffer, maxSize)) {
+			free(buffer);
+			return 1;
+		}
+	}
+
+	FILE *out = outPath ? fopen(outPath, "w") : stdout;
+	if (!out) {
+		printf("Unable to open [%s] to write the results.\n", outPath);
+		free(buffer);
+		return 1;
+	}
+
+	uint32_t sizeCount = 0;
+	while (sizeCount < FIT_HASHBENCH_SIZE_COUNT && FIT_HASHBENCH_SIZES[sizeCount] <= maxSize) {
+		sizeCount++;
+	}
+
+	fprintf(out, "{\n");
+	fprintf(out, "\t\"testVectorsPassed\": true,\n");
+	fprintf(out, "\t\"cycleCounter\": %s,\n", FIT_HASHBENCH_CYCLES ? "\"tsc\"" : "null");
+	fprintf(out, "\t\"backends\": [\n");
+
+	for (uint32_t b = 0; b < FIT_HASH_BACKEND_COUNT; b++) {
+		const FIT_HashBackend *backend = &FIT_HASH_BACKENDS[b];
+		fprintf(stderr, "%s\n", backend->name);
+		fprintf(out, "\t\t{\n");
+		fprintf(out, "\t\t\t\"name\": \"%s\",\n", backend->name);
+		fprintf(out, "\t\t\t\"results\": [\n");
+
+		// FIT_HashBuffer and the base64 step do not depend on the kernel, so only the first backend times them.
+		FIT_HashTiming timing;
+		for (uint32_t i = 0; i < sizeCount; i++) {
+			FIT_HashBenchTime(FIT_HASHBENCH_SHA1, backend->proc, buffer, FIT_HASHBENCH_SIZES[i], seconds, &timing);
+			FIT_HashBenchWriteTiming(out, "FIT_DoSha1", FIT_HASHBENCH_SIZES[i], &timing, b > 0 && i + 1 == sizeCount);
+		}
+		if (b == 0) {
+			for (uint32_t i = 0; i < sizeCount; i++) {
+				FIT_HashBenchTime(FIT_HASHBENCH_HASH_BUFFER, NULL, buffer, FIT_HASHBENCH_SIZES[i], seconds, &timing);
+				FIT_HashBenchWriteTiming(out, "FIT_HashBuffer", FIT_HASHBENCH_SIZES[i], &timing, 0);
+			}
+			FIT_HashBenchTime(FIT_HASHBENCH_BASE64, NULL, buffer, FIT_SHA1_DIGEST_SIZE, seconds, &timing);
+			FIT_HashBenchWriteTiming(out, "FIT_DigestToBase64", FIT_SHA1_DIGEST_SIZE, &timing, 1);
+		}
+
+		fprintf(out, "\t\t\t]\n");
+		fprintf(out, "\t\t}%s\n", b + 1 < FIT_HASH_BACKEND_COUNT ? "," : "");
+	}
+
+	fprintf(out, "\t]\n");
+	fprintf(out, "}\n");
+	if (out != stdout) {
+		fclose(out);
+	}
+
+	free(buffer);
+	return 0;
+}
@@ -0,0 +1,144 @@
+#define FIT_IMPLEMENTATION
+#include "fit.h"
+
+// Runs the commands on small trees, for the cases that broke a store before. Build it like main.c
+// and run
+//
+//   test <scratch dir>
+//
+// Each case gets its own directory below <scratch dir> and finishes with a verify of the store.
+// It returns 0 when every case passes.
+
+typedef struct FIT_TestFile {
+	const char *name;
+	const char *contents;
+} FIT_TestFile;
+
+#define FIT_TEST_MAX_FILES 8
+
+typedef struct FIT_TestCase {
+	const char *name;
+	// the tree for the first snapshot, then the files changed for the second
+	FIT_TestFile files[FIT_TEST_MAX_FILES];
+	FIT_TestFile changes[FIT_TEST_MAX_FILES];
+	const char *deleteIndex;
+	// repack, delete and verify on one context that has the store loaded already, as fit serve does
+	int loaded;
+} FIT_TestCase;
+
+// Repack puts the blobs in path order and stores identical contents once, so delete can not assume
+// each path has its own blobs in save order.
+static const FIT_TestCase FIT_TEST_CASES[] = {
+	{ "repack-delete-newest", { { "a", "a1" }, { "b", "b1" } }, { { "a", "a2 changed" } }, "1", 0 },
+	{ "repack-delete-oldest", { { "a", "a1" }, { "b", "b1" } }, { { "a", "a2 changed" } }, "0", 0 },
+	{ "repack-delete-shared", { { "a", "a1" }, { "b", "same" }, { "c", "same" } }, { { "a", "a2 changed" } }, "1", 0 },
+	{ "repack-delete-shared-oldest", { { "a", "a1" }, { "b", "same" }, { "c", "same" } }, { { "b", "b2 changed" } }, "0", 0 },
+	{ "repack-delete-loaded", { { "a", "a1" }, { "b", "same" }, { "c", "same" } }, { { "a", "a2 changed" } }, "1", 1 },
+};
+#define FIT_TEST_CASE_COUNT (sizeof(FIT_TEST_CASES) / sizeof(FIT_TEST_CASES[0]))
+
+static char FIT_testLastMessage[FIT_MAX_ENTRY_PATH + 1024];
+
+static void FIT_TestKeepLastLog(const char *message, void *user) {
+	(void)user;
+	strncpy(FIT_testLastMessage, message, sizeof(FIT_testLastMessage) - 1);
+}
+
+static int FIT_TestMakeDirectory(const char *path) {
+#ifdef _WIN32
+	return CreateDirectoryA(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+	return mkdir(path, 0777) == 0 || errno == EEXIST;
+#endif
+}
+
+static int FIT_TestWriteFiles(const char *root, const FIT_TestFile *files) {
+	for (uint32_t i = 0; i < FIT_TEST_MAX_FILES && files[i].name; i++) {
+		char path[FIT_MAX_PATH];
+		snprintf(path, sizeof(path), "%s/%s", root, files[i].name);
+		FILE *file = fopen(path, "wb");
+		FIT_ASSERT_LOG_RETURN(file, "Unable to open [%s] to write.", path);
+		size_t len = strlen(files[i].contents);
+		int result = fwrite(files[i].contents, len, 1, file) == 1;
+		result = (fclose(file) == 0) && result;
+		FIT_ASSERT_LOG_RETURN(result, "Unable to write [%s].", path);
+	}
+	return 1;
+}
+
+static int FIT_TestRunCommand(int argc, char *argv[]) {
+	FIT_Context ctx;
+	FIT_ContextInit(&ctx);
+	ctx.nonInteractive = 1;
+	int result = FIT_Run(&ctx, argc, argv);
+	FIT_ContextDeinit(&ctx);
+	return result;
+}
+
+static int FIT_TestRunLoaded(const char *storePath, char *repackArgs[], char *deleteArgs[], char *verifyArgs[]) {
+	FIT_Context ctx;
+	FIT_ContextInit(&ctx);
+	ctx.nonInteractive = 1;
+	int result = FIT_LoadFileStoreAndSetWorkingDirectory(&ctx, storePath);
+	result = result && FIT_Run(&ctx, 3, repackArgs);
+	result = result && FIT_Run(&ctx, 4, deleteArgs);
+	result = result && FIT_Run(&ctx, 3, verifyArgs);
+	FIT_ContextDeinit(&ctx);
+	return result;
+}
+
+static int FIT_TestRunCase(const char *scratchDir, const FIT_TestCase *testCase) {
+	char root[FIT_MAX_PATH];
+	char storePath[FIT_MAX_PATH];
+	int len = snprintf(root, sizeof(root), "%s/%s", scratchDir, testCase->name);
+	FIT_ASSERT_LOG_RETURN(len > 0 && len + 32 < FIT_MAX_PATH, "The scratch directory [%s] is too long.", scratchDir);
+	snprintf(storePath, sizeof(storePath), "%.*s/test.fit", len, root);
+	FIT_ASSERT_LOG_RETURN(FIT_TestMakeDirectory(root), "Unable to make directory [%s].", root);
+	remove(storePath);
+
+	char *createArgs[] = { "fit", "create_track_all_save", storePath };
+	char *saveArgs[] = { "fit", "save", storePath };
+	char *repackArgs[] = { "fit", "repack", storePath };
+	char *deleteArgs[] = { "fit", "delete", storePath, (char *)testCase->deleteIndex };
+	char *verifyArgs[] = { "fit", "verify", storePath };
+
+	FIT_ASSERT_LOG_RETURN(FIT_TestWriteFiles(root, testCase->files), "Unable to write the tree.");
+	FIT_ASSERT_LOG_RETURN(FIT_TestRunCommand(3, createArgs), "create_track_all_save failed: %s", FIT_testLastMessage);
+	// The changes are a different size, so the save sees them even within the same second.
+	FIT_ASSERT_LOG_RETURN(FIT_TestWriteFiles(root, testCase->changes), "Unable to write the changes.");
+	FIT_ASSERT_LOG_RETURN(FIT_TestRunCommand(3, saveArgs), "save failed: %s", FIT_testLastMessage);
+	if (testCase->loaded) {
+		FIT_ASSERT_LOG_RETURN(FIT_TestRunLoaded(storePath, repackArgs, deleteArgs, verifyArgs), "loaded repack, delete and verify failed: %s", FIT_testLastMessage);
+	}
+	else {
+		FIT_ASSERT_LOG_RETURN(FIT_TestRunCommand(3, repackArgs), "repack failed: %s", FIT_testLastMessage);
+		FIT_ASSERT_LOG_RETURN(FIT_TestRunCommand(4, deleteArgs), "delete failed: %s", FIT_testLastMessage);
+	}
+	FIT_ASSERT_LOG_RETURN(FIT_TestRunCommand(3, verifyArgs), "verify failed: %s", FIT_testLastMessage);
+	return 1;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2 || argv[1][0] == '-') {
+		printf("test <scratch dir>\n");
+		return 1;
+	}
+	if (!FIT_TestMakeDirectory(argv[1])) {
+		printf("Unable to make directory [%s].\n", argv[1]);
+		return 1;
+	}
+
+	uint32_t failedCount = 0;
+	for (uint32_t i = 0; i < FIT_TEST_CASE_COUNT; i++) {
+		FIT_testLastMessage[0] = '\0';
+		FIT_SetLogProc(FIT_TestKeepLastLog, NULL);
+		int result = FIT_TestRunCase(argv[1], &FIT_TEST_CASES[i]);
+		FIT_SetLogProc(NULL, NULL);
+		printf("%s %s\n", result ? "pass" : "FAIL", FIT_TEST_CASES[i].name);
+		if (!result) {
+			printf("  %s\n", FIT_testLastMessage);
+			failedCount++;
+		}
+	}
+	return failedCount ? 1 : 0;
+}